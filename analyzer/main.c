@@ -0,0 +1,144 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../src/include/cpu.h"
+#include "../src/include/disasm.h"
+#include "../src/include/analysis.h"
+
+/*
+ * Analyze a ROM, and write the sidecar file used by the -a option of the
+ * emulator and the host. See analysis.h.
+ */
+
+static uint8_t rom[MEM_SZ - ROM_LOAD_ADDR];
+static size_t rom_sz;
+
+static void usage(const char* self) {
+    fprintf(stderr,
+            "Usage: %s [options] <rom>\n"
+            "Options:\n"
+            "  -o FILE  Output file (default: the ROM name with %s)\n"
+            "  -l       Print the disassembly of the code, and the data\n",
+            self, ANALYSIS_EXT);
+    exit(1);
+}
+
+/* Print the instructions and the data bytes of the ROM, in order. Instructions
+ * that overlap the previous one are shown on their own. */
+static void print_listing(const RomAnalysis* an) {
+    const int rom_end = ROM_LOAD_ADDR + rom_sz;
+
+    for (int addr = ROM_LOAD_ADDR; addr < rom_end; addr++) {
+        const uint8_t flags = an->flags[addr];
+
+        if (flags & ANALYSIS_CALL)
+            printf("\nsub_%03X:\n", addr);
+        else if (flags & ANALYSIS_JUMP)
+            printf("loc_%03X:\n", addr);
+
+        if (flags & ANALYSIS_CODE) {
+            const uint16_t opcode = (rom[addr - ROM_LOAD_ADDR] << 8) |
+                                    rom[addr + 1 - ROM_LOAD_ADDR];
+
+            char str[DISASM_SZ];
+            disasm(opcode, str, sizeof(str));
+            printf("%03X:\t%04X\t%s%s%s\n", addr, opcode, str,
+                   (flags & ANALYSIS_WRITTEN) ? "\t; written" : "",
+                   (flags & ANALYSIS_INDIRECT) ? "\t; indirect" : "");
+        } else if (!analysis_is_code(an, addr)) {
+            /* Up to 8 bytes of data on each line */
+            printf("%03X:\tdb", addr);
+            for (int i = 0; i < 8 && addr < rom_end; i++, addr++) {
+                printf("%s%02X", (i > 0) ? ", " : " ",
+                       rom[addr - ROM_LOAD_ADDR]);
+
+                if (addr + 1 < rom_end &&
+                    (analysis_is_code(an, addr + 1) ||
+                     (an->flags[addr + 1] & (ANALYSIS_JUMP | ANALYSIS_CALL))))
+                    break;
+            }
+            putchar('\n');
+            addr--;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* output = NULL;
+    bool listing       = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:l")) != -1) {
+        switch (opt) {
+            case 'o': {
+                output = optarg;
+            } break;
+
+            case 'l': {
+                listing = true;
+            } break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+        usage(argv[0]);
+
+    const char* rom_filename = argv[optind];
+    FILE* fp                 = fopen(rom_filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Failed to open file: '%s'\n", rom_filename);
+        return 1;
+    }
+
+    rom_sz = fread(rom, 1, sizeof(rom), fp);
+    fclose(fp);
+
+    char default_output[512];
+    if (output == NULL) {
+        snprintf(default_output, sizeof(default_output), "%s%s", rom_filename,
+                 ANALYSIS_EXT);
+        output = default_output;
+    }
+
+    static RomAnalysis an;
+    analysis_run(&an, rom, rom_sz);
+
+    if (listing)
+        print_listing(&an);
+
+    if (!analysis_write(&an, output))
+        return 1;
+
+    int code_bytes = 0, written = 0, indirect = 0;
+    for (int addr = 0; addr < MEM_SZ; addr++) {
+        if (addr >= ROM_LOAD_ADDR && addr < ROM_LOAD_ADDR + (int)rom_sz &&
+            analysis_is_code(&an, addr))
+            code_bytes++;
+        if (an.flags[addr] & ANALYSIS_WRITTEN)
+            written++;
+        if (an.flags[addr] & ANALYSIS_INDIRECT)
+            indirect++;
+    }
+
+    fprintf(stderr,
+            "%d instructions, %d of %zu bytes of code, %d invalid, "
+            "%d outside of the ROM, %d written, %d indirect jumps\n",
+            an.num_code, code_bytes, rom_sz, an.num_invalid, an.num_outside,
+            written, indirect);
+
+    for (int addr = 0; addr < MEM_SZ; addr++) {
+        if (an.flags[addr] & ANALYSIS_INVALID)
+            fprintf(stderr, "Invalid opcode %04X at %03X\n",
+                    an.invalid_opcodes[addr], addr);
+        if (an.flags[addr] & ANALYSIS_OUTSIDE)
+            fprintf(stderr, "Code outside of the ROM at %03X\n", addr);
+    }
+
+    return 0;
+}
@@ -0,0 +1,547 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "../src/include/util.h"
+#include "../src/include/cpu.h"
+#include "../src/include/disasm.h"
+#include "../src/include/aot.h"
+#include "../src/include/analysis.h"
+
+/*
+ * Compile a ROM ahead of time into a shared object, for the "aot" backend and
+ * the -A option of the emulator. See aot.h.
+ */
+
+/* Directory of the headers included by the generated code, set by the
+ * Makefile */
+#ifndef AOT_INCLUDE_DIR
+#define AOT_INCLUDE_DIR "src/include"
+#endif
+
+#define ROM_END (ROM_LOAD_ADDR + rom_sz)
+
+static uint8_t rom[MEM_SZ - ROM_LOAD_ADDR];
+static size_t rom_sz;
+
+/* Instructions reachable from ROM_LOAD_ADDR (see analysis.h), and the block
+ * of each one */
+static RomAnalysis analysis;
+static int block_of[MEM_SZ];
+
+static void usage(const char* self) {
+    fprintf(stderr,
+            "Usage: %s [options] <rom>\n"
+            "Options:\n"
+            "  -p PROFILE  Quirk profile: default, vip, chip48 or schip\n"
+            "  -o FILE     Output file (default: the ROM name with .so)\n"
+            "  -c          Only write the C code\n"
+            "  -I DIR      Directory of the emulator headers (default: %s)\n",
+            self, AOT_INCLUDE_DIR);
+    exit(1);
+}
+
+static uint16_t opcode_at(int addr) {
+    return (rom[addr - ROM_LOAD_ADDR] << 8) | rom[addr + 1 - ROM_LOAD_ADDR];
+}
+
+/* Check if both bytes of an instruction are in the ROM */
+static bool in_rom(int addr) {
+    return addr >= ROM_LOAD_ADDR && addr + 2 <= (int)ROM_END;
+}
+
+static bool is_reachable(int addr) {
+    return analysis.flags[addr] & ANALYSIS_CODE;
+}
+
+/* Check if the instruction is translated into C, instead of calling `exec' */
+static bool is_native(uint16_t opcode) {
+    switch (opcode >> 12) {
+        case 0x1:
+        case 0x3:
+        case 0x4:
+        case 0x6:
+        case 0x7:
+        case 0xA:
+            return true;
+
+        case 0x5:
+        case 0x9:
+            return (opcode & 0xF) == 0;
+
+        case 0x8:
+            return (opcode & 0xF) <= 7 || (opcode & 0xF) == 0xE;
+
+        case 0xF:
+            switch (opcode & 0xFF) {
+                case 0x07:
+                case 0x15:
+                case 0x18:
+                case 0x1E:
+                case 0x29:
+                    return true;
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+/* Check if the instruction writes to memory */
+static bool writes_mem(uint16_t opcode) {
+    return (opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055;
+}
+
+/* Check if the next instruction is not always the one after this one, so
+ * the block has to end here */
+static bool ends_block(uint16_t opcode) {
+    switch (opcode >> 12) {
+        case 0x0:
+            return opcode != 0x00E0;
+
+        case 0x1:
+        case 0x2:
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+        case 0xB:
+        case 0xE:
+            return true;
+
+        case 0x8:
+            return !is_native(opcode);
+
+        case 0xF:
+            return (opcode & 0xFF) == 0x0A || writes_mem(opcode) ||
+                   !(is_native(opcode) || (opcode & 0xFF) == 0x65);
+
+        default:
+            return false;
+    }
+}
+
+/* Write the C code of an instruction translated into C. The PC is only
+ * written when leaving the block. */
+static void emit_native(FILE* fp, int addr, uint16_t opcode, int quirks) {
+    const int x    = (opcode >> 8) & 0xF;
+    const int y    = (opcode >> 4) & 0xF;
+    const int kk   = opcode & 0xFF;
+    const int nnn  = opcode & 0xFFF;
+    const int next = (addr + 2) & MEM_MASK;
+    const int skip = (addr + 4) & MEM_MASK;
+    const int src  = (quirks & QUIRK_SHIFT_VX) ? x : y;
+
+    switch (opcode >> 12) {
+        case 0x1:
+            fprintf(fp, "            ctx->PC = 0x%03X;\n", nnn);
+            fprintf(fp, "            return n + 1;\n");
+            return;
+
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9: {
+            const bool ne = (opcode >> 12) == 0x4 || (opcode >> 12) == 0x9;
+            char rhs[16];
+            if ((opcode >> 12) == 0x3 || (opcode >> 12) == 0x4)
+                snprintf(rhs, sizeof(rhs), "0x%02X", kk);
+            else
+                snprintf(rhs, sizeof(rhs), "ctx->V[0x%X]", y);
+
+            fprintf(fp,
+                    "            ctx->PC = (ctx->V[0x%X] %s %s) ? 0x%03X : "
+                    "0x%03X;\n",
+                    x, ne ? "!=" : "==", rhs, skip, next);
+            fprintf(fp, "            return n + 1;\n");
+            return;
+        }
+
+        case 0x6:
+            fprintf(fp, "            ctx->V[0x%X] = 0x%02X;\n", x, kk);
+            break;
+
+        case 0x7:
+            fprintf(fp, "            ctx->V[0x%X] += 0x%02X;\n", x, kk);
+            break;
+
+        case 0x8:
+            switch (opcode & 0xF) {
+                case 0x0:
+                    fprintf(fp, "            ctx->V[0x%X] = ctx->V[0x%X];\n", x,
+                            y);
+                    break;
+
+                case 0x1:
+                case 0x2:
+                case 0x3: {
+                    const char* op = ((opcode & 0xF) == 1)   ? "|"
+                                     : ((opcode & 0xF) == 2) ? "&"
+                                                             : "^";
+                    fprintf(fp, "            ctx->V[0x%X] %s= ctx->V[0x%X];\n",
+                            x, op, y);
+                    if (quirks & QUIRK_VF_RESET)
+                        fprintf(fp, "            ctx->V[0xF] = 0;\n");
+                } break;
+
+                case 0x4:
+                    fprintf(fp,
+                            "            {\n"
+                            "                const uint16_t r = ctx->V[0x%X] "
+                            "+ ctx->V[0x%X];\n"
+                            "                ctx->V[0x%X] = r & 0xFF;\n"
+                            "                ctx->V[0xF] = r > 0xFF;\n"
+                            "            }\n",
+                            x, y, x);
+                    break;
+
+                case 0x5:
+                case 0x7: {
+                    const int a = ((opcode & 0xF) == 5) ? x : y;
+                    const int b = ((opcode & 0xF) == 5) ? y : x;
+                    fprintf(fp,
+                            "            {\n"
+                            "                const bool f = ctx->V[0x%X] >= "
+                            "ctx->V[0x%X];\n"
+                            "                ctx->V[0x%X] = ctx->V[0x%X] - "
+                            "ctx->V[0x%X];\n"
+                            "                ctx->V[0xF] = f;\n"
+                            "            }\n",
+                            a, b, x, a, b);
+                } break;
+
+                case 0x6:
+                case 0xE: {
+                    const bool right = (opcode & 0xF) == 6;
+                    fprintf(fp,
+                            "            {\n"
+                            "                const uint8_t s = ctx->V[0x%X];\n"
+                            "                ctx->V[0x%X] = s %s 1;\n"
+                            "                ctx->V[0xF] = %s;\n"
+                            "            }\n",
+                            src, x, right ? ">>" : "<<",
+                            right ? "s & 1" : "s >> 7");
+                } break;
+            }
+            break;
+
+        case 0xA:
+            fprintf(fp, "            ctx->I = 0x%03X;\n", nnn);
+            break;
+
+        case 0xF:
+            switch (kk) {
+                case 0x07:
+                    fprintf(fp, "            ctx->V[0x%X] = ctx->DT;\n", x);
+                    break;
+
+                case 0x15:
+                    fprintf(fp, "            ctx->DT = ctx->V[0x%X];\n", x);
+                    break;
+
+                case 0x18:
+                    fprintf(fp, "            ctx->ST = ctx->V[0x%X];\n", x);
+                    break;
+
+                case 0x1E:
+                    fprintf(fp, "            ctx->I += ctx->V[0x%X];\n", x);
+                    break;
+
+                case 0x29:
+                    fprintf(fp,
+                            "            ctx->I = 0x%X + ctx->V[0x%X] * %d;\n",
+                            DIGITS_ADDR, x, CHAR_SPRITE_H);
+                    break;
+            }
+            break;
+    }
+}
+
+/* Write the C code of an instruction run by the `exec' of the context */
+static void emit_exec(FILE* fp, int addr, uint16_t opcode) {
+    fprintf(fp,
+            "            ctx->PC = 0x%03X;\n"
+            "            result->trap = ctx->exec(ctx, 0x%04X);\n"
+            "            if (result->trap != TRAP_NONE) {\n"
+            "                ctx->PC = 0x%03X;\n"
+            "                return n;\n"
+            "            }\n",
+            (addr + 2) & MEM_MASK, opcode, addr);
+
+    if (writes_mem(opcode))
+        fprintf(fp, "            result->wrote = true;\n");
+    if (ends_block(opcode))
+        fprintf(fp, "            return n + 1;\n");
+}
+
+/* Write the function of the block starting at `start', and mark its
+ * instructions. Returns the number of instructions. */
+static int emit_block(FILE* fp, int index, int start, int quirks) {
+    fprintf(fp,
+            "static int block_%d(CpuCtx* ctx, int max, AotResult* result) {\n"
+            "    int n = 0;\n"
+            "\n"
+            "    switch (ctx->PC) {\n",
+            index);
+
+    int num  = 0;
+    int addr = start;
+    for (;;) {
+        const uint16_t opcode = opcode_at(addr);
+        block_of[addr]        = index;
+        num++;
+
+        char str[DISASM_SZ];
+        disasm(opcode, str, sizeof(str));
+        fprintf(fp, "        case 0x%03X: /* %s */\n", addr, str);
+
+        if (is_native(opcode))
+            emit_native(fp, addr, opcode, quirks);
+        else
+            emit_exec(fp, addr, opcode);
+
+        /* The instruction already returned */
+        if (ends_block(opcode))
+            break;
+
+        /* Stop when the budget is used, or at the end of the block */
+        const int next = addr + 2;
+        fprintf(fp,
+                "            if (++n == max) {\n"
+                "                ctx->PC = 0x%03X;\n"
+                "                return n;\n"
+                "            }\n",
+                next);
+
+        if (!in_rom(next) || !is_reachable(next) || block_of[next] >= 0) {
+            fprintf(fp,
+                    "            ctx->PC = 0x%03X;\n"
+                    "            return n;\n",
+                    next);
+            break;
+        }
+
+        addr = next;
+    }
+
+    fprintf(fp,
+            "    }\n"
+            "\n"
+            "    return n;\n"
+            "}\n"
+            "\n");
+    return num;
+}
+
+/* Write the C code of the whole ROM */
+static void emit_module(FILE* fp, int quirks) {
+    fprintf(fp,
+            "/* Generated by chip-8-aot.out, do not edit */\n"
+            "\n"
+            "#include <stdbool.h>\n"
+            "#include <stdint.h>\n"
+            "\n"
+            "#include \"cpu.h\"\n"
+            "#include \"aot.h\"\n"
+            "\n");
+
+    for (int addr = 0; addr < MEM_SZ; addr++)
+        block_of[addr] = -1;
+
+    /* Blocks in order of address. Each one goes on while the next instruction
+     * is reachable and not already part of a block. */
+    int num_blocks = 0, num_instrs = 0;
+    for (int addr = ROM_LOAD_ADDR; addr < (int)ROM_END; addr++) {
+        if (!is_reachable(addr) || block_of[addr] >= 0)
+            continue;
+
+        num_instrs += emit_block(fp, num_blocks, addr, quirks);
+        num_blocks++;
+    }
+
+    fprintf(fp, "static const uint8_t rom[] = {");
+    for (size_t i = 0; i < rom_sz; i++)
+        fprintf(fp, "%s0x%02X,", (i % 12 == 0) ? "\n    " : " ", rom[i]);
+    fprintf(fp, "\n};\n\n");
+
+    fprintf(fp, "static const AotBlock blocks[] = {\n");
+    for (int i = 0; i < num_blocks; i++) {
+        int start = -1, end = 0;
+        for (int addr = 0; addr < MEM_SZ; addr++) {
+            if (block_of[addr] != i)
+                continue;
+            if (start < 0)
+                start = addr;
+            end = addr + 2;
+        }
+
+        fprintf(fp, "    { 0x%03X, 0x%03X, block_%d },\n", start, end, i);
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp,
+            "const AotModule %s = {\n"
+            "    .abi_version = %d,\n"
+            "    .quirks      = %d,\n"
+            "    .rom         = rom,\n"
+            "    .rom_sz      = sizeof(rom),\n"
+            "    .blocks      = blocks,\n"
+            "    .num_blocks  = %d,\n"
+            "};\n",
+            AOT_SYMBOL, AOT_ABI_VERSION, quirks, num_blocks);
+
+    fprintf(stderr, "Translated %d instructions in %d blocks\n", num_instrs,
+            num_blocks);
+}
+
+/* Compile the C file into a shared object. The compiler is run directly, not
+ * through a shell, so the paths are passed as they are. `cc' can have
+ * arguments after the program, separated by spaces. Returns false if it could
+ * not be run, or if it failed. */
+static bool compile(const char* cc, const char* include_dir,
+                    const char* output, const char* c_path) {
+    extern char** environ;
+
+    char words[1024];
+    if (snprintf(words, sizeof(words), "%s", cc) >= (int)sizeof(words)) {
+        fprintf(stderr, "Compiler command too long: '%s'\n", cc);
+        return false;
+    }
+
+    /* The words of `cc', the options, and the terminating NULL */
+    char* args[64];
+    int num = 0;
+    for (char* word = strtok(words, " \t"); word != NULL;
+         word       = strtok(NULL, " \t")) {
+        if (num >= (int)LENGTH(args) - 8) {
+            fprintf(stderr, "Too many words in the compiler: '%s'\n", cc);
+            return false;
+        }
+        args[num++] = word;
+    }
+    if (num == 0) {
+        fprintf(stderr, "Empty compiler command.\n");
+        return false;
+    }
+
+    args[num++] = "-O2";
+    args[num++] = "-fPIC";
+    args[num++] = "-shared";
+    args[num++] = "-I";
+    args[num++] = (char*)include_dir;
+    args[num++] = "-o";
+    args[num++] = (char*)output;
+    args[num++] = (char*)c_path;
+    args[num]   = NULL;
+
+    pid_t pid;
+    const int err = posix_spawnp(&pid, args[0], NULL, NULL, args, environ);
+    if (err != 0) {
+        fprintf(stderr, "Could not run the compiler '%s': %s\n", args[0],
+                strerror(err));
+        return false;
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Compilation failed: %s -o '%s' '%s'\n", cc, output,
+                c_path);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    EQuirkProfile profile   = PROFILE_DEFAULT;
+    const char* output      = NULL;
+    bool only_c             = false;
+    const char* include_dir = AOT_INCLUDE_DIR;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:o:cI:")) != -1) {
+        switch (opt) {
+            case 'p': {
+                profile = cpu_profile_from_str(optarg);
+                if (profile == PROFILE_COUNT) {
+                    fprintf(stderr, "Unknown quirk profile: '%s'\n", optarg);
+                    return 1;
+                }
+            } break;
+
+            case 'o': {
+                output = optarg;
+            } break;
+
+            case 'c': {
+                only_c = true;
+            } break;
+
+            case 'I': {
+                include_dir = optarg;
+            } break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+        usage(argv[0]);
+
+    const char* rom_filename = argv[optind];
+    FILE* fp                 = fopen(rom_filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Failed to open file: '%s'\n", rom_filename);
+        return 1;
+    }
+
+    rom_sz = fread(rom, 1, sizeof(rom), fp);
+    fclose(fp);
+
+    char default_output[512];
+    if (output == NULL) {
+        snprintf(default_output, sizeof(default_output), "%s.%s", rom_filename,
+                 only_c ? "c" : "so");
+        output = default_output;
+    }
+
+    analysis_run(&analysis, rom, rom_sz);
+
+    /* Write the C code directly to the output, or to a temporary file */
+    char c_path[] = "/tmp/chip8-aot-XXXXXX.c";
+    if (only_c) {
+        fp = fopen(output, "w");
+    } else {
+        const int fd = mkstemps(c_path, 2);
+        fp           = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    }
+
+    if (fp == NULL) {
+        fprintf(stderr, "Could not create the C file.\n");
+        return 1;
+    }
+
+    emit_module(fp, cpu_profile_quirks(profile));
+    fclose(fp);
+
+    if (only_c)
+        return 0;
+
+    /* Compile with the C compiler of the environment */
+    const char* cc = getenv("CC");
+    if (cc == NULL || *cc == '\0')
+        cc = "cc";
+
+    const bool ok = compile(cc, include_dir, output, c_path);
+    unlink(c_path);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,258 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/include/util.h"
+#include "../src/include/cpu.h"
+#include "../src/include/backend.h"
+#include "../src/include/lockstep.h"
+#include "../src/include/simd.h"
+
+/*
+ * Fuzz target for the CPU core, for clang's libFuzzer. Each input has the
+ * following format:
+ *
+ *     Offset  Size  Description
+ *     ----------------------------------------------------------
+ *     0       1     Bits 0-1: Quirk profile (see EQuirkProfile)
+ *     1       1     Number of frames in the input script (N)
+ *     2       2*N   Keypad mask of each frame, little-endian
+ *     2+2*N   ...   ROM, loaded at ROM_LOAD_ADDR
+ *
+ * The ROM runs for FUZZ_FRAMES frames, cycling through the input script.
+ */
+#define FUZZ_FRAMES 32
+
+/* Instances of the SIMD engine compared with the interpreter. Instance N uses
+ * the input script with its bits rotated N times, so the lanes diverge. */
+#define FUZZ_SIMD_INSTANCES 3
+
+/* Abort if the condition is false, so the fuzzer reports the input */
+#define ASSERT(COND)                                                   \
+    do {                                                               \
+        if (!(COND)) {                                                 \
+            fprintf(stderr, "%s:%d: Assertion failed: %s\n", __FILE__, \
+                    __LINE__, #COND);                                  \
+            abort();                                                   \
+        }                                                              \
+    } while (0)
+
+/* Initial state of every machine, copied on each run instead of calling
+ * `cpu_init' again. */
+static CpuCtx initial;
+static bool initialized = false;
+
+/* Machines for the differential check. They are static, since CpuCtx is too
+ * large to be copied around on each run. */
+static CpuCtx ctx_wrap, ctx_trap;
+
+/* Lanes of the SIMD engine, allocated once and reset for each run */
+static SimdBatch batch;
+
+/* Each backend in lockstep with the reference interpreter. The states of the
+ * backends are created once, and reset for each run. */
+static CpuCtx ctx_ref, ctx_other;
+static Lockstep* lockstep;
+static size_t num_lockstep;
+
+/*----------------------------------------------------------------------------*/
+
+/* Invariants that must hold after every frame, even after a trap */
+static void check_invariants(const CpuCtx* ctx) {
+    ASSERT(ctx->SP <= LENGTH(ctx->stack));
+    ASSERT(ctx->PC < MEM_SZ);
+    ASSERT(ctx->kb.status == KB_NONE || ctx->kb.status == KB_WAITING ||
+           ctx->kb.status == KB_HAS_KEY);
+    ASSERT(ctx->kb.last_key < 16);
+    ASSERT(ctx->rng != 0);
+}
+
+/* Create a lockstep context for every backend other than the reference */
+static void init_backends(void) {
+    const CpuBackend* ref = backend_from_str("interp");
+
+    size_t num_backends = 0;
+    while (backend_get(num_backends) != NULL)
+        num_backends++;
+
+    lockstep = malloc(num_backends * sizeof(Lockstep));
+    ASSERT(lockstep != NULL);
+
+    memcpy(&ctx_ref, &initial, sizeof(CpuCtx));
+    memcpy(&ctx_other, &initial, sizeof(CpuCtx));
+    for (size_t i = 0; i < num_backends; i++)
+        if (backend_get(i) != ref)
+            lockstep_init(&lockstep[num_lockstep++], &ctx_ref, ref,
+                          &ctx_other, backend_get(i));
+}
+
+/* Run the ROM on every backend in lockstep with the reference interpreter */
+static void check_backends(const CpuCtx* initial, const uint8_t* script,
+                           size_t script_len) {
+    for (size_t i = 0; i < num_lockstep; i++) {
+        Lockstep* ls = &lockstep[i];
+
+        memcpy(&ctx_ref, initial, sizeof(CpuCtx));
+        memcpy(&ctx_other, initial, sizeof(CpuCtx));
+        lockstep_reset(ls);
+
+        ELockstepStatus status = LOCKSTEP_OK;
+        for (int frame = 0; frame < FUZZ_FRAMES && status == LOCKSTEP_OK;
+             frame++) {
+            uint16_t mask = 0;
+            if (script_len > 0) {
+                const size_t j = frame % script_len;
+                mask           = script[j * 2] | (script[j * 2 + 1] << 8);
+            }
+
+            status = lockstep_frame(ls, mask);
+        }
+
+        if (status == LOCKSTEP_DIVERGED)
+            fprintf(stderr, "Divergence: %s\n", ls->report);
+        ASSERT(status != LOCKSTEP_DIVERGED);
+    }
+}
+
+/* Run the ROM on a few lanes of the SIMD engine, and compare each one with the
+ * reference interpreter after every frame */
+static void check_simd(const CpuCtx* initial, const uint8_t* script,
+                       size_t script_len) {
+    static CpuCtx ctx_ref[FUZZ_SIMD_INSTANCES];
+    static ECpuTrap trap_ref[FUZZ_SIMD_INSTANCES];
+
+    simd_reset(&batch, initial);
+    for (int i = 0; i < FUZZ_SIMD_INSTANCES; i++) {
+        cpu_seed_rng(&batch.ctx[i], i + 1);
+        simd_load(&batch, i);
+        memcpy(&ctx_ref[i], &batch.ctx[i], sizeof(CpuCtx));
+        trap_ref[i] = TRAP_NONE;
+    }
+
+    for (int frame = 0; frame < FUZZ_FRAMES; frame++) {
+        uint16_t keys[FUZZ_SIMD_INSTANCES] = { 0 };
+        if (script_len > 0) {
+            const size_t j      = frame % script_len;
+            const uint16_t mask = script[j * 2] | (script[j * 2 + 1] << 8);
+            for (int i = 0; i < FUZZ_SIMD_INSTANCES; i++)
+                keys[i] = (mask << i) | (mask >> (16 - i));
+        }
+
+        simd_frame(&batch, keys);
+
+        for (int i = 0; i < FUZZ_SIMD_INSTANCES; i++) {
+            if (trap_ref[i] == TRAP_NONE) {
+                kb_store_mask(&ctx_ref[i].kb, keys[i]);
+                trap_ref[i] = cpu_frame(&ctx_ref[i]);
+            }
+
+            simd_store(&batch, i);
+
+            char report[256];
+            if (!lockstep_compare(&ctx_ref[i], &batch.ctx[i], report,
+                                  sizeof(report)))
+                fprintf(stderr, "SIMD lane %d differs: %s\n", i, report);
+
+            ASSERT(batch.trap[i] == trap_ref[i]);
+            ASSERT(lockstep_compare(&ctx_ref[i], &batch.ctx[i], report,
+                                    sizeof(report)));
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t sz) {
+    if (sz < 2)
+        return 0;
+
+    if (!initialized) {
+        cpu_init(&initial);
+        ASSERT(simd_init(&batch, &initial, FUZZ_SIMD_INSTANCES));
+        init_backends();
+        initialized = true;
+    }
+
+    const EQuirkProfile profile = (data[0] & 3) % PROFILE_COUNT;
+    const size_t script_len     = data[1];
+    if (sz < 2 + script_len * 2)
+        return 0;
+
+    const uint8_t* script = &data[2];
+    const uint8_t* rom    = &data[2 + script_len * 2];
+    size_t rom_sz         = sz - 2 - script_len * 2;
+    if (rom_sz > MEM_SZ - ROM_LOAD_ADDR)
+        rom_sz = MEM_SZ - ROM_LOAD_ADDR;
+
+    /* Reset both machines from the initial state. They run the same ROM with
+     * the two memory modes, which are different specialized interpreters. */
+    memcpy(&ctx_wrap, &initial, sizeof(CpuCtx));
+    cpu_load_rom_data(&ctx_wrap, rom, rom_sz);
+    cpu_set_profile(&ctx_wrap, profile);
+    memcpy(&ctx_trap, &ctx_wrap, sizeof(CpuCtx));
+    cpu_set_mem_mode(&ctx_trap, MEM_TRAP);
+
+    /* Differential check between the execution backends */
+    check_backends(&ctx_wrap, script, script_len);
+    check_simd(&ctx_wrap, script, script_len);
+    check_simd(&ctx_trap, script, script_len);
+
+    for (int frame = 0; frame < FUZZ_FRAMES; frame++) {
+        if (script_len > 0) {
+            const size_t i       = frame % script_len;
+            const uint16_t mask  = script[i * 2] | (script[i * 2 + 1] << 8);
+            kb_store_mask(&ctx_wrap.kb, mask);
+            kb_store_mask(&ctx_trap.kb, mask);
+        }
+
+        const ECpuTrap trap_wrap = cpu_frame(&ctx_wrap);
+        const ECpuTrap trap_trap = cpu_frame(&ctx_trap);
+        check_invariants(&ctx_wrap);
+        check_invariants(&ctx_trap);
+
+        /* Once the trapping machine stops because of the memory range, the
+         * other one continues with wrapped addresses, so they can't be
+         * compared anymore. Until then, they must be identical. */
+        if (trap_trap == TRAP_MEM_RANGE)
+            break;
+
+        char report[256];
+        if (!lockstep_compare(&ctx_wrap, &ctx_trap, report, sizeof(report)))
+            fprintf(stderr, "Memory modes differ: %s\n", report);
+
+        ASSERT(trap_wrap == trap_trap);
+        ASSERT(lockstep_compare(&ctx_wrap, &ctx_trap, report, sizeof(report)));
+
+        if (trap_wrap != TRAP_NONE)
+            break;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+#ifdef FUZZ_STANDALONE
+/* Run each file in the arguments through the fuzz target, without libFuzzer.
+ * Useful for reproducing crashes, or with compilers other than clang. */
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        FILE* fp = fopen(argv[i], "rb");
+        if (!fp) {
+            fprintf(stderr, "Failed to open file: '%s'\n", argv[i]);
+            return 1;
+        }
+
+        static uint8_t data[0x10000];
+        const size_t data_sz = fread(data, 1, sizeof(data), fp);
+        fclose(fp);
+
+        LLVMFuzzerTestOneInput(data, data_sz);
+    }
+
+    return 0;
+}
+#endif /* FUZZ_STANDALONE */
@@ -0,0 +1,273 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/include/util.h"
+#include "../src/include/cpu.h"
+#include "../src/include/input.h"
+#include "../src/include/lockstep.h"
+#include "../src/include/sched.h"
+#include "../src/include/live.h"
+#include "../src/include/analysis.h"
+
+/*
+ * Host many instances of a ROM with the scheduler (see sched.h), and report how
+ * many of them actually had to run. Every instance uses the same input script,
+ * delayed by a number of frames for each instance, so they don't all press the
+ * same keys at the same time. With -v, the results are compared with running
+ * every instance on every frame. With -S, the contexts are exported in shared
+ * memory for external monitors (see live.h).
+ */
+
+static void usage(const char* self) {
+    fprintf(stderr,
+            "Usage: %s [options] <rom>\n"
+            "Options:\n"
+            "  -n NUM      Number of instances (default: 1024)\n"
+            "  -f FRAMES   Number of frames to run (default: 3600)\n"
+            "  -j THREADS  Number of threads (default: 1)\n"
+            "  -p PROFILE  Quirk profile: default, vip, chip48 or schip\n"
+            "  -i FILE     Input script, see input.h\n"
+            "  -d FRAMES   Delay of the input script for each instance "
+            "(default: 1)\n"
+            "  -v          Compare with running every instance on every "
+            "frame\n"
+            "  -S NAME     Export the state of the instances in the shared "
+            "memory\n"
+            "              segment NAME\n"
+            "  -a FILE     Check the ROM with the analysis in FILE, written "
+            "by\n"
+            "              chip-8-analyzer.out\n",
+            self);
+    exit(1);
+}
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Send the input events of the script that happen on this frame, to the
+ * scheduler or to the contexts of `naive'. Instance N sees the script
+ * `N*delay' frames late. */
+static void send_keys(const InputScript* script, uint64_t frame, uint32_t num,
+                      unsigned long delay, Sched* sched, CpuCtx* naive) {
+    for (size_t e = 0; e < script->events_num; e++) {
+        const InputEvent* event = &script->events[e];
+        if (event->frame > frame)
+            break;
+
+        /* Instances that see this event on this frame */
+        uint64_t first = 0, last = num;
+        if (delay > 0) {
+            const uint64_t late = frame - event->frame;
+            if (late % delay != 0 || late / delay >= num)
+                continue;
+
+            first = late / delay;
+            last  = first + 1;
+        } else if (event->frame != frame) {
+            continue;
+        }
+
+        for (uint64_t i = first; i < last; i++) {
+            if (sched != NULL)
+                sched_key(sched, i, event->mask);
+            else
+                kb_store_mask(&naive[i].kb, event->mask);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned long num     = 1024;
+    unsigned long frames  = 3600;
+    int threads           = 1;
+    EQuirkProfile profile = PROFILE_DEFAULT;
+    const char* input     = NULL;
+    unsigned long delay   = 1;
+    bool verify           = false;
+    const char* live_name = NULL;
+    const char* analysis  = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:j:p:i:d:vS:a:")) != -1) {
+        switch (opt) {
+            case 'n': {
+                num = strtoul(optarg, NULL, 0);
+            } break;
+
+            case 'f': {
+                frames = strtoul(optarg, NULL, 0);
+            } break;
+
+            case 'j': {
+                threads = atoi(optarg);
+            } break;
+
+            case 'p': {
+                profile = cpu_profile_from_str(optarg);
+                if (profile == PROFILE_COUNT) {
+                    fprintf(stderr, "Unknown quirk profile: '%s'\n", optarg);
+                    return 1;
+                }
+            } break;
+
+            case 'i': {
+                input = optarg;
+            } break;
+
+            case 'd': {
+                delay = strtoul(optarg, NULL, 0);
+            } break;
+
+            case 'v': {
+                verify = true;
+            } break;
+
+            case 'S': {
+                live_name = optarg;
+            } break;
+
+            case 'a': {
+                analysis = optarg;
+            } break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc || num == 0)
+        usage(argv[0]);
+
+    InputScript script = { NULL, 0, 0 };
+    if (input != NULL && !input_load(&script, input))
+        return 1;
+
+    static CpuCtx initial;
+    cpu_init(&initial);
+    cpu_set_profile(&initial, profile);
+    if (!cpu_load_rom(&initial, argv[optind]))
+        return 1;
+
+    /* Reject bad ROMs before creating any instance */
+    if (analysis != NULL) {
+        static RomAnalysis an;
+        if (!analysis_load(&an, analysis) || !analysis_check(&an, &initial))
+            return 1;
+    }
+
+    /* The contexts live in the shared memory segment, if any */
+    LiveState* live = NULL;
+    CpuCtx* ctx     = NULL;
+    if (live_name != NULL) {
+        live = live_create(live_name, num);
+        if (live == NULL)
+            return 1;
+    } else {
+        ctx = malloc(num * sizeof(CpuCtx));
+    }
+
+    CpuCtx* naive = verify ? malloc(num * sizeof(CpuCtx)) : NULL;
+
+    Sched sched;
+    if (!sched_init(&sched, threads)) {
+        fprintf(stderr, "Could not start the scheduler.\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < num; i++) {
+        CpuCtx* cur = (live != NULL) ? &live->slots[i].ctx : &ctx[i];
+        memcpy(cur, &initial, sizeof(CpuCtx));
+        cpu_seed_rng(cur, i + 1);
+        sched_add(&sched, cur);
+
+        if (live != NULL)
+            sched_set_live(&sched, i, &live->slots[i]);
+
+        if (naive != NULL)
+            memcpy(&naive[i], cur, sizeof(CpuCtx));
+    }
+
+    const double start      = get_time();
+    const clock_t start_cpu = clock();
+
+    uint64_t min_runnable = num, max_runnable = 0;
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        send_keys(&script, frame, num, delay, &sched, NULL);
+
+        const uint32_t ran = sched_frame(&sched);
+        if (ran < min_runnable)
+            min_runnable = ran;
+        if (ran > max_runnable)
+            max_runnable = ran;
+    }
+
+    const double secs     = get_time() - start;
+    const double cpu_secs = (double)(clock() - start_cpu) / CLOCKS_PER_SEC;
+
+    printf("%lu instances, %lu frames in %.3fs (%.3fs of CPU)\n", num, frames,
+           secs, cpu_secs);
+    printf("Ran %llu of %llu instance frames (%.1f%%), %llu-%llu per frame\n",
+           (unsigned long long)sched.frames_run,
+           (unsigned long long)num * frames,
+           100.0 * sched.frames_run / ((double)num * frames),
+           (unsigned long long)min_runnable, (unsigned long long)max_runnable);
+    printf("At the end: %u runnable, %u waiting for keys, %u waiting for DT, "
+           "%u stopped\n",
+           sched_count(&sched, SCHED_RUNNABLE),
+           sched_count(&sched, SCHED_PARKED_KEY),
+           sched_count(&sched, SCHED_PARKED_TIMER),
+           sched_count(&sched, SCHED_STOPPED));
+
+    int ret = 0;
+    if (naive != NULL) {
+        /* Run every instance on every frame, and compare the results */
+        ECpuTrap* traps = calloc(num, sizeof(ECpuTrap));
+        for (uint64_t frame = 0; frame < frames; frame++) {
+            send_keys(&script, frame, num, delay, NULL, naive);
+
+            for (uint32_t i = 0; i < num; i++)
+                if (traps[i] == TRAP_NONE)
+                    traps[i] = cpu_frame(&naive[i]);
+        }
+
+        uint32_t differ = 0;
+        for (uint32_t i = 0; i < num; i++) {
+            sched_wake(&sched, i);
+
+            char report[256];
+            if (traps[i] != sched.instances[i].trap)
+                snprintf(report, sizeof(report), "Trap: %s != %s",
+                         cpu_trap_str(traps[i]),
+                         cpu_trap_str(sched.instances[i].trap));
+
+            if (traps[i] != sched.instances[i].trap ||
+                !lockstep_compare(&naive[i], sched.instances[i].ctx, report,
+                                  sizeof(report))) {
+                if (differ == 0)
+                    printf("Instance %u differs: %s\n", i, report);
+                differ++;
+            }
+        }
+
+        free(traps);
+
+        printf("Verify: %u of %lu instances differ\n", differ, num);
+        ret = (differ > 0) ? 1 : 0;
+    }
+
+    sched_free(&sched);
+    input_free(&script);
+    free(ctx);
+    free(naive);
+    if (live != NULL)
+        live_close(live);
+    return ret;
+}
@@ -0,0 +1,183 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/include/cpu.h"
+#include "../src/include/simd.h"
+#include "chip8.h"
+
+#if CHIP8_DISP_W != DISP_W || CHIP8_DISP_H != DISP_H
+#error "The display size of chip8.h doesn't match display.h"
+#endif
+
+struct Chip8Batch {
+    /* Instances, executed together, and the state they are reset to */
+    SimdBatch simd;
+    CpuCtx initial;
+
+    /* Keypad masks used when the caller doesn't hold any key */
+    uint16_t* no_keys;
+
+    /* Guest memory addresses returned as rewards */
+    uint16_t* reward_addrs;
+    uint32_t num_rewards;
+};
+
+/*----------------------------------------------------------------------------*/
+
+int chip8_api_version(void) {
+    return CHIP8_API_VERSION;
+}
+
+Chip8Batch* chip8_batch_create(uint32_t num, const uint8_t* rom, size_t rom_sz,
+                               const char* profile, uint32_t seed) {
+    EQuirkProfile quirks = PROFILE_DEFAULT;
+    if (profile != NULL) {
+        quirks = cpu_profile_from_str(profile);
+        if (quirks == PROFILE_COUNT)
+            return NULL;
+    }
+
+    if (num == 0 || rom_sz > MEM_SZ - ROM_LOAD_ADDR)
+        return NULL;
+
+    Chip8Batch* batch = calloc(1, sizeof(Chip8Batch));
+    if (batch == NULL)
+        return NULL;
+
+    cpu_init(&batch->initial);
+    cpu_set_profile(&batch->initial, quirks);
+    cpu_load_rom_data(&batch->initial, rom, rom_sz);
+
+    batch->no_keys = calloc(num, sizeof(uint16_t));
+    if (batch->no_keys == NULL ||
+        !simd_init(&batch->simd, &batch->initial, num)) {
+        free(batch->no_keys);
+        free(batch);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < num; i++) {
+        cpu_seed_rng(&batch->simd.ctx[i], seed + i);
+        simd_load(&batch->simd, i);
+    }
+
+    return batch;
+}
+
+void chip8_batch_destroy(Chip8Batch* batch) {
+    if (batch == NULL)
+        return;
+
+    simd_free(&batch->simd);
+    free(batch->no_keys);
+    free(batch->reward_addrs);
+    free(batch);
+}
+
+uint32_t chip8_batch_size(const Chip8Batch* batch) {
+    return batch->simd.num;
+}
+
+int chip8_batch_set_rewards(Chip8Batch* batch, const uint16_t* addrs,
+                            uint32_t num_addrs) {
+    for (uint32_t i = 0; i < num_addrs; i++)
+        if (addrs[i] >= MEM_SZ)
+            return -1;
+
+    uint16_t* copy = NULL;
+    if (num_addrs > 0) {
+        copy = malloc(num_addrs * sizeof(uint16_t));
+        if (copy == NULL)
+            return -1;
+        memcpy(copy, addrs, num_addrs * sizeof(uint16_t));
+    }
+
+    free(batch->reward_addrs);
+    batch->reward_addrs = copy;
+    batch->num_rewards  = num_addrs;
+    return 0;
+}
+
+void chip8_batch_reset(Chip8Batch* batch, const uint8_t* mask) {
+    for (uint32_t i = 0; i < batch->simd.num; i++) {
+        if (mask != NULL && mask[i] == 0)
+            continue;
+
+        /* Keep the state of the random number generator */
+        CpuCtx* ctx = &batch->simd.ctx[i];
+        simd_store(&batch->simd, i);
+        const uint32_t rng = ctx->rng;
+        memcpy(ctx, &batch->initial, sizeof(CpuCtx));
+        ctx->rng = rng;
+
+        simd_load(&batch->simd, i);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* Write the framebuffer of an instance in the specified format */
+static void write_fb(const CpuCtx* ctx, uint8_t* dst, EChip8FbFormat format) {
+    for (int y = 0; y < DISP_H; y++) {
+        const uint64_t row = ctx->fb[y];
+
+        if (format == CHIP8_FB_BITS) {
+            /* Big-endian, so the leftmost pixel is the MSB of the first
+             * byte */
+            for (int i = 0; i < DISP_W / 8; i++)
+                *dst++ = row >> (DISP_W - 8 - i * 8);
+        } else {
+            for (int x = 0; x < DISP_W; x++)
+                *dst++ = (row >> (DISP_W - 1 - x)) & 1;
+        }
+    }
+}
+
+uint32_t chip8_batch_step(Chip8Batch* batch, const uint16_t* keys,
+                          uint32_t frames, void* fb, EChip8FbFormat fb_format,
+                          uint8_t* rewards, uint8_t* traps) {
+    const size_t fb_sz = (fb_format == CHIP8_FB_BITS) ? CHIP8_FB_BITS_SZ
+                                                      : CHIP8_FB_BYTES_SZ;
+    SimdBatch* simd  = &batch->simd;
+    uint32_t stopped = 0;
+
+    if (keys == NULL)
+        keys = batch->no_keys;
+
+    /* The keys only have to be stored once */
+    for (uint32_t frame = 0; frame < frames; frame++)
+        simd_frame(simd, (frame == 0) ? keys : NULL);
+
+    for (uint32_t i = 0; i < simd->num; i++) {
+        const CpuCtx* ctx = &simd->ctx[i];
+
+        if (simd->trap[i] != TRAP_NONE)
+            stopped++;
+
+        if (fb != NULL && fb_format != CHIP8_FB_NONE)
+            write_fb(ctx, (uint8_t*)fb + i * fb_sz, fb_format);
+
+        if (rewards != NULL)
+            for (uint32_t j = 0; j < batch->num_rewards; j++)
+                rewards[i * batch->num_rewards + j] =
+                  ctx->mem[batch->reward_addrs[j]];
+
+        if (traps != NULL)
+            traps[i] = simd->trap[i];
+    }
+
+    return stopped;
+}
+
+int chip8_batch_read_mem(const Chip8Batch* batch, uint32_t instance,
+                         uint16_t addr, uint8_t* dst, size_t sz) {
+    if (instance >= batch->simd.num || addr >= MEM_SZ ||
+        sz > (size_t)(MEM_SZ - addr))
+        return -1;
+
+    memcpy(dst, &batch->simd.ctx[instance].mem[addr], sz);
+    return 0;
+}
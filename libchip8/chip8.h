@@ -0,0 +1,89 @@
+
+#ifndef CHIP8_H_
+#define CHIP8_H_ 1
+
+/*
+ * Embeddable API for running many CHIP-8 machines from other programs (e.g.
+ * through Python's ctypes). It only uses fixed-size integer types and opaque
+ * pointers, and it doesn't depend on the rest of the emulator headers.
+ *
+ * All the instances of a batch run the same ROM, and they are stepped
+ * together with a single call. The outputs of all the instances are written
+ * into contiguous buffers owned by the caller, in instance order.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Incremented when the API changes in an incompatible way */
+#define CHIP8_API_VERSION 1
+
+/* Size of the display, in pixels */
+#define CHIP8_DISP_W 64
+#define CHIP8_DISP_H 32
+
+/* Size of the framebuffer of each instance, in bytes, for each format */
+#define CHIP8_FB_BITS_SZ  (CHIP8_DISP_W * CHIP8_DISP_H / 8)
+#define CHIP8_FB_BYTES_SZ (CHIP8_DISP_W * CHIP8_DISP_H)
+
+/* Format of the framebuffers written by `chip8_batch_step' */
+typedef enum {
+    CHIP8_FB_NONE  = 0, /* Don't write the framebuffers */
+    CHIP8_FB_BITS  = 1, /* 8 bytes per row, MSB of each byte on the left */
+    CHIP8_FB_BYTES = 2, /* 1 byte per pixel, 0 or 1 */
+} EChip8FbFormat;
+
+typedef struct Chip8Batch Chip8Batch;
+
+/*----------------------------------------------------------------------------*/
+
+/* Get the CHIP8_API_VERSION of the library */
+int chip8_api_version(void);
+
+/* Create `num' instances running the specified ROM. The profile is one of the
+ * quirk profiles of the emulator ("default", "vip", "chip48" or "schip"), or
+ * NULL for the default one. Instance N uses `seed+N' as its random seed.
+ * Returns NULL if the profile is not valid, or the ROM doesn't fit in
+ * memory. */
+Chip8Batch* chip8_batch_create(uint32_t num, const uint8_t* rom, size_t rom_sz,
+                               const char* profile, uint32_t seed);
+
+/* Free a batch created with `chip8_batch_create' */
+void chip8_batch_destroy(Chip8Batch* batch);
+
+/* Get the number of instances in the batch */
+uint32_t chip8_batch_size(const Chip8Batch* batch);
+
+/* Set the guest memory addresses that are returned as rewards by
+ * `chip8_batch_step', one byte each. Returns 0 on success, or -1 if an address
+ * is outside of the emulated memory. */
+int chip8_batch_set_rewards(Chip8Batch* batch, const uint16_t* addrs,
+                            uint32_t num_addrs);
+
+/* Reset the instances to the state right after loading the ROM. If `mask' is
+ * not NULL, only the instances whose byte in `mask' is not zero are reset.
+ * The random number generators are not reset, so each episode is different. */
+void chip8_batch_reset(Chip8Batch* batch, const uint8_t* mask);
+
+/* Run all the instances for `frames' frames (at 60Hz), holding the keys of
+ * `keys[N]' in instance N, where bit K is set if key K is held. If `keys' is
+ * NULL, no keys are held.
+ *
+ * After stepping, the following (optional) outputs are written:
+ *   - fb: the framebuffers, with the size of the format (see CHIP8_FB_BITS_SZ
+ *     and CHIP8_FB_BYTES_SZ) for each instance.
+ *   - rewards: the bytes at the reward addresses, `num_addrs' per instance.
+ *   - traps: the trap of each instance, or 0 if it didn't trap.
+ *
+ * An instance that traps is stopped until it is reset. Returns the number of
+ * stopped instances. */
+uint32_t chip8_batch_step(Chip8Batch* batch, const uint16_t* keys,
+                          uint32_t frames, void* fb, EChip8FbFormat fb_format,
+                          uint8_t* rewards, uint8_t* traps);
+
+/* Copy `sz' bytes of the guest memory of an instance, starting at `addr', into
+ * `dst'. Returns 0 on success, or -1 if the range is not valid. */
+int chip8_batch_read_mem(const Chip8Batch* batch, uint32_t instance,
+                         uint16_t addr, uint8_t* dst, size_t sz);
+
+#endif /* CHIP8_H_ */
@@ -0,0 +1,149 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/include/util.h"
+#include "../src/include/cpu.h"
+#include "../src/include/backend.h"
+#include "../src/include/input.h"
+#include "../src/include/lockstep.h"
+
+static void usage(const char* self) {
+    fprintf(stderr,
+            "Usage: %s [options] <rom>\n"
+            "Options:\n"
+            "  -a BACKEND  Reference backend (default: interp)\n"
+            "  -b BACKEND  Backend being tested (default: interp)\n"
+            "  -p PROFILE  Quirk profile: default, vip, chip48 or schip\n"
+            "  -t          Trap on out-of-range memory accesses\n"
+            "  -i FILE     Input script, see input.h\n"
+            "  -n FRAMES   Number of frames to run (default: 3600)\n"
+            "  -s SEED     Seed for the RND instruction (default: 1)\n"
+            "  -f          Only compare at the end of each frame\n"
+            "Backends: ",
+            self);
+    backend_print_names();
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static const CpuBackend* get_backend(const char* name) {
+    const CpuBackend* backend = backend_from_str(name);
+    if (backend == NULL) {
+        fprintf(stderr, "Unknown backend: '%s'\n", name);
+        exit(1);
+    }
+
+    return backend;
+}
+
+int main(int argc, char** argv) {
+    const CpuBackend* ref   = backend_from_str("interp");
+    const CpuBackend* other = ref;
+    EQuirkProfile profile   = PROFILE_DEFAULT;
+    EMemMode mem_mode       = MEM_WRAP;
+    const char* input_file  = NULL;
+    unsigned long frames    = 3600;
+    unsigned long seed      = 1;
+    bool per_instruction    = true;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:b:p:ti:n:s:f")) != -1) {
+        switch (opt) {
+            case 'a': {
+                ref = get_backend(optarg);
+            } break;
+
+            case 'b': {
+                other = get_backend(optarg);
+            } break;
+
+            case 'p': {
+                profile = cpu_profile_from_str(optarg);
+                if (profile == PROFILE_COUNT) {
+                    fprintf(stderr, "Unknown quirk profile: '%s'\n", optarg);
+                    return 1;
+                }
+            } break;
+
+            case 't': {
+                mem_mode = MEM_TRAP;
+            } break;
+
+            case 'i': {
+                input_file = optarg;
+            } break;
+
+            case 'n': {
+                frames = strtoul(optarg, NULL, 0);
+            } break;
+
+            case 's': {
+                seed = strtoul(optarg, NULL, 0);
+            } break;
+
+            case 'f': {
+                per_instruction = false;
+            } break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+        usage(argv[0]);
+
+    InputScript script = { NULL, 0, 0 };
+    if (input_file != NULL && !input_load(&script, input_file))
+        return 1;
+
+    /* Both machines start with the exact same state */
+    static CpuCtx ctx_ref, ctx_other;
+    cpu_init(&ctx_ref);
+    cpu_seed_rng(&ctx_ref, seed);
+    cpu_set_mem_mode(&ctx_ref, mem_mode);
+    cpu_set_profile(&ctx_ref, profile);
+    if (!cpu_load_rom(&ctx_ref, argv[optind]))
+        return 1;
+    memcpy(&ctx_other, &ctx_ref, sizeof(CpuCtx));
+
+    Lockstep ls;
+    lockstep_init(&ls, &ctx_ref, ref, &ctx_other, other);
+    ls.per_instruction = per_instruction;
+
+    const clock_t start = clock();
+
+    ELockstepStatus status = LOCKSTEP_OK;
+    while (status == LOCKSTEP_OK && ls.frame < frames)
+        status = lockstep_frame(&ls, input_mask_at(&script, ls.frame));
+
+    const double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    switch (status) {
+        case LOCKSTEP_OK: {
+            printf("OK: %llu frames, %llu instructions in %.3fs\n",
+                   (unsigned long long)ls.frame,
+                   (unsigned long long)ls.retired, secs);
+        } break;
+
+        case LOCKSTEP_TRAPPED: {
+            printf("OK: Both backends trapped on frame %llu (%s at %03X)\n",
+                   (unsigned long long)ls.frame, cpu_trap_str(ls.trap),
+                   ctx_ref.PC);
+        } break;
+
+        case LOCKSTEP_DIVERGED: {
+            printf("Divergence: %s\n", ls.report);
+        } break;
+    }
+
+    lockstep_free(&ls);
+    input_free(&script);
+    return (status == LOCKSTEP_DIVERGED) ? 1 : 0;
+}
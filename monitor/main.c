@@ -0,0 +1,140 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../src/include/cpu.h"
+#include "../src/include/display.h"
+#include "../src/include/live.h"
+
+/*
+ * Watch the state exported by the emulator or the host with -S (see live.h).
+ * The segment is only read, so the emulator is never slowed down.
+ */
+
+static void usage(const char* self) {
+    fprintf(stderr,
+            "Usage: %s [options] <name>\n"
+            "Options:\n"
+            "  -i INDEX    Instance to show (default: 0)\n"
+            "  -l          List every instance, instead of showing one\n"
+            "  -f          Show the framebuffer\n"
+            "  -r MS       Refresh every MS milliseconds, instead of once\n",
+            self);
+    exit(1);
+}
+
+/* Print the registers of a context */
+static void print_regs(const CpuCtx* ctx, uint64_t frame) {
+    printf("Frame %llu  PC=%03X  I=%03X  SP=%X  DT=%02X  ST=%02X\n",
+           (unsigned long long)frame, ctx->PC, ctx->I, ctx->SP, ctx->DT,
+           ctx->ST);
+
+    for (int i = 0; i < 16; i++)
+        printf("V%X=%02X%c", i, ctx->V[i], (i % 8 == 7) ? '\n' : ' ');
+}
+
+/* Print the framebuffer, with a character for each pixel */
+static void print_fb(const CpuCtx* ctx) {
+    char line[DISP_W + 2];
+    for (int y = 0; y < DISP_H; y++) {
+        for (int x = 0; x < DISP_W; x++)
+            line[x] = (ctx->fb[y] >> (DISP_W - 1 - x) & 1) ? '#' : '.';
+        line[DISP_W]     = '\n';
+        line[DISP_W + 1] = '\0';
+        fputs(line, stdout);
+    }
+}
+
+/* Print a line for each instance */
+static void print_list(const LiveState* live) {
+    static CpuCtx ctx;
+
+    printf("%8s %10s %5s %5s %4s %4s\n", "Instance", "Frame", "PC", "I", "DT",
+           "ST");
+    for (uint32_t i = 0; i < live->header->num; i++) {
+        uint64_t frame;
+        if (!live_read(live, i, &ctx, &frame)) {
+            printf("%8u  busy\n", i);
+            continue;
+        }
+
+        printf("%8u %10llu   %03X   %03X   %02X   %02X\n", i,
+               (unsigned long long)frame, ctx.PC, ctx.I, ctx.DT, ctx.ST);
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned long index = 0;
+    bool list           = false;
+    bool show_fb        = false;
+    int refresh         = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:lfr:")) != -1) {
+        switch (opt) {
+            case 'i': {
+                index = strtoul(optarg, NULL, 0);
+            } break;
+
+            case 'l': {
+                list = true;
+            } break;
+
+            case 'f': {
+                show_fb = true;
+            } break;
+
+            case 'r': {
+                refresh = atoi(optarg);
+            } break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+        usage(argv[0]);
+
+    LiveState* live = live_open(argv[optind]);
+    if (live == NULL)
+        return 1;
+
+    if (index >= live->header->num) {
+        fprintf(stderr, "Instance %lu out of range, there are %u.\n", index,
+                live->header->num);
+        live_close(live);
+        return 1;
+    }
+
+    static CpuCtx ctx;
+    for (;;) {
+        /* Clear the terminal before each refresh */
+        if (refresh > 0)
+            fputs("\x1B[H\x1B[2J", stdout);
+
+        if (list) {
+            print_list(live);
+        } else {
+            uint64_t frame;
+            if (live_read(live, index, &ctx, &frame)) {
+                print_regs(&ctx, frame);
+                if (show_fb)
+                    print_fb(&ctx);
+            } else {
+                printf("Instance %lu is busy\n", index);
+            }
+        }
+
+        fflush(stdout);
+        if (refresh <= 0)
+            break;
+
+        usleep(refresh * 1000);
+    }
+
+    live_close(live);
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/include/cpu.h"
+#include "../src/include/keyboard.h"
+#include "../src/include/input.h"
+#include "../src/include/ramsearch.h"
+
+/*
+ * Headless RAM search (see ramsearch.h). The ROM runs with an input script,
+ * and a snapshot is taken at the end of each of the specified frames. Each
+ * snapshot can filter the candidates, comparing it with the previous one or
+ * with a value:
+ *
+ *     chip-8-ramsearch.out -i play.in rom.ch8 60 120:increased 180:eq=3
+ */
+
+typedef struct Checkpoint {
+    unsigned long frame;
+    ERamPredicate pred; /* RAM_PREDICATE_COUNT for only a snapshot */
+    uint8_t value;
+} Checkpoint;
+
+static void usage(const char* self) {
+    fprintf(stderr,
+            "Usage: %s [options] <rom> <FRAME[:PREDICATE[=VALUE]]>...\n"
+            "Options:\n"
+            "  -p PROFILE  Quirk profile: default, vip, chip48 or schip\n"
+            "  -t          Trap on out-of-range memory accesses\n"
+            "  -i FILE     Input script, see input.h\n"
+            "  -s SEED     Seed for the RND instruction (default: 1)\n"
+            "  -n NUM      Maximum number of candidates shown (default: 64)\n"
+            "Predicates: changed, unchanged, increased, decreased, eq and ne,\n"
+            "which needs a hexadecimal VALUE. The frames must be in order.\n",
+            self);
+    exit(1);
+}
+
+static bool parse_checkpoint(const char* str, Checkpoint* cp) {
+    char pred[16] = "";
+    unsigned value = 0;
+
+    const int num = sscanf(str, "%lu:%15[a-z]=%x", &cp->frame, pred, &value);
+    if (num < 1 || value > 0xFF)
+        return false;
+
+    if (num == 1) {
+        cp->pred = RAM_PREDICATE_COUNT;
+        return true;
+    }
+
+    cp->pred  = ram_predicate_from_str(pred);
+    cp->value = value;
+    return cp->pred != RAM_PREDICATE_COUNT &&
+           ram_predicate_has_value(cp->pred) == (num == 3);
+}
+
+int main(int argc, char** argv) {
+    EQuirkProfile profile  = PROFILE_DEFAULT;
+    EMemMode mem_mode      = MEM_WRAP;
+    const char* input_file = NULL;
+    unsigned long seed     = 1;
+    size_t max_shown       = 64;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:ti:s:n:")) != -1) {
+        switch (opt) {
+            case 'p': {
+                profile = cpu_profile_from_str(optarg);
+                if (profile == PROFILE_COUNT) {
+                    fprintf(stderr, "Unknown quirk profile: '%s'\n", optarg);
+                    return 1;
+                }
+            } break;
+
+            case 't': {
+                mem_mode = MEM_TRAP;
+            } break;
+
+            case 'i': {
+                input_file = optarg;
+            } break;
+
+            case 's': {
+                seed = strtoul(optarg, NULL, 0);
+            } break;
+
+            case 'n': {
+                max_shown = strtoul(optarg, NULL, 0);
+            } break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind + 1 >= argc)
+        usage(argv[0]);
+
+    const int num_checkpoints = argc - optind - 1;
+    Checkpoint* checkpoints   = malloc(num_checkpoints * sizeof(Checkpoint));
+    for (int i = 0; i < num_checkpoints; i++) {
+        Checkpoint* cp = &checkpoints[i];
+        if (!parse_checkpoint(argv[optind + 1 + i], cp) ||
+            (i > 0 && cp->frame <= checkpoints[i - 1].frame) ||
+            (i == 0 && cp->pred != RAM_PREDICATE_COUNT &&
+             !ram_predicate_has_value(cp->pred))) {
+            fprintf(stderr, "Invalid snapshot: '%s'\n", argv[optind + 1 + i]);
+            return 1;
+        }
+    }
+
+    InputScript script = { NULL, 0, 0 };
+    if (input_file != NULL && !input_load(&script, input_file))
+        return 1;
+
+    static CpuCtx ctx;
+    cpu_init(&ctx);
+    cpu_seed_rng(&ctx, seed);
+    cpu_set_mem_mode(&ctx, mem_mode);
+    cpu_set_profile(&ctx, profile);
+    if (!cpu_load_rom(&ctx, argv[optind]))
+        return 1;
+
+    static RamSearch rs;
+    ram_search_init(&rs);
+
+    /* Frame N runs with the keys of line N of the script, and the snapshot
+     * of frame N is taken once it's done */
+    uint64_t frame = 0;
+    for (int i = 0; i < num_checkpoints; i++) {
+        const Checkpoint* cp = &checkpoints[i];
+
+        for (; frame < cp->frame; frame++) {
+            kb_store_mask(&ctx.kb, input_mask_at(&script, frame));
+
+            const ECpuTrap trap = cpu_frame(&ctx);
+            if (trap != TRAP_NONE) {
+                fprintf(stderr, "%s at %03X, on frame %llu\n",
+                        cpu_trap_str(trap), ctx.PC, (unsigned long long)frame);
+                return 1;
+            }
+        }
+
+        const uint32_t cur = ram_search_snapshot(&rs, &ctx);
+        if (cp->pred != RAM_PREDICATE_COUNT)
+            ram_search_filter(&rs, cp->pred, (cur > 0) ? cur - 1 : cur, cur,
+                              cp->value);
+
+        printf("Frame %lu: %u candidates\n", cp->frame, rs.num_candidates);
+    }
+
+    ram_search_print(&rs, max_shown, stdout);
+
+    ram_search_free(&rs);
+    input_free(&script);
+    free(checkpoints);
+    return 0;
+}
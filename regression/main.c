@@ -0,0 +1,406 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../src/include/util.h"
+#include "../src/include/cpu.h"
+#include "../src/include/input.h"
+
+/*
+ * Headless regression runner. The tests are listed in a manifest file, with
+ * one test on each line:
+ *
+ *     # name   rom                 input   frames  profile
+ *     corax    roms/3-corax+.ch8   -       120     default
+ *     keypad   roms/6-keypad.ch8   keys.in 600     vip
+ *
+ * The paths are relative to the directory of the manifest, and '-' means no
+ * input script. Each test has a golden file in the same directory, called
+ * "<name>.golden", with a checkpoint on each line:
+ *
+ *     # frame  framebuffer      memory
+ *     60       0123456789ABCDEF 0123456789ABCDEF
+ *
+ * The test runs for the number of frames of the manifest, and the hashes of
+ * the framebuffer and the memory are compared at each checkpoint. With the -u
+ * option, the golden files are written instead, with a checkpoint every N
+ * frames and one on the last frame.
+ */
+
+typedef struct Checkpoint {
+    uint64_t frame;
+    uint64_t fb_hash;
+    uint64_t mem_hash;
+} Checkpoint;
+
+typedef struct Test {
+    char name[64];
+    char rom[512];
+    char input[512];
+    char golden[512];
+    unsigned long frames;
+    EQuirkProfile profile;
+
+    /* Result of the test, written by the worker thread */
+    bool passed;
+    char message[640];
+} Test;
+
+/* Global state shared by the worker threads. Each thread takes the next test
+ * from `next_test' atomically. */
+static Test* tests        = NULL;
+static size_t tests_num   = 0;
+static size_t next_test   = 0;
+static bool update        = false;
+static unsigned long step = 60;
+
+/*----------------------------------------------------------------------------*/
+
+static void usage(const char* self) {
+    fprintf(stderr,
+            "Usage: %s [options] <manifest>\n"
+            "Options:\n"
+            "  -j JOBS   Number of threads (default: number of cores)\n"
+            "  -u        Update the golden files instead of comparing\n"
+            "  -k FRAMES Frames between checkpoints, with -u (default: 60)\n",
+            self);
+    exit(1);
+}
+
+/* Write "<dir>/<file>" into `dst', unless `file' is already absolute */
+static void join_path(char* dst, size_t dst_sz, const char* dir,
+                      const char* file) {
+    if (file[0] == '/' || dir[0] == '\0')
+        snprintf(dst, dst_sz, "%s", file);
+    else
+        snprintf(dst, dst_sz, "%s/%s", dir, file);
+}
+
+/* Parse the manifest file, filling the global `tests' array */
+static bool load_manifest(const char* filename) {
+    FILE* fp = fopen(filename, "r");
+    if (!fp) {
+        ERR("Failed to open file: '%s'", filename);
+        return false;
+    }
+
+    /* Directory of the manifest, the paths are relative to it */
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", filename);
+    char* slash = strrchr(dir, '/');
+    if (slash != NULL)
+        *slash = '\0';
+    else
+        dir[0] = '\0';
+
+    size_t tests_sz = 0;
+    char line[1024];
+    for (int line_num = 1; fgets(line, sizeof(line), fp); line_num++) {
+        char* comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        char name[64], rom[256], input[256], profile[32];
+        unsigned long frames;
+        const int fields = sscanf(line, "%63s %255s %255s %lu %31s", name, rom,
+                                  input, &frames, profile);
+        if (fields <= 0)
+            continue;
+
+        if (fields != 5) {
+            ERR("%s:%d: Expected 5 fields.", filename, line_num);
+            fclose(fp);
+            return false;
+        }
+
+        if (tests_num >= tests_sz) {
+            tests_sz = (tests_sz == 0) ? 32 : tests_sz * 2;
+            tests    = realloc(tests, tests_sz * sizeof(Test));
+        }
+
+        Test* test = &tests[tests_num++];
+        snprintf(test->name, sizeof(test->name), "%s", name);
+        join_path(test->rom, sizeof(test->rom), dir, rom);
+        if (strcmp(input, "-") == 0)
+            test->input[0] = '\0';
+        else
+            join_path(test->input, sizeof(test->input), dir, input);
+
+        char golden[128];
+        snprintf(golden, sizeof(golden), "%s.golden", name);
+        join_path(test->golden, sizeof(test->golden), dir, golden);
+
+        test->frames  = frames;
+        test->profile = cpu_profile_from_str(profile);
+        if (test->profile == PROFILE_COUNT) {
+            ERR("%s:%d: Unknown quirk profile: '%s'", filename, line_num,
+                profile);
+            fclose(fp);
+            return false;
+        }
+
+        test->passed     = false;
+        test->message[0] = '\0';
+    }
+
+    fclose(fp);
+    return true;
+}
+
+/* Append a checkpoint to an array of `*num' checkpoints, which grows as
+ * needed */
+static void add_checkpoint(Checkpoint** checkpoints, size_t* num,
+                           uint64_t frame, uint64_t fb_hash,
+                           uint64_t mem_hash) {
+    /* The array is full when the size is a power of two */
+    if (*num == 0 || (*num >= 64 && (*num & (*num - 1)) == 0))
+        *checkpoints = realloc(*checkpoints, ((*num == 0) ? 64 : *num * 2) *
+                                               sizeof(Checkpoint));
+
+    Checkpoint* cp = &(*checkpoints)[(*num)++];
+    cp->frame      = frame;
+    cp->fb_hash    = fb_hash;
+    cp->mem_hash   = mem_hash;
+}
+
+/* Read the checkpoints of a golden file into a new array. Returns false on
+ * error. */
+static bool load_golden(const char* filename, Checkpoint** checkpoints,
+                        size_t* num) {
+    *checkpoints = NULL;
+    *num         = 0;
+
+    FILE* fp = fopen(filename, "r");
+    if (!fp)
+        return false;
+
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#')
+            continue;
+
+        unsigned long long frame, fb_hash, mem_hash;
+        if (sscanf(line, "%llu %llx %llx", &frame, &fb_hash, &mem_hash) != 3)
+            continue;
+
+        add_checkpoint(checkpoints, num, frame, fb_hash, mem_hash);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* Run a single test, storing the result in the test structure itself */
+static void run_test(Test* test) {
+    const uint64_t last_frame = test->frames;
+
+    /* Golden checkpoints, or the results with -u */
+    Checkpoint* expected = NULL;
+    size_t expected_num  = 0;
+    Checkpoint* results  = NULL;
+    size_t results_num   = 0;
+
+    if (!update) {
+        if (!load_golden(test->golden, &expected, &expected_num) ||
+            expected_num == 0) {
+            snprintf(test->message, sizeof(test->message),
+                     "Missing or empty golden file: '%s'", test->golden);
+            free(expected);
+            return;
+        }
+    }
+
+    InputScript script = { NULL, 0, 0 };
+    if (test->input[0] != '\0' && !input_load(&script, test->input)) {
+        snprintf(test->message, sizeof(test->message),
+                 "Could not load input script: '%s'", test->input);
+        free(expected);
+        return;
+    }
+
+    CpuCtx* ctx = malloc(sizeof(CpuCtx));
+    cpu_init(ctx);
+    cpu_set_profile(ctx, test->profile);
+    if (!cpu_load_rom(ctx, test->rom)) {
+        snprintf(test->message, sizeof(test->message),
+                 "Could not load ROM: '%s'", test->rom);
+        goto done;
+    }
+
+    size_t next = 0;
+
+    for (uint64_t frame = 1; frame <= last_frame; frame++) {
+        kb_store_mask(&ctx->kb, input_mask_at(&script, frame - 1));
+
+        const ECpuTrap trap = cpu_frame(ctx);
+        if (trap != TRAP_NONE) {
+            snprintf(test->message, sizeof(test->message),
+                     "Frame %llu: %s at %03X", (unsigned long long)frame,
+                     cpu_trap_str(trap), ctx->PC);
+            goto done;
+        }
+
+        /* Is this frame a checkpoint? The last frame always is, with -u. */
+        if (update) {
+            if (frame % step == 0 || frame == last_frame)
+                add_checkpoint(&results, &results_num, frame,
+                               cpu_hash_fb(ctx), cpu_hash_mem(ctx));
+            continue;
+        }
+
+        if (next >= expected_num || frame != expected[next].frame)
+            continue;
+
+        const Checkpoint result = { frame, cpu_hash_fb(ctx),
+                                    cpu_hash_mem(ctx) };
+
+        const Checkpoint* golden = &expected[next++];
+        if (result.fb_hash != golden->fb_hash ||
+            result.mem_hash != golden->mem_hash) {
+            snprintf(test->message, sizeof(test->message),
+                     "Frame %llu: %s hash is %016llX, expected %016llX",
+                     (unsigned long long)frame,
+                     (result.fb_hash != golden->fb_hash) ? "Framebuffer"
+                                                         : "Memory",
+                     (unsigned long long)((result.fb_hash != golden->fb_hash)
+                                            ? result.fb_hash
+                                            : result.mem_hash),
+                     (unsigned long long)((result.fb_hash != golden->fb_hash)
+                                            ? golden->fb_hash
+                                            : golden->mem_hash));
+            goto done;
+        }
+
+        /* Checkpoints in the same frame would never be reached */
+        while (next < expected_num && expected[next].frame <= frame)
+            next++;
+    }
+
+    /* Checkpoints after the last frame of the manifest are never checked */
+    if (!update && next < expected_num) {
+        snprintf(test->message, sizeof(test->message),
+                 "Checkpoint at frame %llu is after the last frame (%llu)",
+                 (unsigned long long)expected[next].frame,
+                 (unsigned long long)last_frame);
+        goto done;
+    }
+
+    if (update) {
+        FILE* fp = fopen(test->golden, "w");
+        if (!fp) {
+            snprintf(test->message, sizeof(test->message),
+                     "Could not write golden file: '%s'", test->golden);
+            goto done;
+        }
+
+        fprintf(fp, "# frame  framebuffer      memory\n");
+        for (size_t i = 0; i < results_num; i++)
+            fprintf(fp, "%-8llu %016llX %016llX\n",
+                    (unsigned long long)results[i].frame,
+                    (unsigned long long)results[i].fb_hash,
+                    (unsigned long long)results[i].mem_hash);
+
+        fclose(fp);
+    }
+
+    test->passed = true;
+
+done:
+    cpu_free(ctx);
+    input_free(&script);
+    free(expected);
+    free(results);
+}
+
+static void* worker(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        const size_t i = __atomic_fetch_add(&next_test, 1, __ATOMIC_RELAXED);
+        if (i >= tests_num)
+            break;
+
+        run_test(&tests[i]);
+    }
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int main(int argc, char** argv) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:uk:")) != -1) {
+        switch (opt) {
+            case 'j': {
+                jobs = strtol(optarg, NULL, 0);
+            } break;
+
+            case 'u': {
+                update = true;
+            } break;
+
+            case 'k': {
+                step = strtoul(optarg, NULL, 0);
+                if (step == 0)
+                    step = 1;
+            } break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+        usage(argv[0]);
+
+    if (!load_manifest(argv[optind]))
+        return 1;
+
+    if (jobs < 1)
+        jobs = 1;
+    if ((size_t)jobs > tests_num)
+        jobs = (tests_num > 0) ? tests_num : 1;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t* threads = malloc(jobs * sizeof(pthread_t));
+    for (long i = 0; i < jobs; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for (long i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double secs =
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    /* Print the results in the order of the manifest */
+    size_t failed = 0;
+    for (size_t i = 0; i < tests_num; i++) {
+        const Test* test = &tests[i];
+        if (test->passed) {
+            printf("%s %s\n", update ? "UPDATED" : "PASS   ", test->name);
+        } else {
+            printf("FAIL    %s: %s\n", test->name, test->message);
+            failed++;
+        }
+    }
+
+    printf("\n%zu/%zu tests passed in %.3fs (%ld threads)\n",
+           tests_num - failed, tests_num, secs, jobs);
+
+    free(tests);
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,270 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/include/cpu.h"
+#include "../src/include/search.h"
+
+/*
+ * Search for the keypad input that takes a ROM to a target state, and write
+ * it as an input script (see input.h) that the other tools can replay. See
+ * search.h.
+ */
+
+#define MAX_TARGETS 32
+
+static void usage(const char* self) {
+    fprintf(stderr,
+            "Usage: %s [options] <rom>\n"
+            "Options:\n"
+            "  -p PROFILE  Quirk profile: default, vip, chip48 or schip\n"
+            "  -t          Trap on out-of-range memory accesses\n"
+            "  -s SEED     Seed for the RND instruction (default: 1)\n"
+            "  -k KEYS     Keys to try, as hexadecimal digits (default: all)\n"
+            "  -f FRAMES   Frames each key is held on a step (default: 1)\n"
+            "  -d STEPS    Maximum number of steps (default: 600)\n"
+            "  -n STATES   Maximum number of different states (default: "
+            "50000)\n"
+            "  -j THREADS  Number of threads (default: 1)\n"
+            "  -B          Best-first search, by distance to the targets\n"
+            "  -o FILE     Write the input script into FILE\n"
+            "Targets, all of them must be met:\n"
+            "  -m ADDR=VAL Byte of memory at ADDR is VAL\n"
+            "  -v X=VAL    Register Vx is VAL\n"
+            "  -P ADDR     Program counter is ADDR\n"
+            "  -x X,Y      Pixel at (X,Y) is set\n"
+            "  -h HASH     Hash of the framebuffer is HASH\n"
+            "Numbers are hexadecimal, except the coordinates.\n",
+            self);
+    exit(1);
+}
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+
+    return -1;
+}
+
+/* Write the masks as an input script, with a line for each change */
+static void write_script(FILE* fp, const SearchResult* result) {
+    for (uint64_t f = 0; f < result->frames; f++)
+        if (f == 0 || result->masks[f] != result->masks[f - 1])
+            fprintf(fp, "%llu %04X\n", (unsigned long long)f,
+                    result->masks[f]);
+}
+
+int main(int argc, char** argv) {
+    EQuirkProfile profile = PROFILE_DEFAULT;
+    EMemMode mem_mode     = MEM_WRAP;
+    unsigned long seed    = 1;
+    const char* output    = NULL;
+
+    SearchTarget targets[MAX_TARGETS];
+    uint16_t masks[17];
+    SearchParams params = {
+        .targets     = targets,
+        .num_targets = 0,
+        .masks       = masks,
+        .num_masks   = 0,
+        .step_frames = 1,
+        .max_depth   = 600,
+        .max_states  = 50000,
+        .threads     = 1,
+        .best_first  = false,
+    };
+
+    /* No key, and every key on its own */
+    const char* keys = "0123456789ABCDEF";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:ts:k:f:d:n:j:Bo:m:v:P:x:h:")) != -1) {
+        SearchTarget* target = &targets[params.num_targets];
+        unsigned int a, b;
+
+        if (strchr("mvPxh", opt) != NULL && params.num_targets >= MAX_TARGETS) {
+            fprintf(stderr, "Too many targets.\n");
+            return 1;
+        }
+
+        switch (opt) {
+            case 'p': {
+                profile = cpu_profile_from_str(optarg);
+                if (profile == PROFILE_COUNT) {
+                    fprintf(stderr, "Unknown quirk profile: '%s'\n", optarg);
+                    return 1;
+                }
+            } break;
+
+            case 't': {
+                mem_mode = MEM_TRAP;
+            } break;
+
+            case 's': {
+                seed = strtoul(optarg, NULL, 0);
+            } break;
+
+            case 'k': {
+                keys = optarg;
+            } break;
+
+            case 'f': {
+                params.step_frames = atoi(optarg);
+            } break;
+
+            case 'd': {
+                params.max_depth = atoi(optarg);
+            } break;
+
+            case 'n': {
+                params.max_states = strtoul(optarg, NULL, 0);
+            } break;
+
+            case 'j': {
+                params.threads = atoi(optarg);
+            } break;
+
+            case 'B': {
+                params.best_first = true;
+            } break;
+
+            case 'o': {
+                output = optarg;
+            } break;
+
+            case 'm':
+            case 'v': {
+                if (sscanf(optarg, "%x=%x", &a, &b) != 2 || b > 0xFF ||
+                    a >= ((opt == 'm') ? MEM_SZ : 16)) {
+                    fprintf(stderr, "Invalid target: '%s'\n", optarg);
+                    return 1;
+                }
+
+                target->kind  = (opt == 'm') ? TARGET_MEM : TARGET_REG;
+                target->addr  = a;
+                target->value = b;
+                params.num_targets++;
+            } break;
+
+            case 'P': {
+                if (sscanf(optarg, "%x", &a) != 1 || a >= MEM_SZ) {
+                    fprintf(stderr, "Invalid target: '%s'\n", optarg);
+                    return 1;
+                }
+
+                target->kind  = TARGET_PC;
+                target->value = a;
+                params.num_targets++;
+            } break;
+
+            case 'x': {
+                if (sscanf(optarg, "%u,%u", &a, &b) != 2 || a >= DISP_W ||
+                    b >= DISP_H) {
+                    fprintf(stderr, "Invalid target: '%s'\n", optarg);
+                    return 1;
+                }
+
+                target->kind = TARGET_PIXEL;
+                target->addr = a;
+                target->y    = b;
+                params.num_targets++;
+            } break;
+
+            case 'h': {
+                target->kind  = TARGET_FB_HASH;
+                target->value = strtoull(optarg, NULL, 16);
+                params.num_targets++;
+            } break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc || params.num_targets == 0 ||
+        params.step_frames < 1)
+        usage(argv[0]);
+
+    masks[params.num_masks++] = 0;
+    for (const char* c = keys; *c != '\0'; c++) {
+        const int key = hex_digit(*c);
+        if (key < 0) {
+            fprintf(stderr, "Invalid key: '%c'\n", *c);
+            return 1;
+        }
+
+        /* Ignore repeated keys */
+        const uint16_t mask = 1 << key;
+        bool repeated       = false;
+        for (int i = 0; i < params.num_masks; i++)
+            repeated |= masks[i] == mask;
+        if (!repeated)
+            masks[params.num_masks++] = mask;
+    }
+
+    static CpuCtx initial;
+    cpu_init(&initial);
+    cpu_seed_rng(&initial, seed);
+    cpu_set_mem_mode(&initial, mem_mode);
+    cpu_set_profile(&initial, profile);
+    if (!cpu_load_rom(&initial, argv[optind]))
+        return 1;
+
+    const double start = get_time();
+
+    SearchResult result;
+    if (!search_run(&initial, &params, &result)) {
+        fprintf(stderr, "Could not start the search.\n");
+        return 1;
+    }
+
+    const double secs = get_time() - start;
+
+    fprintf(stderr,
+            "%llu states, %llu duplicates pruned, %llu expanded in %.3fs\n",
+            (unsigned long long)result.states,
+            (unsigned long long)result.duplicates,
+            (unsigned long long)result.expanded, secs);
+
+    if (!result.found) {
+        fprintf(stderr, "Not found%s.\n",
+                result.limit_reached ? ", reached the limit of states" : "");
+        return 1;
+    }
+
+    fprintf(stderr, "Found after %llu frames.\n",
+            (unsigned long long)result.frames);
+
+    FILE* fp = stdout;
+    if (output != NULL) {
+        fp = fopen(output, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "Failed to open file: '%s'\n", output);
+            return 1;
+        }
+    }
+
+    fprintf(fp, "# Targets met after %llu frames\n",
+            (unsigned long long)result.frames);
+    write_script(fp, &result);
+
+    if (fp != stdout)
+        fclose(fp);
+
+    search_result_free(&result);
+    return 0;
+}
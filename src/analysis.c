@@ -0,0 +1,428 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "include/util.h"
+#include "include/cpu.h"
+#include "include/analysis.h"
+
+/* Header of the sidecar file */
+#define MAP_MAGIC "chip8-map"
+
+static uint16_t opcode_at(const uint8_t* rom, int addr) {
+    return (rom[addr - ROM_LOAD_ADDR] << 8) | rom[addr + 1 - ROM_LOAD_ADDR];
+}
+
+/* Check if both bytes of an instruction are in the ROM */
+static bool in_rom(size_t sz, int addr) {
+    return addr >= ROM_LOAD_ADDR && addr + 2 <= ROM_LOAD_ADDR + (int)sz;
+}
+
+static bool is_skip(uint16_t opcode) {
+    switch (opcode >> 12) {
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+        case 0xE:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* Check if the instruction can be followed by the next one in memory,
+ * without going somewhere else first */
+static bool falls_through(uint16_t opcode) {
+    if (!cpu_opcode_valid(opcode))
+        return false;
+
+    switch (opcode >> 12) {
+        case 0x0:
+            return (opcode & 0xFF) == 0xE0;
+
+        case 0x1:
+        case 0x2:
+        case 0xB:
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+/* Check if the instruction might change I, other than "LD I, addr". Fx55
+ * and Fx65 do with some quirk profiles. */
+static bool changes_i(uint16_t opcode) {
+    if ((opcode & 0xF000) != 0xF000)
+        return false;
+
+    switch (opcode & 0xFF) {
+        case 0x1E:
+        case 0x29:
+        case 0x55:
+        case 0x65:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* Mark the code reachable from ROM_LOAD_ADDR, following the jumps, calls and
+ * skips. The targets of "JP V0, addr" are unknown. */
+static void find_reachable(RomAnalysis* an, const uint8_t* rom) {
+    static int stack[MEM_SZ * 2];
+    int sp = 0;
+
+    stack[sp++] = ROM_LOAD_ADDR;
+    while (sp > 0) {
+        const int addr = stack[--sp] & MEM_MASK;
+
+        /* Running outside of the ROM executes the interpreter area, or the
+         * zeros after the ROM */
+        if (!in_rom(an->rom_sz, addr)) {
+            if (!(an->flags[addr] & ANALYSIS_OUTSIDE)) {
+                an->flags[addr] |= ANALYSIS_OUTSIDE;
+                an->num_outside++;
+            }
+            continue;
+        }
+
+        if (an->flags[addr] & ANALYSIS_CODE)
+            continue;
+
+        an->flags[addr] |= ANALYSIS_CODE;
+        an->num_code++;
+
+        const uint16_t opcode = opcode_at(rom, addr);
+        const int next        = addr + 2;
+
+        if (!cpu_opcode_valid(opcode)) {
+            an->flags[addr] |= ANALYSIS_INVALID;
+            an->invalid_opcodes[addr] = opcode;
+            an->num_invalid++;
+            continue;
+        }
+
+        switch (opcode >> 12) {
+            case 0x1:
+                an->flags[opcode & 0xFFF] |= ANALYSIS_JUMP;
+                stack[sp++] = opcode & 0xFFF;
+                break;
+
+            case 0x2:
+                an->flags[opcode & 0xFFF] |= ANALYSIS_CALL;
+                stack[sp++] = opcode & 0xFFF;
+                stack[sp++] = next;
+                break;
+
+            case 0xB:
+                an->flags[addr] |= ANALYSIS_INDIRECT;
+                break;
+
+            default:
+                if (is_skip(opcode))
+                    stack[sp++] = next + 2;
+                if (falls_through(opcode))
+                    stack[sp++] = next;
+                break;
+        }
+    }
+}
+
+/* Get the value of I before the instruction at `addr', if it was set by a "LD
+ * I, addr" earlier in the same sequence of instructions. Otherwise, returns
+ * -1. */
+static int known_i(const RomAnalysis* an, const uint8_t* rom, int addr) {
+    for (int cur = addr;; cur -= 2) {
+        const int prev = cur - 2;
+
+        /* Stop where other paths might join the sequence: targets, and the
+         * instructions that can be skipped into */
+        if (an->flags[cur] & (ANALYSIS_JUMP | ANALYSIS_CALL))
+            return -1;
+        if (prev < ROM_LOAD_ADDR || !(an->flags[prev] & ANALYSIS_CODE))
+            return -1;
+        if (prev - 2 >= ROM_LOAD_ADDR &&
+            (an->flags[prev - 2] & ANALYSIS_CODE) &&
+            is_skip(opcode_at(rom, prev - 2)))
+            return -1;
+
+        const uint16_t opcode = opcode_at(rom, prev);
+        if ((opcode & 0xF000) == 0xA000)
+            return opcode & 0xFFF;
+
+        if (!falls_through(opcode) || changes_i(opcode))
+            return -1;
+    }
+}
+
+/* Mark the bytes of code written by the Fx33 and Fx55 instructions with a
+ * known I */
+static void find_written(RomAnalysis* an, const uint8_t* rom) {
+    for (int addr = ROM_LOAD_ADDR; in_rom(an->rom_sz, addr); addr++) {
+        if (!(an->flags[addr] & ANALYSIS_CODE))
+            continue;
+
+        const uint16_t opcode = opcode_at(rom, addr);
+
+        int sz;
+        if ((opcode & 0xF0FF) == 0xF033)
+            sz = 3;
+        else if ((opcode & 0xF0FF) == 0xF055)
+            sz = ((opcode >> 8) & 0xF) + 1;
+        else
+            continue;
+
+        const int i = known_i(an, rom, addr);
+        if (i < 0)
+            continue;
+
+        for (int j = 0; j < sz; j++)
+            if (analysis_is_code(an, i + j))
+                an->flags[(i + j) & MEM_MASK] |= ANALYSIS_WRITTEN;
+    }
+}
+
+/* Write the ranges of bytes in [start, end) where `pred' is true */
+static void write_ranges(FILE* fp, const char* name, const RomAnalysis* an,
+                         int start, int end,
+                         bool (*pred)(const RomAnalysis*, int)) {
+    for (int addr = start; addr < end;) {
+        if (!pred(an, addr)) {
+            addr++;
+            continue;
+        }
+
+        const int first = addr;
+        while (addr < end && pred(an, addr))
+            addr++;
+
+        fprintf(fp, "%s %03X %03X\n", name, first, addr);
+    }
+}
+
+static bool is_data(const RomAnalysis* an, int addr) {
+    return !analysis_is_code(an, addr);
+}
+
+static bool is_written(const RomAnalysis* an, int addr) {
+    return an->flags[addr] & ANALYSIS_WRITTEN;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void analysis_run(RomAnalysis* an, const uint8_t* rom, size_t sz) {
+    if (sz > MEM_SZ - ROM_LOAD_ADDR)
+        sz = MEM_SZ - ROM_LOAD_ADDR;
+
+    memset(an, 0, sizeof(RomAnalysis));
+    an->rom_sz = sz;
+
+    /* Same bytes as the memory after loading the ROM */
+    static uint8_t loaded[MEM_SZ - ROM_LOAD_ADDR];
+    memset(loaded, 0, sizeof(loaded));
+    memcpy(loaded, rom, sz);
+    an->rom_hash = hash_fnv1a(FNV1A_INIT, loaded, sizeof(loaded));
+
+    find_reachable(an, rom);
+    find_written(an, rom);
+}
+
+bool analysis_write(const RomAnalysis* an, const char* filename) {
+    FILE* fp = fopen(filename, "w");
+    if (!fp) {
+        ERR("Failed to open file: '%s'", filename);
+        return false;
+    }
+
+    const int rom_end = ROM_LOAD_ADDR + an->rom_sz;
+
+    fprintf(fp, "%s %d\n", MAP_MAGIC, ANALYSIS_VERSION);
+    fprintf(fp, "rom %03zX %016llX\n", an->rom_sz,
+            (unsigned long long)an->rom_hash);
+
+    /* Runs of instructions, which can start at odd addresses */
+    for (int addr = ROM_LOAD_ADDR; addr < rom_end; addr++) {
+        if (!(an->flags[addr] & ANALYSIS_CODE) ||
+            (an->flags[addr - 2] & ANALYSIS_CODE))
+            continue;
+
+        int end = addr;
+        while (end < MEM_SZ && (an->flags[end] & ANALYSIS_CODE))
+            end += 2;
+
+        fprintf(fp, "code %03X %03X\n", addr, end);
+    }
+
+    write_ranges(fp, "data", an, ROM_LOAD_ADDR, rom_end, is_data);
+
+    static const struct {
+        const char* name;
+        EAnalysisFlags flag;
+    } addr_items[] = {
+        { "jump", ANALYSIS_JUMP },
+        { "call", ANALYSIS_CALL },
+        { "indirect", ANALYSIS_INDIRECT },
+    };
+
+    for (size_t i = 0; i < LENGTH(addr_items); i++)
+        for (int addr = 0; addr < MEM_SZ; addr++)
+            if (an->flags[addr] & addr_items[i].flag)
+                fprintf(fp, "%s %03X\n", addr_items[i].name, addr);
+
+    for (int addr = ROM_LOAD_ADDR; addr < rom_end; addr++)
+        if (an->flags[addr] & ANALYSIS_INVALID)
+            fprintf(fp, "invalid %03X %04X\n", addr,
+                    an->invalid_opcodes[addr]);
+
+    for (int addr = 0; addr < MEM_SZ; addr++)
+        if (an->flags[addr] & ANALYSIS_OUTSIDE)
+            fprintf(fp, "outside %03X\n", addr);
+
+    write_ranges(fp, "written", an, 0, MEM_SZ, is_written);
+
+    const bool ok = !ferror(fp);
+    if (fclose(fp) != 0 || !ok) {
+        ERR("Failed to write file: '%s'", filename);
+        return false;
+    }
+
+    return true;
+}
+
+bool analysis_load(RomAnalysis* an, const char* filename) {
+    memset(an, 0, sizeof(RomAnalysis));
+
+    FILE* fp = fopen(filename, "r");
+    if (!fp) {
+        ERR("Failed to open file: '%s'", filename);
+        return false;
+    }
+
+    bool got_magic = false, got_rom = false;
+    char line[256];
+    for (int line_num = 1; fgets(line, sizeof(line), fp); line_num++) {
+        /* Ignore comments and empty lines */
+        char* comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        char name[16];
+        if (sscanf(line, "%15s", name) != 1)
+            continue;
+
+        int version;
+        if (!got_magic) {
+            if (sscanf(line, "%15s %d", name, &version) != 2 ||
+                strcmp(name, MAP_MAGIC) != 0) {
+                ERR("%s: Not a ROM analysis file.", filename);
+                goto fail;
+            }
+
+            if (version != ANALYSIS_VERSION) {
+                ERR("%s: Unsupported version %d.", filename, version);
+                goto fail;
+            }
+
+            got_magic = true;
+            continue;
+        }
+
+        /* Every item has one or two numbers, and the first one is always
+         * smaller than MEM_SZ */
+        unsigned long long a, b = 0;
+        const int num = sscanf(line, "%15s %llx %llx", name, &a, &b);
+        if (num < 2 || a >= MEM_SZ) {
+            ERR("%s:%d: Invalid line.", filename, line_num);
+            goto fail;
+        }
+
+        /* Ranges end at most at MEM_SZ */
+        const bool range = strcmp(name, "code") == 0 ||
+                           strcmp(name, "data") == 0 ||
+                           strcmp(name, "written") == 0;
+        if (range && (num != 3 || b < a || b > MEM_SZ)) {
+            ERR("%s:%d: Invalid range.", filename, line_num);
+            goto fail;
+        }
+
+        if (strcmp(name, "rom") == 0) {
+            if (num != 3 || a > MEM_SZ - ROM_LOAD_ADDR) {
+                ERR("%s:%d: Invalid ROM size.", filename, line_num);
+                goto fail;
+            }
+
+            an->rom_sz   = a;
+            an->rom_hash = b;
+            got_rom      = true;
+        } else if (strcmp(name, "code") == 0) {
+            for (unsigned long long addr = a; addr < b; addr += 2) {
+                an->flags[addr] |= ANALYSIS_CODE;
+                an->num_code++;
+            }
+        } else if (strcmp(name, "data") == 0) {
+            /* Everything that is not code */
+        } else if (strcmp(name, "jump") == 0) {
+            an->flags[a] |= ANALYSIS_JUMP;
+        } else if (strcmp(name, "call") == 0) {
+            an->flags[a] |= ANALYSIS_CALL;
+        } else if (strcmp(name, "indirect") == 0) {
+            an->flags[a] |= ANALYSIS_INDIRECT;
+        } else if (strcmp(name, "invalid") == 0) {
+            if (num != 3 || b > 0xFFFF) {
+                ERR("%s:%d: Invalid opcode.", filename, line_num);
+                goto fail;
+            }
+
+            an->flags[a] |= ANALYSIS_INVALID;
+            an->invalid_opcodes[a] = b;
+            an->num_invalid++;
+        } else if (strcmp(name, "outside") == 0) {
+            if (!(an->flags[a] & ANALYSIS_OUTSIDE))
+                an->num_outside++;
+            an->flags[a] |= ANALYSIS_OUTSIDE;
+        } else if (strcmp(name, "written") == 0) {
+            for (unsigned long long addr = a; addr < b; addr++)
+                an->flags[addr] |= ANALYSIS_WRITTEN;
+        } else {
+            ERR("%s:%d: Unknown item '%s'.", filename, line_num, name);
+            goto fail;
+        }
+    }
+
+    fclose(fp);
+
+    if (!got_rom) {
+        ERR("%s: Missing ROM size and hash.", filename);
+        return false;
+    }
+
+    return true;
+
+fail:
+    fclose(fp);
+    return false;
+}
+
+bool analysis_check(const RomAnalysis* an, const CpuCtx* ctx) {
+    const uint64_t hash = hash_fnv1a(FNV1A_INIT, &ctx->mem[ROM_LOAD_ADDR],
+                                     MEM_SZ - ROM_LOAD_ADDR);
+    if (hash != an->rom_hash) {
+        ERR("The analysis is not for this ROM.");
+        return false;
+    }
+
+    for (int addr = 0; addr < MEM_SZ; addr++) {
+        if (an->flags[addr] & ANALYSIS_INVALID)
+            ERR("Invalid opcode %04X at %03X", an->invalid_opcodes[addr],
+                addr);
+        if (an->flags[addr] & ANALYSIS_OUTSIDE)
+            ERR("Code outside of the ROM at %03X", addr);
+    }
+
+    return an->num_invalid == 0 && an->num_outside == 0;
+}
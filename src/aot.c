@@ -0,0 +1,170 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "include/util.h"
+#include "include/cpu.h"
+#include "include/aot.h"
+
+/* Set by `aot_set_module_path' */
+static const char* module_path = NULL;
+
+/* Check if an opcode run by the interpreter writes to memory */
+static inline bool writes_mem(uint16_t opcode) {
+    return (opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055;
+}
+
+/* Check if the code of a block is still the one that was translated */
+static bool block_valid(const CpuCtx* ctx, Aot* aot, int32_t i) {
+    if (aot->block_gen[i] == aot->gen)
+        return true;
+
+    const AotBlock* block = &aot->module->blocks[i];
+    const uint8_t* rom    = &aot->module->rom[block->start - ROM_LOAD_ADDR];
+    if (memcmp(&ctx->mem[block->start], rom, block->end - block->start) != 0)
+        return false;
+
+    aot->block_gen[i] = aot->gen;
+    return true;
+}
+
+/* Check if a module was compiled for the ROM and profile of a machine.
+ * Returns what is different, or NULL. */
+static const char* module_mismatch(const AotModule* module,
+                                   const CpuCtx* ctx) {
+    if (module->quirks != cpu_profile_quirks(ctx->profile))
+        return "for another quirk profile";
+
+    if (module->rom_sz > MEM_SZ - ROM_LOAD_ADDR ||
+        memcmp(&ctx->mem[ROM_LOAD_ADDR], module->rom, module->rom_sz) != 0)
+        return "from another ROM";
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+
+Aot* aot_load(const char* path, const CpuCtx* ctx) {
+    Aot* aot = aot_open(path);
+    if (aot == NULL)
+        return NULL;
+
+    const char* mismatch = module_mismatch(aot->module, ctx);
+    if (mismatch != NULL) {
+        ERR("'%s' was compiled %s", path, mismatch);
+        aot_free(aot);
+        return NULL;
+    }
+
+    aot_reset(aot, ctx);
+    return aot;
+}
+
+Aot* aot_open(const char* path) {
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        ERR("Could not load '%s': %s", path, dlerror());
+        return NULL;
+    }
+
+    const AotModule* module = dlsym(handle, AOT_SYMBOL);
+    if (module == NULL || module->abi_version != AOT_ABI_VERSION) {
+        ERR("Not a compiled ROM, or compiled for another version: '%s'", path);
+        dlclose(handle);
+        return NULL;
+    }
+
+    Aot* aot = calloc(1, sizeof(Aot));
+    if (aot == NULL) {
+        dlclose(handle);
+        return NULL;
+    }
+
+    aot->handle    = handle;
+    aot->module    = module;
+    aot->gen       = 1;
+    aot->block_gen = calloc(module->num_blocks, sizeof(uint32_t));
+
+    /* Instructions are 2 bytes, but they can start at any address */
+    for (int addr = 0; addr < MEM_SZ; addr++)
+        aot->block_at[addr] = -1;
+    for (uint32_t i = 0; i < module->num_blocks; i++)
+        for (int addr = module->blocks[i].start; addr < module->blocks[i].end;
+             addr += 2)
+            aot->block_at[addr] = i;
+
+    return aot;
+}
+
+bool aot_reset(Aot* aot, const CpuCtx* ctx) {
+    aot->enabled = module_mismatch(aot->module, ctx) == NULL;
+    aot_invalidate(aot);
+    return aot->enabled;
+}
+
+void aot_free(Aot* aot) {
+    if (aot == NULL)
+        return;
+
+    dlclose(aot->handle);
+    free(aot->block_gen);
+    free(aot);
+}
+
+void aot_set_module_path(const char* path) {
+    module_path = path;
+}
+
+const char* aot_get_module_path(void) {
+    return (module_path != NULL) ? module_path : getenv("CHIP8_AOT");
+}
+
+ECpuTrap aot_step(CpuCtx* ctx, Aot* aot, int max, int* retired) {
+    *retired = 0;
+
+    while (*retired < max) {
+        const int32_t i =
+          (aot != NULL && aot->enabled) ? aot->block_at[ctx->PC] : -1;
+
+        /* Interpret a single instruction if there is no valid block */
+        if (i < 0 || !block_valid(ctx, aot, i)) {
+            const uint16_t opcode = cpu_fetch(ctx);
+            const ECpuTrap trap   = cpu_cycle(ctx);
+            if (trap != TRAP_NONE)
+                return trap;
+
+            if (aot != NULL) {
+                if (writes_mem(opcode))
+                    aot->gen++;
+                aot->interp_instrs++;
+            }
+
+            (*retired)++;
+            continue;
+        }
+
+        AotResult result = { TRAP_NONE, false };
+        const int done   = aot->module->blocks[i].run(ctx, max - *retired,
+                                                      &result);
+        *retired += done;
+        aot->native_instrs += done;
+
+        if (result.wrote)
+            aot->gen++;
+        if (result.trap != TRAP_NONE)
+            return result.trap;
+    }
+
+    return TRAP_NONE;
+}
+
+ECpuTrap aot_frame(CpuCtx* ctx, Aot* aot, int* retired) {
+    const ECpuTrap trap = aot_step(ctx, aot, CYCLES_PER_FRAME, retired);
+    if (trap != TRAP_NONE)
+        return trap;
+
+    cpu_tick_timers(ctx);
+    return TRAP_NONE;
+}
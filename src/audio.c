@@ -0,0 +1,135 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "include/util.h"
+#include "include/display.h"
+#include "include/audio.h"
+
+/* Number of bits in the pattern */
+#define PATTERN_BITS (AUDIO_PATTERN_SZ * 8)
+
+/* Default pattern, a square wave of 8 bits (500Hz at the default rate) */
+static const uint8_t default_pattern[AUDIO_PATTERN_SZ] = {
+    0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+    0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
+};
+
+/* Called from the audio thread of SDL when the device needs `len' bytes */
+static void audio_callback(void* userdata, Uint8* stream, int len) {
+    Audio* audio     = userdata;
+    int16_t* out     = (int16_t*)stream;
+    const uint32_t n = len / sizeof(int16_t);
+
+    const uint64_t tail = audio->tail;
+    const uint64_t head = __atomic_load_n(&audio->head, __ATOMIC_ACQUIRE);
+
+    uint32_t avail = head - tail;
+    if (avail > n)
+        avail = n;
+
+    for (uint32_t i = 0; i < avail; i++)
+        out[i] = audio->ring[(tail + i) % AUDIO_RING_SZ];
+
+    /* The emulation is late, play silence instead of waiting */
+    if (avail < n) {
+        memset(&out[avail], 0, (n - avail) * sizeof(int16_t));
+        audio->underruns += n - avail;
+    }
+
+    __atomic_store_n(&audio->tail, tail + avail, __ATOMIC_RELEASE);
+}
+
+Audio* audio_open(void) {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        ERR("Unable to start the SDL audio: %s", SDL_GetError());
+        return NULL;
+    }
+
+    Audio* audio = calloc(1, sizeof(Audio));
+    if (audio == NULL) {
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return NULL;
+    }
+
+    SDL_AudioSpec want, have;
+    memset(&want, 0, sizeof(want));
+    want.freq     = AUDIO_RATE;
+    want.format   = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples  = AUDIO_SAMPLES;
+    want.callback = audio_callback;
+    want.userdata = audio;
+
+    audio->dev = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+                                     SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (audio->dev == 0) {
+        ERR("Could not open the audio device: %s", SDL_GetError());
+        free(audio);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return NULL;
+    }
+
+    audio->rate = have.freq;
+    audio_set_pattern(audio, default_pattern, AUDIO_PATTERN_RATE);
+
+    /* The device takes a frame of samples between two emulated frames, so
+     * after a frame, only the extra buffer of the device is still queued
+     * before the new samples */
+    audio->target = have.freq / FPS + have.samples;
+    if (audio->target > AUDIO_RING_SZ)
+        audio->target = AUDIO_RING_SZ;
+
+    SDL_PauseAudioDevice(audio->dev, 0);
+    return audio;
+}
+
+void audio_close(Audio* audio) {
+    if (audio == NULL)
+        return;
+
+    SDL_CloseAudioDevice(audio->dev);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    free(audio);
+}
+
+void audio_set_pattern(Audio* audio, const uint8_t* pattern, double rate) {
+    memcpy(audio->pattern, pattern, AUDIO_PATTERN_SZ);
+    audio->step = rate / audio->rate;
+}
+
+void audio_frame(Audio* audio, bool on) {
+    const uint64_t head = audio->head;
+    const uint64_t tail = __atomic_load_n(&audio->tail, __ATOMIC_ACQUIRE);
+
+    /* Only top up the ring, so the latency doesn't grow if the emulation
+     * runs faster than the device */
+    const uint32_t queued = head - tail;
+    if (queued >= audio->target)
+        return;
+
+    const uint32_t n = audio->target - queued;
+    for (uint32_t i = 0; i < n; i++) {
+        int16_t sample = 0;
+        if (on) {
+            const uint32_t bit = (uint32_t)audio->phase;
+            const bool high    = (audio->pattern[bit / 8] >> (7 - bit % 8)) & 1;
+            sample             = high ? AUDIO_VOLUME : -AUDIO_VOLUME;
+
+            audio->phase += audio->step;
+            if (audio->phase >= PATTERN_BITS)
+                audio->phase -= PATTERN_BITS;
+        }
+
+        audio->ring[(head + i) % AUDIO_RING_SZ] = sample;
+    }
+
+    /* Every tone starts at the beginning of the pattern */
+    if (!on)
+        audio->phase = 0;
+
+    __atomic_store_n(&audio->head, head + n, __ATOMIC_RELEASE);
+}
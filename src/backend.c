@@ -0,0 +1,132 @@
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "include/util.h"
+#include "include/cpu.h"
+#include "include/backend.h"
+#include "include/aot.h"
+#include "include/fuse.h"
+
+/* Reference interpreter, calls `cpu_cycle' for each instruction */
+static ECpuTrap interp_step(CpuCtx* ctx, void* state, int max, int* retired) {
+    (void)state;
+
+    for (*retired = 0; *retired < max; (*retired)++) {
+        const ECpuTrap trap = cpu_cycle(ctx);
+        if (trap != TRAP_NONE)
+            return trap;
+    }
+
+    return TRAP_NONE;
+}
+
+/* ROM compiled ahead of time, see aot.h. Without a module, it only
+ * interprets. */
+static void* aot_create(CpuCtx* ctx) {
+    const char* path = aot_get_module_path();
+    if (path == NULL)
+        return NULL;
+
+    Aot* aot = aot_open(path);
+    if (aot != NULL && !aot_reset(aot, ctx))
+        ERR("'%s' was not compiled for this ROM and profile, only "
+            "interpreting.",
+            path);
+
+    return aot;
+}
+
+static void aot_destroy(void* state) {
+    aot_free(state);
+}
+
+static void aot_backend_reset(CpuCtx* ctx, void* state) {
+    if (state != NULL)
+        aot_reset(state, ctx);
+}
+
+static ECpuTrap aot_backend_step(CpuCtx* ctx, void* state, int max,
+                                 int* retired) {
+    return aot_step(ctx, state, max, retired);
+}
+
+/* Interpreter with superinstructions, see fuse.h */
+static void* fuse_backend_create(CpuCtx* ctx) {
+    (void)ctx;
+    return fuse_create();
+}
+
+static void fuse_backend_destroy(void* state) {
+    fuse_destroy(state);
+}
+
+static void fuse_backend_reset(CpuCtx* ctx, void* state) {
+    (void)ctx;
+    fuse_invalidate(state);
+}
+
+static ECpuTrap fuse_backend_step(CpuCtx* ctx, void* state, int max,
+                                  int* retired) {
+    return fuse_step(ctx, state, max, retired);
+}
+
+static const CpuBackend backends[] = {
+    {
+      .name    = "interp",
+      .create  = NULL,
+      .destroy = NULL,
+      .reset   = NULL,
+      .step    = interp_step,
+    },
+    {
+      .name    = "aot",
+      .create  = aot_create,
+      .destroy = aot_destroy,
+      .reset   = aot_backend_reset,
+      .step    = aot_backend_step,
+    },
+    {
+      .name    = "fused",
+      .create  = fuse_backend_create,
+      .destroy = fuse_backend_destroy,
+      .reset   = fuse_backend_reset,
+      .step    = fuse_backend_step,
+    },
+};
+
+/*----------------------------------------------------------------------------*/
+
+const CpuBackend* backend_from_str(const char* name) {
+    for (size_t i = 0; i < LENGTH(backends); i++)
+        if (strcmp(backends[i].name, name) == 0)
+            return &backends[i];
+
+    return NULL;
+}
+
+const CpuBackend* backend_get(size_t i) {
+    return (i < LENGTH(backends)) ? &backends[i] : NULL;
+}
+
+void backend_print_names(void) {
+    for (size_t i = 0; i < LENGTH(backends); i++)
+        fprintf(stderr, "%s%s", (i > 0) ? ", " : "", backends[i].name);
+}
+
+ECpuTrap backend_frame(const CpuBackend* backend, CpuCtx* ctx, void* state) {
+    int done = 0;
+    while (done < CYCLES_PER_FRAME) {
+        int retired;
+        const ECpuTrap trap =
+          backend->step(ctx, state, CYCLES_PER_FRAME - done, &retired);
+        if (trap != TRAP_NONE)
+            return trap;
+
+        done += retired;
+    }
+
+    cpu_tick_timers(ctx);
+    return TRAP_NONE;
+}
@@ -0,0 +1,424 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "include/util.h"
+#include "include/display.h"
+#include "include/capture.h"
+
+/* Time that the writer thread sleeps when the queue is empty */
+#define WRITER_SLEEP_NS 1000000
+
+/* Scaled size of the images */
+#define IMG_W(CAPTURE) (DISP_W * (CAPTURE)->scale)
+#define IMG_H(CAPTURE) (DISP_H * (CAPTURE)->scale)
+
+/*----------------------------------------------------------------------------*/
+
+/* Expand a framebuffer into one byte per scaled pixel, with the specified
+ * values for set and unset pixels. */
+static void expand_pixels(const Capture* capture, const uint64_t* fb,
+                          uint8_t* dst, uint8_t set, uint8_t unset) {
+    const int w = IMG_W(capture);
+
+    for (int y = 0; y < DISP_H; y++) {
+        uint8_t* row = &dst[y * capture->scale * w];
+
+        for (int x = 0; x < DISP_W; x++) {
+            const uint8_t val = display_get_pixel(fb, x, y) ? set : unset;
+            memset(&row[x * capture->scale], val, capture->scale);
+        }
+
+        /* The other rows of this scaled pixel are copies of the first one */
+        for (int i = 1; i < capture->scale; i++)
+            memcpy(&row[i * w], row, w);
+    }
+}
+
+/* Pack one byte per pixel into 1-bit rows, MSB first. Each row is padded to a
+ * whole byte. */
+static size_t pack_bits(const Capture* capture, const uint8_t* pixels,
+                        uint8_t* dst) {
+    const int w           = IMG_W(capture);
+    const int h           = IMG_H(capture);
+    const size_t row_size = (w + 7) / 8;
+
+    memset(dst, 0, row_size * h);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+            if (pixels[y * w + x])
+                dst[y * row_size + x / 8] |= 0x80 >> (x % 8);
+
+    return row_size * h;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static uint32_t crc32_table[256];
+
+static void crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        crc32_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t sz) {
+    for (size_t i = 0; i < sz; i++)
+        crc = crc32_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+static void put_be32(uint8_t* dst, uint32_t val) {
+    dst[0] = (val >> 24) & 0xFF;
+    dst[1] = (val >> 16) & 0xFF;
+    dst[2] = (val >> 8) & 0xFF;
+    dst[3] = val & 0xFF;
+}
+
+/* Write a PNG chunk, with its length and CRC */
+static void png_chunk(FILE* fp, const char* type, const uint8_t* data,
+                      uint32_t sz) {
+    uint8_t buf[4];
+
+    put_be32(buf, sz);
+    fwrite(buf, 1, 4, fp);
+    fwrite(type, 1, 4, fp);
+    fwrite(data, 1, sz, fp);
+
+    uint32_t crc = crc32_update(0xFFFFFFFF, (const uint8_t*)type, 4);
+    crc          = crc32_update(crc, data, sz);
+    put_be32(buf, crc ^ 0xFFFFFFFF);
+    fwrite(buf, 1, 4, fp);
+}
+
+/* Write a 1-bit grayscale PNG. The image data is stored in uncompressed
+ * deflate blocks, so we don't depend on zlib. */
+static void write_png(FILE* fp, const Capture* capture, const uint8_t* bits) {
+    const uint32_t w        = IMG_W(capture);
+    const uint32_t h        = IMG_H(capture);
+    const uint32_t row_size = (w + 7) / 8;
+
+    fwrite("\x89PNG\r\n\x1A\n", 1, 8, fp);
+
+    uint8_t ihdr[13];
+    put_be32(&ihdr[0], w);
+    put_be32(&ihdr[4], h);
+    ihdr[8]  = 1; /* Bit depth */
+    ihdr[9]  = 0; /* Grayscale */
+    ihdr[10] = 0; /* Deflate */
+    ihdr[11] = 0; /* Adaptive filtering */
+    ihdr[12] = 0; /* No interlacing */
+    png_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+
+    /* Raw data: each row starts with a filter type of zero */
+    const uint32_t raw_sz = (row_size + 1) * h;
+    uint8_t* raw          = malloc(raw_sz);
+    for (uint32_t y = 0; y < h; y++) {
+        raw[y * (row_size + 1)] = 0;
+        memcpy(&raw[y * (row_size + 1) + 1], &bits[y * row_size], row_size);
+    }
+
+    /* Zlib stream: header, stored blocks of up to 0xFFFF bytes, and the
+     * Adler-32 of the raw data */
+    const uint32_t blocks = (raw_sz + 0xFFFE) / 0xFFFF;
+    const uint32_t idat_sz = 2 + blocks * 5 + raw_sz + 4;
+    uint8_t* idat          = malloc(idat_sz);
+    uint8_t* p             = idat;
+    *p++                   = 0x78;
+    *p++                   = 0x01;
+
+    uint32_t a = 1, b = 0;
+    for (uint32_t pos = 0; pos < raw_sz;) {
+        const uint32_t len = (raw_sz - pos > 0xFFFF) ? 0xFFFF : raw_sz - pos;
+
+        *p++ = (pos + len == raw_sz) ? 1 : 0;
+        *p++ = len & 0xFF;
+        *p++ = (len >> 8) & 0xFF;
+        *p++ = ~len & 0xFF;
+        *p++ = (~len >> 8) & 0xFF;
+        memcpy(p, &raw[pos], len);
+        p += len;
+
+        for (uint32_t i = 0; i < len; i++) {
+            a = (a + raw[pos + i]) % 65521;
+            b = (b + a) % 65521;
+        }
+
+        pos += len;
+    }
+
+    put_be32(p, (b << 16) | a);
+    png_chunk(fp, "IDAT", idat, idat_sz);
+    png_chunk(fp, "IEND", NULL, 0);
+
+    free(idat);
+    free(raw);
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* Encode a single frame in the format of the capture */
+static void write_frame(Capture* capture, const uint64_t* fb,
+                        uint8_t* pixels, uint8_t* bits) {
+    const int w = IMG_W(capture);
+    const int h = IMG_H(capture);
+
+    switch (capture->format) {
+        case CAPTURE_RAW: {
+            expand_pixels(capture, fb, pixels, 1, 0);
+            const size_t sz = pack_bits(capture, pixels, bits);
+            fwrite(bits, 1, sz, capture->fp);
+        } break;
+
+        case CAPTURE_PGM: {
+            expand_pixels(capture, fb, pixels, 255, 0);
+            fprintf(capture->fp, "P5\n%d %d\n255\n", w, h);
+            fwrite(pixels, 1, w * h, capture->fp);
+        } break;
+
+        case CAPTURE_PNG: {
+            /* The pattern is never used as a format string */
+            char filename[1100];
+            if (capture->zero_pad)
+                snprintf(filename, sizeof(filename), "%s%0*d%s",
+                         capture->prefix, capture->width,
+                         (int)capture->written, capture->suffix);
+            else
+                snprintf(filename, sizeof(filename), "%s%*d%s",
+                         capture->prefix, capture->width,
+                         (int)capture->written, capture->suffix);
+
+            FILE* fp = fopen(filename, "wb");
+            if (!fp) {
+                ERR("Failed to open file: '%s'", filename);
+                return;
+            }
+
+            expand_pixels(capture, fb, pixels, 1, 0);
+            pack_bits(capture, pixels, bits);
+            write_png(fp, capture, bits);
+            fclose(fp);
+        } break;
+
+        case CAPTURE_Y4M: {
+            /* Luma plane, and constant chroma planes with 4:2:0 subsampling */
+            expand_pixels(capture, fb, pixels, 235, 16);
+            fputs("FRAME\n", capture->fp);
+            fwrite(pixels, 1, w * h, capture->fp);
+
+            memset(pixels, 128, (w / 2) * (h / 2));
+            fwrite(pixels, 1, (w / 2) * (h / 2), capture->fp);
+            fwrite(pixels, 1, (w / 2) * (h / 2), capture->fp);
+        } break;
+    }
+
+    capture->written++;
+}
+
+static void* writer_thread(void* arg) {
+    Capture* capture = arg;
+
+    uint8_t* pixels = malloc(IMG_W(capture) * IMG_H(capture));
+    uint8_t* bits   = malloc(((IMG_W(capture) + 7) / 8) * IMG_H(capture));
+
+    for (;;) {
+        const uint64_t head = __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE);
+        const uint64_t tail = capture->tail;
+
+        if (tail == head) {
+            if (__atomic_load_n(&capture->stopping, __ATOMIC_ACQUIRE) &&
+                __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE) == tail)
+                break;
+
+            const struct timespec ts = { 0, WRITER_SLEEP_NS };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        /* Write every frame that is available, releasing each slot to the
+         * producer as soon as it's written, since some formats (like PNG,
+         * with a file per frame) are slow */
+        for (uint64_t i = tail; i != head; i++) {
+            write_frame(capture, capture->queue[i % CAPTURE_QUEUE_SZ], pixels,
+                        bits);
+            __atomic_store_n(&capture->tail, i + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    free(bits);
+    free(pixels);
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* Append a character to a string of `sz' bytes. Returns false if it doesn't
+ * fit. */
+static bool append_char(char* str, size_t* len, size_t sz, char c) {
+    if (*len + 1 >= sz)
+        return false;
+
+    str[(*len)++] = c;
+    str[*len]     = '\0';
+    return true;
+}
+
+/* Split a PNG filename pattern around its only integer conversion, which can
+ * have the '0' and '-' flags and a width. Any other '%' must be "%%". Returns
+ * false if the pattern is invalid. */
+static bool parse_pattern(Capture* capture, const char* pattern) {
+    char* dst  = capture->prefix;
+    size_t len = 0;
+    bool found = false;
+
+    capture->prefix[0] = capture->suffix[0] = '\0';
+    capture->width     = 0;
+    capture->zero_pad  = false;
+
+    for (const char* p = pattern; *p != '\0'; p++) {
+        if (*p != '%' || p[1] == '%') {
+            if (!append_char(dst, &len, sizeof(capture->prefix), *p))
+                return false;
+            if (*p == '%')
+                p++;
+            continue;
+        }
+
+        if (found)
+            return false;
+        found = true;
+
+        bool left = false;
+        for (p++; *p == '0' || *p == '-'; p++) {
+            if (*p == '0')
+                capture->zero_pad = true;
+            else
+                left = true;
+        }
+
+        int width = 0;
+        for (; *p >= '0' && *p <= '9'; p++) {
+            width = width * 10 + (*p - '0');
+            if (width > 64)
+                return false;
+        }
+
+        if (*p != 'd' && *p != 'i' && *p != 'u')
+            return false;
+
+        /* Zeros are ignored when aligning to the left, like with printf */
+        capture->width = left ? -width : width;
+        if (left)
+            capture->zero_pad = false;
+
+        dst = capture->suffix;
+        len = 0;
+    }
+
+    return found;
+}
+
+bool capture_format_from_path(const char* path, ECaptureFormat* format) {
+    const char* ext = strrchr(path, '.');
+    if (ext == NULL)
+        return false;
+
+    if (strcmp(ext, ".raw") == 0)
+        *format = CAPTURE_RAW;
+    else if (strcmp(ext, ".pgm") == 0)
+        *format = CAPTURE_PGM;
+    else if (strcmp(ext, ".png") == 0)
+        *format = CAPTURE_PNG;
+    else if (strcmp(ext, ".y4m") == 0)
+        *format = CAPTURE_Y4M;
+    else
+        return false;
+
+    return true;
+}
+
+Capture* capture_start(const char* path, ECaptureFormat format, int scale) {
+    if (scale < 1)
+        scale = 1;
+
+    /* Y4M needs even dimensions for the chroma planes, which is always true
+     * since DISP_W and DISP_H are even. */
+    Capture* capture  = calloc(1, sizeof(Capture));
+    capture->format   = format;
+    capture->scale    = scale;
+    capture->head     = 0;
+    capture->tail     = 0;
+    capture->stopping = false;
+
+    if (format == CAPTURE_PNG) {
+        /* The path is a pattern for the frame number */
+        if (!parse_pattern(capture, path)) {
+            ERR("PNG captures need a pattern with a single integer for the "
+                "frame number (e.g. \"frame%%05d.png\").");
+            free(capture);
+            return NULL;
+        }
+
+        crc32_init();
+    } else {
+        capture->fp = fopen(path, "wb");
+        if (!capture->fp) {
+            ERR("Failed to open file: '%s'", path);
+            free(capture);
+            return NULL;
+        }
+
+        if (format == CAPTURE_Y4M)
+            fprintf(capture->fp, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C420jpeg\n",
+                    IMG_W(capture), IMG_H(capture));
+    }
+
+    if (pthread_create(&capture->thread, NULL, writer_thread, capture) != 0) {
+        ERR("Could not create the writer thread.");
+        if (capture->fp != NULL)
+            fclose(capture->fp);
+        free(capture);
+        return NULL;
+    }
+
+    return capture;
+}
+
+void capture_frame(Capture* capture, const uint64_t* fb) {
+    const uint64_t head = capture->head;
+    const uint64_t tail = __atomic_load_n(&capture->tail, __ATOMIC_ACQUIRE);
+
+    /* Never wait for the writer thread */
+    if (head - tail >= CAPTURE_QUEUE_SZ) {
+        capture->dropped++;
+        return;
+    }
+
+    memcpy(capture->queue[head % CAPTURE_QUEUE_SZ], fb,
+           sizeof(capture->queue[0]));
+    __atomic_store_n(&capture->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void capture_stop(Capture* capture) {
+    __atomic_store_n(&capture->stopping, true, __ATOMIC_RELEASE);
+    pthread_join(capture->thread, NULL);
+
+    if (capture->fp != NULL)
+        fclose(capture->fp);
+
+    if (capture->dropped > 0)
+        ERR("Warning: Dropped %llu frames out of %llu.",
+            (unsigned long long)capture->dropped,
+            (unsigned long long)(capture->written + capture->dropped));
+
+    free(capture);
+}
@@ -12,32 +12,59 @@
 #define DO_STEP   true
 #define DONT_STEP false
 
+/* Quirks of each profile. See EQuirkFlags in cpu.h */
+#define QUIRKS_DEFAULT (QUIRK_VF_RESET | QUIRK_SHIFT_VX)
+#define QUIRKS_VIP     (QUIRK_VF_RESET | QUIRK_MEM_INC_I)
+#define QUIRKS_CHIP48  (QUIRK_SHIFT_VX | QUIRK_MEM_INC_IX | QUIRK_JUMP_VX)
+#define QUIRKS_SCHIP   (QUIRK_SHIFT_VX | QUIRK_JUMP_VX)
+
 /*----------------------------------------------------------------------------*/
 
-/* Push and pop values from the stack of the CPU */
-static void stack_push(CpuCtx* ctx, uint16_t val) {
-    if (ctx->SP >= LENGTH(ctx->stack)) {
-        ERR("Tried pushing with SP: %d", ctx->SP);
-        return;
-    }
+/* Push and pop values from the stack of the CPU. On overflow or underflow,
+ * the stack is left unchanged and the corresponding trap is returned. */
+static inline ECpuTrap stack_push(CpuCtx* ctx, uint16_t val) {
+    if (ctx->SP >= LENGTH(ctx->stack))
+        return TRAP_STACK_OVERFLOW;
 
     ctx->stack[ctx->SP++] = val;
+    return TRAP_NONE;
 }
 
-static uint16_t stack_pop(CpuCtx* ctx) {
-    if (ctx->SP <= 0) {
-        ERR("Tried popping with SP: %d", ctx->SP);
-        return 0;
-    }
+static inline ECpuTrap stack_pop(CpuCtx* ctx, uint16_t* dst) {
+    if (ctx->SP <= 0)
+        return TRAP_STACK_UNDERFLOW;
 
-    return ctx->stack[--ctx->SP];
+    *dst = ctx->stack[--ctx->SP];
+    return TRAP_NONE;
 }
 
+/* Access the emulated memory at the specified address. Since MEM_SZ is a
+ * power of two, out-of-range addresses wrap around with a mask, so the host
+ * memory is never accessed outside of the array, without any branches. The
+ * Program Counter is also wrapped with MEM_MASK whenever it changes. */
+#define MEM_AT(ADDR) ctx->mem[(ADDR) & MEM_MASK]
+
+/* Internal flag, combined with the EQuirkFlags of a profile, for generating the
+ * specialized versions that trap on out-of-range accesses. See EMemMode. */
+#define EXEC_MEM_TRAP (1 << 16)
+
+/* If the memory mode is MEM_TRAP, make sure that `sz' bytes starting at I are
+ * inside the emulated memory. Otherwise, this is removed at compile-time. */
+#define CHECK_I_RANGE(SZ)                                       \
+    do {                                                        \
+        if ((quirks & EXEC_MEM_TRAP) && ctx->I + (SZ) > MEM_SZ) \
+            return TRAP_MEM_RANGE;                              \
+    } while (0)
+
 /*----------------------------------------------------------------------------*/
 
 void cpu_init(CpuCtx* ctx) {
-    /* Allocate emulated memory */
-    ctx->mem = calloc(MEM_SZ, sizeof(uint8_t));
+    /* Clear the emulated memory, the framebuffer and the keyboard */
+    memset(ctx->mem, 0, sizeof(ctx->mem));
+    display_clear(ctx->fb);
+    ctx->kb.status   = KB_NONE;
+    ctx->kb.last_key = 0;
+    ctx->kb.held     = 0;
 
     /* Store the digit sprites in the "interpreter" memory region */
     memcpy(&ctx->mem[DIGITS_ADDR],
@@ -55,6 +82,9 @@ void cpu_init(CpuCtx* ctx) {
     /* Clear I register, and delay and sound timers */
     ctx->I = ctx->DT = ctx->ST = 0;
 
+    /* No tone was played yet */
+    ctx->sound = false;
+
     /* Initialize the program counter to where the programs are loaded */
     ctx->PC = ROM_LOAD_ADDR;
 
@@ -64,40 +94,73 @@ void cpu_init(CpuCtx* ctx) {
     /* Initialize the stack */
     for (size_t i = 0; i < LENGTH(ctx->stack); i++)
         ctx->stack[i] = 0;
+
+    /* Use a fixed seed for the RND instruction, so runs are reproducible
+     * unless the user specifies otherwise */
+    cpu_seed_rng(ctx, 1);
+
+    /* Use the default quirks and wrap memory accesses, until the user
+     * specifies otherwise */
+    ctx->mem_mode = MEM_WRAP;
+    cpu_set_profile(ctx, PROFILE_DEFAULT);
 }
 
 void cpu_free(CpuCtx* ctx) {
-    free(ctx->mem);
     free(ctx);
 }
 
-void cpu_load_rom(CpuCtx* ctx, const char* rom_filename) {
+void cpu_seed_rng(CpuCtx* ctx, uint32_t seed) {
+    /* The xorshift state can't be zero */
+    ctx->rng = (seed != 0) ? seed : 1;
+}
+
+bool cpu_load_rom(CpuCtx* ctx, const char* rom_filename) {
     FILE* fp = fopen(rom_filename, "rb");
-    if (!fp)
-        die("Failed to open file: '%s'\n", rom_filename);
+    if (!fp) {
+        ERR("Failed to open file: '%s'", rom_filename);
+        return false;
+    }
 
-    fseek(fp, 0L, SEEK_END);
-    size_t file_sz = ftell(fp);
-    fseek(fp, 0L, SEEK_SET);
+    /* Read one more byte than what fits, to detect if the ROM is too large */
+    uint8_t data[MEM_SZ - ROM_LOAD_ADDR + 1];
+    const size_t data_sz = fread(data, 1, sizeof(data), fp);
+    fclose(fp);
 
+    cpu_load_rom_data(ctx, data, data_sz);
+    return true;
+}
+
+void cpu_load_rom_data(CpuCtx* ctx, const uint8_t* data, size_t sz) {
     const size_t max_sz = MEM_SZ - ROM_LOAD_ADDR;
-    if (file_sz > max_sz) {
-        ERR("Warning: ROM is too large. Reading up to 0x%X bytes.", max_sz);
-        file_sz = max_sz;
+    if (sz > max_sz) {
+        ERR("Warning: ROM is too large. Reading up to 0x%zX bytes.", max_sz);
+        sz = max_sz;
     }
 
-    for (size_t i = 0; i < file_sz; i++)
-        ctx->mem[ctx->PC + i] = fgetc(fp);
-
-    fclose(fp);
+    memcpy(&ctx->mem[ROM_LOAD_ADDR], data, sz);
 }
 
 /*----------------------------------------------------------------------------*/
 
-void cpu_frame(CpuCtx* ctx) {
-    /* Each frame, run N instructions */
-    for (int i = 0; i < CYCLES_PER_FRAME; i++)
-        cpu_cycle(ctx);
+ECpuTrap cpu_frame(CpuCtx* ctx) {
+    int retired;
+    return cpu_frame_count(ctx, &retired);
+}
+
+ECpuTrap cpu_frame_count(CpuCtx* ctx, int* retired) {
+    /* Each frame, run N instructions. Stop as soon as one of them traps. */
+    for (*retired = 0; *retired < CYCLES_PER_FRAME; (*retired)++) {
+        const ECpuTrap trap = cpu_cycle(ctx);
+        if (trap != TRAP_NONE)
+            return trap;
+    }
+
+    cpu_tick_timers(ctx);
+    return TRAP_NONE;
+}
+
+void cpu_tick_timers(CpuCtx* ctx) {
+    ctx->sound = ctx->ST > 0;
 
     /* Decrement the timers, if needed */
     if (ctx->DT > 0)
@@ -106,24 +169,75 @@ void cpu_frame(CpuCtx* ctx) {
         ctx->ST--;
 }
 
-void cpu_cycle(CpuCtx* ctx) {
-    /* Read next two bytes at the Program Counter. CHIP-8 is always
-     * big-endian. */
-    uint16_t current_opcode;
-    current_opcode = ctx->mem[ctx->PC] << 8;
-    current_opcode |= ctx->mem[ctx->PC + 1];
-
-    /* First, make sure that the keyboard is not waiting for a key for the
-     * "LD Vx, K" instruction. If it is, do not increment the Program Counter.
-     * Otherwise, increment it before executing the instruction itself */
-    if (kb_get_status() != KB_WAITING)
-        ctx->PC += 2;
-
-    /* Parse and execute the instruction */
-    cpu_exec(ctx, current_opcode);
+ECpuTrap cpu_cycle(CpuCtx* ctx) {
+    const uint16_t pc = ctx->PC;
+
+    /* Read next two bytes at the Program Counter */
+    const uint16_t current_opcode = cpu_fetch(ctx);
+
+    /* Increment the Program Counter before executing the instruction itself.
+     * While waiting for a key, "LD Vx, K" moves it back to itself. */
+    ctx->PC = (ctx->PC + 2) & MEM_MASK;
+
+    /* Parse and execute the instruction. If it traps, point the Program
+     * Counter back to it, so the state can be inspected. */
+    const ECpuTrap trap = ctx->exec(ctx, current_opcode);
+    if (trap != TRAP_NONE)
+        ctx->PC = pc;
+
+    return trap;
+}
+
+ECpuTrap cpu_exec(CpuCtx* ctx, uint16_t opcode) {
+    return ctx->exec(ctx, opcode);
+}
+
+bool cpu_opcode_valid(uint16_t opcode) {
+    const uint8_t byte2 = opcode & 0xFF;
+
+    /* Same cases as `exec_quirks' */
+    switch (opcode >> 12) {
+        case 0x0:
+            return byte2 == 0xE0 || byte2 == 0xEE;
+
+        case 0x5:
+        case 0x9:
+            return (opcode & 0xF) == 0;
+
+        case 0x8:
+            return (opcode & 0xF) <= 7 || (opcode & 0xF) == 0xE;
+
+        case 0xE:
+            return byte2 == 0x9E || byte2 == 0xA1;
+
+        case 0xF:
+            switch (byte2) {
+                case 0x07:
+                case 0x0A:
+                case 0x15:
+                case 0x18:
+                case 0x1E:
+                case 0x29:
+                case 0x33:
+                case 0x55:
+                case 0x65:
+                    return true;
+            }
+            return false;
+
+        default:
+            return true;
+    }
 }
 
-void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
+/*----------------------------------------------------------------------------*/
+
+/* Generic version of `cpu_exec'. The `quirks' argument is a combination of
+ * EQuirkFlags, and it must be a constant, since this function is only used to
+ * generate the specialized versions below. Once inlined, the compiler removes
+ * the checks for the quirks that are not part of the profile. */
+static inline __attribute__((always_inline)) ECpuTrap
+exec_quirks(CpuCtx* ctx, uint16_t opcode, const int quirks) {
     /* Groups of 8 bits, from left to right */
     const uint8_t byte1 = (opcode >> 8) & 0xFF;
     const uint8_t byte2 = opcode & 0xFF;
@@ -140,20 +254,22 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
             switch (byte2) {
                 /* CLS */
                 case 0xE0: {
-                    display_clear();
+                    display_clear(ctx->fb);
 
                     PRNT_I("CLS");
                 } break;
 
                 /* RET */
                 case 0xEE: {
-                    ctx->PC = stack_pop(ctx);
+                    const ECpuTrap trap = stack_pop(ctx, &ctx->PC);
+                    if (trap != TRAP_NONE)
+                        return trap;
 
                     PRNT_I("RET");
                 } break;
 
                 default: {
-                    die("Invalid opcode: %04X", opcode);
+                    return TRAP_INVALID_OPCODE;
                 } break;
             }
         } break;
@@ -166,7 +282,10 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
         /* CALL addr */
         case 2: {
             /* Push address of current instruction + size of opcode */
-            stack_push(ctx, ctx->PC);
+            const ECpuTrap trap = stack_push(ctx, ctx->PC);
+            if (trap != TRAP_NONE)
+                return trap;
+
             ctx->PC = opcode & 0xFFF;
 
             PRNT_I("CALL %X", opcode & 0xFFF);
@@ -176,7 +295,7 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
         case 3: {
             const bool cmp = ctx->V[nibble2] == byte2;
             if (cmp)
-                ctx->PC += 2;
+                ctx->PC = (ctx->PC + 2) & MEM_MASK;
 
             PRNT_I("SE V%X, %X\t\t; Cmp: %X", nibble2, byte2, cmp);
         } break;
@@ -185,7 +304,7 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
         case 4: {
             const bool cmp = ctx->V[nibble2] != byte2;
             if (cmp)
-                ctx->PC += 2;
+                ctx->PC = (ctx->PC + 2) & MEM_MASK;
 
             PRNT_I("SNE V%X, %X\t\t; Cmp: %X", nibble2, byte2, cmp);
         } break;
@@ -193,11 +312,11 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
         /* SE Vx, Vy */
         case 5: {
             if (nibble4 != 0)
-                die("Invalid opcode: %04X", opcode);
+                return TRAP_INVALID_OPCODE;
 
             const bool cmp = ctx->V[nibble2] == ctx->V[nibble3];
             if (cmp)
-                ctx->PC += 2;
+                ctx->PC = (ctx->PC + 2) & MEM_MASK;
 
             PRNT_I("SE V%X, V%X\t\t; Cmp: %X", nibble2, nibble3, cmp);
         } break;
@@ -229,21 +348,24 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
                 /* OR Vx, Vy */
                 case 1: {
                     ctx->V[nibble2] |= ctx->V[nibble3];
-                    ctx->V[0xF] = 0;
+                    if (quirks & QUIRK_VF_RESET)
+                        ctx->V[0xF] = 0;
                     PRNT_I("OR V%X, V%X", nibble2, nibble3);
                 } break;
 
                 /* AND Vx, Vy */
                 case 2: {
                     ctx->V[nibble2] &= ctx->V[nibble3];
-                    ctx->V[0xF] = 0;
+                    if (quirks & QUIRK_VF_RESET)
+                        ctx->V[0xF] = 0;
                     PRNT_I("AND V%X, V%X", nibble2, nibble3);
                 } break;
 
                 /* XOR Vx, Vy */
                 case 3: {
                     ctx->V[nibble2] ^= ctx->V[nibble3];
-                    ctx->V[0xF] = 0;
+                    if (quirks & QUIRK_VF_RESET)
+                        ctx->V[0xF] = 0;
                     PRNT_I("XOR V%X, V%X", nibble2, nibble3);
                 } break;
 
@@ -276,13 +398,19 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
 
                 /* SHR Vx {, Vy} */
                 case 6: {
-                    /* VF will store if bit 7 of Vx was set before the
+                    /* Depending on the quirks, shift Vx in place or store the
+                     * shifted Vy in Vx. */
+                    const uint8_t src =
+                      (quirks & QUIRK_SHIFT_VX) ? ctx->V[nibble2]
+                                                : ctx->V[nibble3];
+
+                    /* VF will store if bit 0 of the source was set before the
                      * operation. */
-                    const bool discarded = ctx->V[nibble2] & 1;
+                    const bool discarded = src & 1;
 
                     /* Shift 1 bit to the right, effectively dividing by 2.
                      * Make sure the flags are set after the operation. */
-                    ctx->V[nibble2] >>= 1;
+                    ctx->V[nibble2] = src >> 1;
                     ctx->V[0xF] = discarded;
 
                     PRNT_I("SHR V%X\t\t\t; Result: %X, Flag: %X", nibble2,
@@ -304,13 +432,18 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
 
                 /* SHL Vx {, Vy} */
                 case 0xE: {
-                    /* VF will store if bit 7 of Vx was set before the
+                    /* See SHR */
+                    const uint8_t src =
+                      (quirks & QUIRK_SHIFT_VX) ? ctx->V[nibble2]
+                                                : ctx->V[nibble3];
+
+                    /* VF will store if bit 7 of the source was set before the
                      * operation. */
-                    const bool discarded = (ctx->V[nibble2] >> 7) & 1;
+                    const bool discarded = (src >> 7) & 1;
 
                     /* Shift 1 bit to the left, effectively multiplying by 2.
                      * Make sure the flags are set after the operation. */
-                    ctx->V[nibble2] <<= 1;
+                    ctx->V[nibble2] = src << 1;
                     ctx->V[0xF] = discarded;
 
                     PRNT_I("SHL V%X\t\t\t; Result: %X, Flag: %X", nibble2,
@@ -318,7 +451,7 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
                 } break;
 
                 default: {
-                    die("Invalid opcode: %04X", opcode);
+                    return TRAP_INVALID_OPCODE;
                 } break;
             }
         } break;
@@ -326,11 +459,11 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
         /* SNE Vx, Vy */
         case 9: {
             if (nibble4 != 0)
-                die("Invalid opcode: %04X", opcode);
+                return TRAP_INVALID_OPCODE;
 
             const bool cmp = ctx->V[nibble2] != ctx->V[nibble3];
             if (cmp)
-                ctx->PC += 2;
+                ctx->PC = (ctx->PC + 2) & MEM_MASK;
 
             PRNT_I("SNE V%X, V%X\t\t; Cmp: %X", nibble2, nibble3, cmp);
         } break;
@@ -343,14 +476,31 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
 
         /* JP V0, addr */
         case 0xB: {
-            ctx->PC = ctx->V[0] + (opcode & 0xFFF);
-            PRNT_I("JP V0, %X\t\t\t; Addr: %X", opcode & 0xFFF,
-                   ctx->V[0] + (opcode & 0xFFF));
+            /* With the jump quirk, this is actually `JP Vx, xnn' */
+            const uint8_t reg = (quirks & QUIRK_JUMP_VX) ? nibble2 : 0;
+
+            /* This is the only instruction that can jump outside of the
+             * memory. Instructions are always fetched with a mask, but in
+             * MEM_TRAP mode, report it. */
+            if ((quirks & EXEC_MEM_TRAP) &&
+                ctx->V[reg] + (opcode & 0xFFF) > MEM_SZ - 2)
+                return TRAP_MEM_RANGE;
+
+            ctx->PC = (ctx->V[reg] + (opcode & 0xFFF)) & MEM_MASK;
+            PRNT_I("JP V%X, %X\t\t\t; Addr: %X", reg, opcode & 0xFFF,
+                   ctx->PC);
         } break;
 
         /* RND Vx, byte */
         case 0xC: {
-            const uint8_t random_byte = rand() % 0xFF;
+            /* Xorshift32, with the state stored in the context itself */
+            uint32_t rng = ctx->rng;
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            ctx->rng = rng;
+
+            const uint8_t random_byte = rng & 0xFF;
             ctx->V[nibble2]           = random_byte & byte2;
 
             PRNT_I("RND V%X, %X\t\t\t; Result: %X", nibble2, byte2,
@@ -361,12 +511,19 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
         case 0xD: {
             const uint8_t x           = ctx->V[nibble2];
             const uint8_t y           = ctx->V[nibble3];
-            const void* bytes         = &ctx->mem[ctx->I];
             const uint8_t byte_number = nibble4;
 
+            CHECK_I_RANGE(byte_number);
+
+            /* Copy the sprite, since it might wrap around the memory */
+            uint8_t bytes[16];
+            for (int i = 0; i < byte_number; i++)
+                bytes[i] = MEM_AT(ctx->I + i);
+
             /* If there is a collision (a pixel was set, but is cleared after
              * the draw operation), set VF to 1. Set it to 0 otherwise. */
-            ctx->V[0xF] = display_draw_sprite(x, y, bytes, byte_number);
+            ctx->V[0xF] =
+              display_draw_sprite(ctx->fb, x, y, bytes, byte_number);
 
             PRNT_I("DRW V%X, V%X, %X\t\t; I: %X", nibble2, nibble3, nibble4,
                    ctx->I);
@@ -374,13 +531,13 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
 
         case 0xE: {
             const uint8_t key = ctx->V[nibble2] & 0xF;
-            const bool held   = kb_is_held(key);
+            const bool held   = kb_is_held(&ctx->kb, key);
 
             switch (byte2) {
                 /* SKP Vx */
                 case 0x9E: {
                     if (held)
-                        ctx->PC += 2;
+                        ctx->PC = (ctx->PC + 2) & MEM_MASK;
 
                     PRNT_I("SKP V%X\t\t\t; Cmp: %X, Key: %X", nibble2, held,
                            key);
@@ -389,14 +546,14 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
                 /* SKNP Vx */
                 case 0xA1: {
                     if (!held)
-                        ctx->PC += 2;
+                        ctx->PC = (ctx->PC + 2) & MEM_MASK;
 
                     PRNT_I("SKNP V%X\t\t\t; Cmp: %X, Key: %X", nibble2, !held,
                            key);
                 } break;
 
                 default: {
-                    die("Invalid opcode: %04X", opcode);
+                    return TRAP_INVALID_OPCODE;
                 } break;
             }
         } break;
@@ -412,25 +569,29 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
 
                 /* LD Vx, K */
                 case 0x0A: {
-                    const EKeyboardStatus keyboard_status = kb_get_status();
+                    const EKeyboardStatus keyboard_status =
+                      kb_get_status(&ctx->kb);
 
                     /* If the keyboard is not waiting, wait. If the keyboard was
-                     * waiting but has a key for us, retreive it. If it's
-                     * already waiting, don't do anything. */
+                     * waiting but has a key for us, retreive it. Until then,
+                     * this instruction is executed again on each cycle. */
                     switch (keyboard_status) {
                         default:
                         case KB_NONE: {
-                            kb_wait_for_key();
+                            kb_wait_for_key(&ctx->kb);
+                            ctx->PC = (ctx->PC - 2) & MEM_MASK;
                         } break;
 
                         case KB_HAS_KEY: {
-                            ctx->V[nibble2] = kb_get_last_key() & 0xFF;
+                            ctx->V[nibble2] =
+                              kb_get_last_key(&ctx->kb) & 0xFF;
                             PRNT_I("LD V%X, K\t\t; Key: %X", nibble2,
                                    ctx->V[nibble2]);
                         } break;
 
-                        case KB_WAITING:
-                            break;
+                        case KB_WAITING: {
+                            ctx->PC = (ctx->PC - 2) & MEM_MASK;
+                        } break;
                     }
                 } break;
 
@@ -460,49 +621,149 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
 
                 /* LD B, Vx */
                 case 0x33: {
+                    CHECK_I_RANGE(3);
+
                     uint8_t n = ctx->V[nibble2];
 
                     /* Store right-most decimal digit */
-                    ctx->mem[ctx->I + 2] = n % 10;
+                    MEM_AT(ctx->I + 2) = n % 10;
 
                     /* Store middle decimal digit */
                     n /= 10;
-                    ctx->mem[ctx->I + 1] = n % 10;
+                    MEM_AT(ctx->I + 1) = n % 10;
 
                     /* Store left-most decimal digit */
                     n /= 10;
-                    ctx->mem[ctx->I] = n % 10;
+                    MEM_AT(ctx->I) = n % 10;
 
                     PRNT_I("LD B, V%X", nibble2);
                 } break;
 
                 /* LD [I], Vx */
                 case 0x55: {
+                    CHECK_I_RANGE(nibble2 + 1);
+
                     for (int i = 0; i <= nibble2; i++)
-                        ctx->mem[ctx->I + i] = ctx->V[i];
+                        MEM_AT(ctx->I + i) = ctx->V[i];
+
+                    if (quirks & QUIRK_MEM_INC_I)
+                        ctx->I += nibble2 + 1;
+                    else if (quirks & QUIRK_MEM_INC_IX)
+                        ctx->I += nibble2;
 
                     PRNT_I("LD [I], V%X", nibble2);
                 } break;
 
                 /* LD Vx, [I] */
                 case 0x65: {
+                    CHECK_I_RANGE(nibble2 + 1);
+
                     for (int i = 0; i <= nibble2; i++)
-                        ctx->V[i] = ctx->mem[ctx->I + i];
+                        ctx->V[i] = MEM_AT(ctx->I + i);
+
+                    if (quirks & QUIRK_MEM_INC_I)
+                        ctx->I += nibble2 + 1;
+                    else if (quirks & QUIRK_MEM_INC_IX)
+                        ctx->I += nibble2;
 
                     PRNT_I("LD [I], V%X", nibble2);
                 } break;
 
                 default: {
-                    die("Invalid opcode: %04X", opcode);
+                    return TRAP_INVALID_OPCODE;
                 } break;
             }
         } break;
 
         default: {
             /* If we reached here, this was an invalid instruction */
-            die("Invalid opcode: %04X", opcode);
+            return TRAP_INVALID_OPCODE;
         } break;
     }
+
+    return TRAP_NONE;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* Generate the specialized versions of `exec_quirks' for each profile, one for
+ * each memory mode. */
+#define DEFINE_EXEC(NAME, QUIRKS)                                  \
+    static ECpuTrap NAME##_wrap(CpuCtx* ctx, uint16_t opcode) {    \
+        return exec_quirks(ctx, opcode, QUIRKS);                   \
+    }                                                              \
+    static ECpuTrap NAME##_trap(CpuCtx* ctx, uint16_t opcode) {    \
+        return exec_quirks(ctx, opcode, (QUIRKS) | EXEC_MEM_TRAP); \
+    }
+
+DEFINE_EXEC(exec_default, QUIRKS_DEFAULT)
+DEFINE_EXEC(exec_vip, QUIRKS_VIP)
+DEFINE_EXEC(exec_chip48, QUIRKS_CHIP48)
+DEFINE_EXEC(exec_schip, QUIRKS_SCHIP)
+
+static const struct {
+    const char* name;
+    int quirks;
+    CpuExecFunc exec[2]; /* Indexed by EMemMode */
+} profiles[PROFILE_COUNT] = {
+    [PROFILE_DEFAULT] = { "default",
+                          QUIRKS_DEFAULT,
+                          { exec_default_wrap, exec_default_trap } },
+    [PROFILE_VIP]     = { "vip", QUIRKS_VIP, { exec_vip_wrap, exec_vip_trap } },
+    [PROFILE_CHIP48]  = { "chip48",
+                          QUIRKS_CHIP48,
+                          { exec_chip48_wrap, exec_chip48_trap } },
+    [PROFILE_SCHIP]   = { "schip",
+                          QUIRKS_SCHIP,
+                          { exec_schip_wrap, exec_schip_trap } },
+};
+
+void cpu_set_profile(CpuCtx* ctx, EQuirkProfile profile) {
+    if (profile >= PROFILE_COUNT) {
+        ERR("Invalid profile: %d", profile);
+        profile = PROFILE_DEFAULT;
+    }
+
+    ctx->profile = profile;
+    ctx->exec    = profiles[profile].exec[ctx->mem_mode];
+}
+
+void cpu_set_mem_mode(CpuCtx* ctx, EMemMode mode) {
+    ctx->mem_mode = (mode == MEM_TRAP) ? MEM_TRAP : MEM_WRAP;
+    ctx->exec     = profiles[ctx->profile].exec[ctx->mem_mode];
+}
+
+EQuirkProfile cpu_profile_from_str(const char* name) {
+    for (int i = 0; i < PROFILE_COUNT; i++)
+        if (strcmp(profiles[i].name, name) == 0)
+            return i;
+
+    return PROFILE_COUNT;
+}
+
+const char* cpu_profile_str(EQuirkProfile profile) {
+    return (profile < PROFILE_COUNT) ? profiles[profile].name : "unknown";
+}
+
+int cpu_profile_quirks(EQuirkProfile profile) {
+    return (profile < PROFILE_COUNT) ? profiles[profile].quirks : 0;
+}
+
+const char* cpu_trap_str(ECpuTrap trap) {
+    switch (trap) {
+        case TRAP_NONE:
+            return "No trap";
+        case TRAP_INVALID_OPCODE:
+            return "Invalid opcode";
+        case TRAP_STACK_OVERFLOW:
+            return "Stack overflow";
+        case TRAP_STACK_UNDERFLOW:
+            return "Stack underflow";
+        case TRAP_MEM_RANGE:
+            return "Memory access out of range";
+    }
+
+    return "Unknown trap";
 }
 
 /*----------------------------------------------------------------------------*/
@@ -510,7 +771,7 @@ void cpu_exec(CpuCtx* ctx, uint16_t opcode) {
 void cpu_dump_mem(CpuCtx* ctx, size_t sz) {
     for (size_t i = 0; i < sz; i++) {
         const int addr     = ROM_LOAD_ADDR + i;
-        const uint8_t byte = ctx->mem[addr];
+        const uint8_t byte = MEM_AT(addr);
 
         if (addr % 0x10 == 0)
             printf("\n%04X: ", addr);
@@ -521,3 +782,17 @@ void cpu_dump_mem(CpuCtx* ctx, size_t sz) {
     }
     printf("\n\n");
 }
+
+uint64_t cpu_hash_mem(const CpuCtx* ctx) {
+    return hash_fnv1a(FNV1A_INIT, ctx->mem, sizeof(ctx->mem));
+}
+
+uint64_t cpu_hash_fb(const CpuCtx* ctx) {
+    /* Hash the rows as big-endian bytes, from left to right */
+    uint8_t bytes[DISP_H * 8];
+    for (int y = 0; y < DISP_H; y++)
+        for (int i = 0; i < 8; i++)
+            bytes[y * 8 + i] = (ctx->fb[y] >> (56 - i * 8)) & 0xFF;
+
+    return hash_fnv1a(FNV1A_INIT, bytes, sizeof(bytes));
+}
@@ -0,0 +1,477 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "include/cpu.h"
+#include "include/disasm.h"
+#include "include/debug.h"
+
+/* Debugger whose watchpoints are checked by `watch_exec' */
+static Debugger* watching = NULL;
+
+/* Replacement for the `exec' of the context, while there are watchpoints.
+ * Checks the memory accessed relative to I, and then runs the original. The
+ * hit is only reported if the instruction didn't trap. */
+static ECpuTrap watch_exec(CpuCtx* ctx, uint16_t opcode) {
+    Debugger* dbg = watching;
+    const int x   = (opcode >> 8) & 0xF;
+
+    int len = 0, flags = 0;
+    if ((opcode & 0xF000) == 0xD000) {
+        len   = opcode & 0xF;
+        flags = WATCH_READ;
+    } else {
+        switch (opcode & 0xF0FF) {
+            case 0xF033:
+                len   = 3;
+                flags = WATCH_WRITE;
+                break;
+
+            case 0xF055:
+                len   = x + 1;
+                flags = WATCH_WRITE;
+                break;
+
+            case 0xF065:
+                len   = x + 1;
+                flags = WATCH_READ;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    /* Checked before running it, since some quirks change I */
+    int hit = -1;
+    for (int i = 0; i < len; i++) {
+        const uint16_t addr = (ctx->I + i) & MEM_MASK;
+        if (dbg->watchpoints[addr] & flags) {
+            hit = addr;
+            break;
+        }
+    }
+
+    const ECpuTrap trap = dbg->exec(ctx, opcode);
+    if (trap == TRAP_NONE && hit >= 0) {
+        dbg->watch_hit  = (flags == WATCH_READ) ? STOP_WATCH_READ
+                                                : STOP_WATCH_WRITE;
+        dbg->watch_addr = hit;
+    }
+
+    return trap;
+}
+
+/* Run a single instruction, finishing the frame after the last one. Stops if
+ * it traps or hits a watchpoint. */
+static ECpuTrap run_cycle(Debugger* dbg) {
+    CpuCtx* ctx = dbg->ctx;
+
+    const ECpuTrap trap = cpu_cycle(ctx);
+    if (trap != TRAP_NONE) {
+        dbg->trap = trap;
+        debug_stop(dbg, STOP_TRAP);
+        return trap;
+    }
+
+    if (++dbg->cycle >= CYCLES_PER_FRAME) {
+        dbg->cycle = 0;
+        cpu_tick_timers(ctx);
+    }
+
+    if (dbg->watch_hit != STOP_NONE) {
+        debug_stop(dbg, dbg->watch_hit);
+        dbg->stop_addr = dbg->watch_addr;
+        dbg->watch_hit = STOP_NONE;
+    }
+
+    return TRAP_NONE;
+}
+
+/* Print the PC and the instruction at it */
+static void print_location(const CpuCtx* ctx, FILE* fp) {
+    char str[DISASM_SZ];
+    disasm(cpu_fetch(ctx), str, sizeof(str));
+    fprintf(fp, "%03X:\t%s\n", ctx->PC, str);
+}
+
+static void print_regs(const CpuCtx* ctx, FILE* fp) {
+    for (int i = 0; i < 16; i++)
+        fprintf(fp, "V%X=%02X%c", i, ctx->V[i], (i % 8 == 7) ? '\n' : ' ');
+
+    fprintf(fp, "I=%03X PC=%03X SP=%X DT=%02X ST=%02X\n", ctx->I, ctx->PC,
+            ctx->SP, ctx->DT, ctx->ST);
+
+    for (int i = 0; i < ctx->SP && i < 16; i++)
+        fprintf(fp, "%s%03X", (i == 0) ? "Stack: " : " ", ctx->stack[i]);
+    if (ctx->SP > 0)
+        fputc('\n', fp);
+}
+
+static void print_mem(const CpuCtx* ctx, unsigned addr, unsigned len,
+                      FILE* fp) {
+    for (unsigned i = 0; i < len; i++) {
+        if (i % 16 == 0)
+            fprintf(fp, "%s%03X:", (i == 0) ? "" : "\n",
+                    (addr + i) & MEM_MASK);
+        fprintf(fp, " %02X", ctx->mem[(addr + i) & MEM_MASK]);
+    }
+    fputc('\n', fp);
+}
+
+static void print_list(const CpuCtx* ctx, unsigned addr, unsigned num,
+                       FILE* fp) {
+    for (unsigned i = 0; i < num; i++) {
+        const uint16_t cur = (addr + i * 2) & MEM_MASK;
+        const uint16_t opcode =
+          (ctx->mem[cur] << 8) | ctx->mem[(cur + 1) & MEM_MASK];
+
+        char str[DISASM_SZ];
+        disasm(opcode, str, sizeof(str));
+        fprintf(fp, "%c %03X:\t%04X\t%s\n", (cur == ctx->PC) ? '>' : ' ', cur,
+                opcode, str);
+    }
+}
+
+static void print_points(const Debugger* dbg, FILE* fp) {
+    for (int addr = 0; addr < MEM_SZ; addr++) {
+        if (dbg->breakpoints[addr])
+            fprintf(fp, "Breakpoint at %03X\n", addr);
+
+        const int flags = dbg->watchpoints[addr];
+        if (flags != 0)
+            fprintf(fp, "Watchpoint at %03X (%s%s)\n", addr,
+                    (flags & WATCH_READ) ? "r" : "",
+                    (flags & WATCH_WRITE) ? "w" : "");
+    }
+}
+
+static void print_help(FILE* fp) {
+    fputs("Addresses and numbers are in hexadecimal.\n"
+          "  break ADDR          Stop before running the instruction at ADDR\n"
+          "  delete ADDR         Remove a breakpoint\n"
+          "  watch ADDR [LEN]    Stop after writing to ADDR\n"
+          "  rwatch ADDR [LEN]   Stop after reading ADDR\n"
+          "  awatch ADDR [LEN]   Stop after reading or writing ADDR\n"
+          "  unwatch ADDR [LEN]  Remove a watchpoint\n"
+          "  info                List the breakpoints and watchpoints\n"
+          "  continue            Resume the machine\n"
+          "  stop                Stop the machine\n"
+          "  step [NUM]          Run NUM instructions (default: 1)\n"
+          "  next                Run an instruction, or a whole CALL\n"
+          "  regs                Show the registers\n"
+          "  mem ADDR [LEN]      Show LEN bytes of memory (default: 10)\n"
+          "  list [ADDR] [NUM]   Disassemble NUM instructions (default: 8)\n"
+          "  ram snap            Start a RAM search with a snapshot\n"
+          "  ram PRED [VALUE]    Take a snapshot, and keep the addresses\n"
+          "                      that are changed, unchanged, increased or\n"
+          "                      decreased since the last one, or eq or ne\n"
+          "                      to VALUE\n"
+          "  ram list [NUM]      Show NUM candidates (default: 10)\n"
+          "  ram reset           Make every address a candidate again\n"
+          "  quit                Quit the emulator\n"
+          "Each command can be abbreviated to its first letter, except\n"
+          "rwatch, awatch, unwatch, stop and ram.\n",
+          fp);
+}
+
+/* Run the "ram" subcommands, see `print_help' */
+static void ram_command(Debugger* dbg, const char* line, FILE* fp) {
+    RamSearch* rs = &dbg->ram;
+
+    char sub[16];
+    unsigned arg;
+    const int num = sscanf(line, "%*s %15s %x", sub, &arg);
+    if (num < 1) {
+        fprintf(fp, "Missing subcommand.\n");
+        return;
+    }
+
+    if (!strcmp(sub, "snap")) {
+        ram_search_reset(rs);
+        ram_search_snapshot(rs, dbg->ctx);
+        fprintf(fp, "%u candidates\n", rs->num_candidates);
+    } else if (!strcmp(sub, "list")) {
+        ram_search_print(rs, (num > 1) ? arg : 0x10, fp);
+    } else if (!strcmp(sub, "reset")) {
+        ram_search_reset(rs);
+    } else {
+        const ERamPredicate pred = ram_predicate_from_str(sub);
+        if (pred == RAM_PREDICATE_COUNT) {
+            fprintf(fp, "Unknown subcommand: '%s'. Try \"help\".\n", sub);
+            return;
+        }
+
+        if (ram_predicate_has_value(pred) && num < 2) {
+            fprintf(fp, "Missing value.\n");
+            return;
+        }
+
+        if (rs->num_snapshots == 0) {
+            fprintf(fp, "No snapshot, start with \"ram snap\".\n");
+            return;
+        }
+
+        const uint32_t cur = ram_search_snapshot(rs, dbg->ctx);
+        ram_search_filter(rs, pred, cur - 1, cur, (num > 1) ? arg : 0);
+        fprintf(fp, "%u candidates\n", rs->num_candidates);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+void debug_init(Debugger* dbg, CpuCtx* ctx) {
+    memset(dbg, 0, sizeof(Debugger));
+    dbg->ctx          = ctx;
+    dbg->stopped      = true;
+    dbg->stop_pending = true;
+    dbg->stop         = STOP_REQUEST;
+    ram_search_init(&dbg->ram);
+}
+
+void debug_free(Debugger* dbg) {
+    if (dbg->num_watchpoints > 0) {
+        dbg->ctx->exec = dbg->exec;
+        watching       = NULL;
+    }
+
+    memset(dbg->breakpoints, 0, sizeof(dbg->breakpoints));
+    memset(dbg->watchpoints, 0, sizeof(dbg->watchpoints));
+    dbg->num_breakpoints = 0;
+    dbg->num_watchpoints = 0;
+
+    ram_search_free(&dbg->ram);
+}
+
+void debug_set_breakpoint(Debugger* dbg, uint16_t addr, bool set) {
+    addr &= MEM_MASK;
+    if (dbg->breakpoints[addr] == set)
+        return;
+
+    dbg->breakpoints[addr] = set;
+    dbg->num_breakpoints += set ? 1 : -1;
+}
+
+void debug_set_watchpoint(Debugger* dbg, uint16_t addr, size_t len, int flags,
+                          bool set) {
+    const bool had_watchpoints = dbg->num_watchpoints > 0;
+
+    for (size_t i = 0; i < len && i < MEM_SZ; i++) {
+        uint8_t* cur   = &dbg->watchpoints[(addr + i) & MEM_MASK];
+        const bool was = *cur != 0;
+
+        *cur = set ? (*cur | flags) : (*cur & ~flags);
+        dbg->num_watchpoints += (*cur != 0) - was;
+    }
+
+    /* Replace the `exec' of the context only while it's needed */
+    if (!had_watchpoints && dbg->num_watchpoints > 0) {
+        dbg->exec      = dbg->ctx->exec;
+        dbg->ctx->exec = watch_exec;
+        watching       = dbg;
+    } else if (had_watchpoints && dbg->num_watchpoints == 0) {
+        dbg->ctx->exec = dbg->exec;
+        watching       = NULL;
+    }
+}
+
+void debug_stop(Debugger* dbg, EDebugStop reason) {
+    dbg->stopped      = true;
+    dbg->stop_pending = true;
+    dbg->stop         = reason;
+    dbg->stop_addr    = dbg->ctx->PC;
+    dbg->step_over    = false;
+    dbg->resume       = false;
+}
+
+void debug_continue(Debugger* dbg) {
+    dbg->stopped = false;
+    dbg->resume  = true;
+}
+
+ECpuTrap debug_step(Debugger* dbg) {
+    dbg->stop           = STOP_NONE;
+    const ECpuTrap trap = run_cycle(dbg);
+
+    /* Unless a trap or a watchpoint already stopped it, with a better
+     * reason */
+    if (dbg->stop == STOP_NONE)
+        debug_stop(dbg, STOP_STEP);
+
+    return trap;
+}
+
+ECpuTrap debug_next(Debugger* dbg) {
+    const CpuCtx* ctx = dbg->ctx;
+    if ((cpu_fetch(ctx) & 0xF000) != 0x2000)
+        return debug_step(dbg);
+
+    /* Continue until the CALL returns to the next instruction */
+    debug_continue(dbg);
+    dbg->step_over      = true;
+    dbg->step_over_addr = (ctx->PC + 2) & MEM_MASK;
+    dbg->step_over_sp   = ctx->SP;
+    return TRAP_NONE;
+}
+
+ECpuTrap debug_frame(Debugger* dbg, int* retired) {
+    const CpuCtx* ctx = dbg->ctx;
+
+    *retired = 0;
+    do {
+        if (dbg->stopped)
+            return TRAP_NONE;
+
+        if (!dbg->resume) {
+            if (dbg->breakpoints[ctx->PC]) {
+                debug_stop(dbg, STOP_BREAKPOINT);
+                return TRAP_NONE;
+            }
+
+            if (dbg->step_over && ctx->PC == dbg->step_over_addr &&
+                ctx->SP == dbg->step_over_sp) {
+                debug_stop(dbg, STOP_STEP);
+                return TRAP_NONE;
+            }
+        }
+        dbg->resume = false;
+
+        const ECpuTrap trap = run_cycle(dbg);
+        if (trap != TRAP_NONE)
+            return trap;
+        (*retired)++;
+    } while (dbg->cycle != 0);
+
+    return TRAP_NONE;
+}
+
+const char* debug_stop_str(const Debugger* dbg) {
+    static char str[64];
+
+    switch (dbg->stop) {
+        case STOP_REQUEST:
+            return "Stopped";
+        case STOP_STEP:
+            return "Step";
+        case STOP_BREAKPOINT:
+            snprintf(str, sizeof(str), "Breakpoint at %03X", dbg->stop_addr);
+            return str;
+        case STOP_WATCH_READ:
+            snprintf(str, sizeof(str), "Read of %03X", dbg->stop_addr);
+            return str;
+        case STOP_WATCH_WRITE:
+            snprintf(str, sizeof(str), "Write to %03X", dbg->stop_addr);
+            return str;
+        case STOP_TRAP:
+            return cpu_trap_str(dbg->trap);
+        default:
+            return "Running";
+    }
+}
+
+bool debug_command(Debugger* dbg, const char* line, FILE* fp) {
+    char cmd[16];
+    unsigned arg1, arg2;
+    const int num = sscanf(line, "%15s %x %x", cmd, &arg1, &arg2);
+    if (num < 1)
+        return true;
+
+    if (!strcmp(cmd, "break") || !strcmp(cmd, "b") || !strcmp(cmd, "delete") ||
+        !strcmp(cmd, "d")) {
+        if (num < 2) {
+            fprintf(fp, "Missing address.\n");
+            return true;
+        }
+
+        debug_set_breakpoint(dbg, arg1, cmd[0] == 'b');
+    } else if (!strcmp(cmd, "watch") || !strcmp(cmd, "w") ||
+               !strcmp(cmd, "rwatch") || !strcmp(cmd, "awatch") ||
+               !strcmp(cmd, "unwatch")) {
+        if (num < 2) {
+            fprintf(fp, "Missing address.\n");
+            return true;
+        }
+
+        const int flags = (cmd[0] == 'r')   ? WATCH_READ
+                          : (cmd[0] == 'w') ? WATCH_WRITE
+                                            : WATCH_READ | WATCH_WRITE;
+        debug_set_watchpoint(dbg, arg1, (num > 2) ? arg2 : 1, flags,
+                             cmd[0] != 'u');
+    } else if (!strcmp(cmd, "info") || !strcmp(cmd, "i")) {
+        print_points(dbg, fp);
+    } else if (!strcmp(cmd, "continue") || !strcmp(cmd, "c")) {
+        debug_continue(dbg);
+    } else if (!strcmp(cmd, "stop")) {
+        debug_stop(dbg, STOP_REQUEST);
+    } else if (!strcmp(cmd, "step") || !strcmp(cmd, "s")) {
+        const unsigned steps = (num > 1) ? arg1 : 1;
+        dbg->stop_pending    = false;
+        for (unsigned i = 0; i < steps; i++)
+            if (debug_step(dbg) != TRAP_NONE || dbg->stop != STOP_STEP)
+                break;
+    } else if (!strcmp(cmd, "next") || !strcmp(cmd, "n")) {
+        dbg->stop_pending = false;
+        debug_next(dbg);
+    } else if (!strcmp(cmd, "regs") || !strcmp(cmd, "r")) {
+        print_regs(dbg->ctx, fp);
+    } else if (!strcmp(cmd, "mem") || !strcmp(cmd, "m")) {
+        if (num < 2) {
+            fprintf(fp, "Missing address.\n");
+            return true;
+        }
+
+        print_mem(dbg->ctx, arg1, (num > 2) ? arg2 : 0x10, fp);
+    } else if (!strcmp(cmd, "list") || !strcmp(cmd, "l")) {
+        print_list(dbg->ctx, (num > 1) ? arg1 : dbg->ctx->PC,
+                   (num > 2) ? arg2 : 8, fp);
+    } else if (!strcmp(cmd, "ram")) {
+        ram_command(dbg, line, fp);
+    } else if (!strcmp(cmd, "help") || !strcmp(cmd, "h")) {
+        print_help(fp);
+    } else if (!strcmp(cmd, "quit") || !strcmp(cmd, "q")) {
+        return false;
+    } else {
+        fprintf(fp, "Unknown command: '%s'. Try \"help\".\n", cmd);
+    }
+
+    return true;
+}
+
+bool debug_console_poll(Debugger* dbg) {
+    bool keep_running = true;
+
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    while (keep_running && poll(&pfd, 1, 0) > 0) {
+        char c;
+        if (read(STDIN_FILENO, &c, 1) != 1)
+            return false;
+
+        if (c != '\n') {
+            if (dbg->line_len < sizeof(dbg->line) - 1)
+                dbg->line[dbg->line_len++] = c;
+            continue;
+        }
+
+        dbg->line[dbg->line_len] = '\0';
+        dbg->line_len            = 0;
+
+        /* While running, the prompt is shown again on the next stop */
+        keep_running = debug_command(dbg, dbg->line, stdout);
+        if (keep_running && dbg->stopped && !dbg->stop_pending)
+            printf("(chip8) ");
+    }
+
+    /* Report where the machine stopped */
+    if (dbg->stop_pending) {
+        dbg->stop_pending = false;
+        printf("%s\n", debug_stop_str(dbg));
+        print_location(dbg->ctx, stdout);
+        printf("(chip8) ");
+    }
+
+    fflush(stdout);
+    return keep_running;
+}
@@ -2,71 +2,118 @@
 #include <stdbool.h>
 #include "include/display.h"
 #include "include/main.h"
+#include "include/term.h"
+#include "include/phosphor.h"
+#include "include/scale.h"
 
-#define COLOR_SET   0xFFFFFF
-#define COLOR_UNSET 0x000000
+/* Colors of the texture, in ARGB8888 */
+#define COLOR_SET   0xFFFFFFFF
+#define COLOR_UNSET 0xFF000000
 
-static bool display[DISP_H * DISP_W];
+static EDisplayBackend display_backend = DISPLAY_SDL;
+static Phosphor* display_phosphor       = NULL;
+
+/* Streaming texture with the scaled display, and where it's drawn in the
+ * window */
+static bool display_fill             = false;
+static SDL_Texture* display_texture  = NULL;
+static Scaler display_scaler         = { 0, 0, NULL, NULL };
+static SDL_Rect display_rect         = { 0, 0, 0, 0 };
 
 /*----------------------------------------------------------------------------*/
 
-void display_clear(void) {
-    for (int y = 0; y < DISP_H; y++)
-        for (int x = 0; x < DISP_W; x++)
-            display[DISP_W * y + x] = false;
+void display_set_backend(EDisplayBackend backend) {
+    display_backend = backend;
 }
 
-void display_render(void) {
-    for (int y = 0; y < DISP_H; y++) {
-        for (int x = 0; x < DISP_W; x++) {
-            const uint32_t color =
-              display[DISP_W * y + x] ? COLOR_SET : COLOR_UNSET;
-            set_render_color(g_renderer, color);
-
-            SDL_Rect rect;
-            rect.x = x * DISP_SCALE;
-            rect.y = y * DISP_SCALE;
-            rect.w = DISP_SCALE;
-            rect.h = DISP_SCALE;
-            SDL_RenderFillRect(g_renderer, &rect);
-        }
+void display_set_phosphor(Phosphor* ph) {
+    display_phosphor = ph;
+}
+
+void display_set_fill(bool fill) {
+    display_fill = fill;
+}
+
+bool display_resize(int w, int h) {
+    display_free();
+
+    /* Largest integer scale, or the largest size with the same aspect ratio
+     * if it doesn't fit or filling was requested */
+    int scale_w, scale_h;
+    const int scale = (w / DISP_W < h / DISP_H) ? w / DISP_W : h / DISP_H;
+    if (!display_fill && scale >= 1) {
+        scale_w = DISP_W * scale;
+        scale_h = DISP_H * scale;
+    } else if (w * DISP_H > h * DISP_W) {
+        scale_w = h * DISP_W / DISP_H;
+        scale_h = h;
+    } else {
+        scale_w = w;
+        scale_h = w * DISP_H / DISP_W;
+    }
+
+    /* Minimized windows might have no size at all */
+    if (scale_w < 1 || scale_h < 1)
+        return true;
+
+    display_rect.x = (w - scale_w) / 2;
+    display_rect.y = (h - scale_h) / 2;
+    display_rect.w = scale_w;
+    display_rect.h = scale_h;
+
+    display_texture =
+      SDL_CreateTexture(g_renderer, SDL_PIXELFORMAT_ARGB8888,
+                        SDL_TEXTUREACCESS_STREAMING, scale_w, scale_h);
+    if (display_texture == NULL)
+        return false;
+
+    if (!scale_init(&display_scaler, scale_w, scale_h)) {
+        display_free();
+        return false;
     }
+
+    return true;
 }
 
-/*----------------------------------------------------------------------------*/
+void display_free(void) {
+    if (display_texture != NULL)
+        SDL_DestroyTexture(display_texture);
+    display_texture = NULL;
+
+    scale_free(&display_scaler);
+}
+
+void display_render(const uint64_t* fb) {
+    Phosphor* ph = display_phosphor;
+    if (ph != NULL)
+        phosphor_update(ph, fb);
 
-bool display_draw_sprite(int x, int y, const uint8_t* bytes, int sz) {
-    bool result = false;
-
-    /* Make sure the coordinates don't exceed the screen size */
-    x %= DISP_W;
-    y %= DISP_H;
-
-    /*
-     * Each bit of each byte of the sprite represents a pixel on the
-     * screen. For example, this is a 3 byte sprite:
-     *
-     *     Hex     Binary      Pixels
-     *     --------------------------
-     *     0xF0    11110000    ****
-     *     0x80    10000000    *
-     *     0xF0    11110000    ****
-     */
-    for (int cur_y = 0; cur_y < sz && y + cur_y < DISP_H; cur_y++) {
-        const uint8_t byte = bytes[cur_y];
-
-        for (int cur_x = 0, i = 7; i >= 0 && x + cur_x < DISP_W; cur_x++, i--) {
-            const bool bit_set = (byte >> i) & 1;
-
-            /* This function returns true if a pixel on the screen is changed
-             * from set (true) to unset (false). Since we are XOR'ing, this
-             * means that both were true before the change. */
-            if (display[DISP_W * (y + cur_y) + (x + cur_x)] && bit_set)
-                result = true;
-
-            display[DISP_W * (y + cur_y) + (x + cur_x)] ^= bit_set;
+    if (display_backend == DISPLAY_TERM) {
+        /* The terminal only has two colors */
+        if (ph != NULL) {
+            uint64_t faded[DISP_H];
+            phosphor_threshold(ph, faded);
+            term_render(faded);
+        } else {
+            term_render(fb);
         }
+        return;
     }
 
-    return result;
+    if (display_texture == NULL)
+        return;
+
+    /* Scale the display into the texture, and draw it in a single copy. With
+     * the filter, the intensities are drawn as gray levels. */
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(display_texture, NULL, &pixels, &pitch) != 0)
+        return;
+
+    scale_frame(&display_scaler, fb,
+                (ph != NULL) ? (const uint8_t(*)[DISP_W])ph->intensity : NULL,
+                COLOR_SET, COLOR_UNSET, pixels, pitch);
+
+    SDL_UnlockTexture(display_texture);
+    SDL_RenderCopy(g_renderer, display_texture, NULL, &display_rect);
 }
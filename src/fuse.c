@@ -0,0 +1,192 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "include/cpu.h"
+#include "include/analysis.h"
+#include "include/fuse.h"
+
+/* Bytes read by the longest sequence, which are the ones that make the kind
+ * of an address stale when they are written */
+#define MAX_SEQ_SZ 6
+
+/* Read the opcode at any address, wrapping around the memory */
+static inline uint16_t read_opcode(const CpuCtx* ctx, uint16_t addr) {
+    return (ctx->mem[addr & MEM_MASK] << 8) | ctx->mem[(addr + 1) & MEM_MASK];
+}
+
+/* Find the kind of the sequence starting at an address */
+static EFuseKind decode(const CpuCtx* ctx, uint16_t addr) {
+    const uint16_t op1 = read_opcode(ctx, addr);
+    const uint16_t op2 = read_opcode(ctx, addr + 2);
+
+    switch (op1 & 0xF000) {
+        case 0xA000:
+            if ((op2 & 0xF000) == 0xD000)
+                return FUSE_LD_I_DRW;
+            break;
+
+        case 0x7000:
+            if ((op2 & 0xF000) == 0x3000 || (op2 & 0xF000) == 0x4000)
+                return FUSE_ADD_SKIP;
+            break;
+
+        case 0xF000:
+            if ((op1 & 0xFF) == 0x29 && (op2 & 0xF000) == 0xD000)
+                return FUSE_LD_F_DRW;
+
+            /* The JP doesn't have to go back to the loop, since it's only
+             * run when DT is not zero */
+            if ((op1 & 0xFF) == 0x07 && op2 == (0x3000 | (op1 & 0x0F00)) &&
+                (read_opcode(ctx, addr + 4) & 0xF000) == 0x1000)
+                return FUSE_DT_LOOP;
+            break;
+    }
+
+    return FUSE_SINGLE;
+}
+
+/* Forget the kinds that depend on the `sz' bytes written at `addr' */
+static void invalidate(FuseCache* cache, uint16_t addr, int sz) {
+    for (int i = -(MAX_SEQ_SZ - 1); i < sz; i++)
+        cache->kind[(addr + i) & MEM_MASK] = FUSE_UNKNOWN;
+}
+
+/* Run a single instruction with the interpreter, updating the cache if it
+ * writes to memory */
+static ECpuTrap run_single(CpuCtx* ctx, FuseCache* cache) {
+    const uint16_t opcode = cpu_fetch(ctx);
+    const uint16_t i      = ctx->I;
+
+    const ECpuTrap trap = cpu_cycle(ctx);
+    if (trap != TRAP_NONE)
+        return trap;
+
+    if ((opcode & 0xF0FF) == 0xF033)
+        invalidate(cache, i, 3);
+    else if ((opcode & 0xF0FF) == 0xF055)
+        invalidate(cache, i, ((opcode >> 8) & 0xF) + 1);
+
+    return TRAP_NONE;
+}
+
+/* Run the DRW at `addr', after the instruction that set I. Returns its
+ * trap, and leaves the PC at the DRW if it trapped. */
+static inline ECpuTrap run_drw(CpuCtx* ctx, uint16_t addr) {
+    ctx->PC = (addr + 2) & MEM_MASK;
+
+    const ECpuTrap trap = ctx->exec(ctx, read_opcode(ctx, addr));
+    if (trap != TRAP_NONE)
+        ctx->PC = addr;
+
+    return trap;
+}
+
+/*----------------------------------------------------------------------------*/
+
+FuseCache* fuse_create(void) {
+    return calloc(1, sizeof(FuseCache));
+}
+
+void fuse_destroy(FuseCache* cache) {
+    free(cache);
+}
+
+void fuse_predecode(FuseCache* cache, const CpuCtx* ctx,
+                    const RomAnalysis* an) {
+    for (int addr = 0; addr < MEM_SZ; addr++)
+        if (an->flags[addr] & ANALYSIS_CODE)
+            cache->kind[addr] = decode(ctx, addr);
+}
+
+ECpuTrap fuse_step(CpuCtx* ctx, FuseCache* cache, int max, int* retired) {
+    for (*retired = 0; *retired < max;) {
+        const uint16_t pc = ctx->PC;
+
+        EFuseKind kind = cache->kind[pc];
+        if (kind == FUSE_UNKNOWN) {
+            kind            = decode(ctx, pc);
+            cache->kind[pc] = kind;
+        }
+
+        /* Only run whole sequences */
+        const int left = max - *retired;
+        if (left < ((kind == FUSE_DT_LOOP) ? 3 : 2))
+            kind = FUSE_SINGLE;
+
+        cache->runs[kind]++;
+
+        switch (kind) {
+            default:
+            case FUSE_SINGLE: {
+                const ECpuTrap trap = run_single(ctx, cache);
+                if (trap != TRAP_NONE)
+                    return trap;
+
+                (*retired)++;
+            } break;
+
+            case FUSE_LD_I_DRW: {
+                ctx->I = read_opcode(ctx, pc) & 0xFFF;
+                (*retired)++;
+
+                const ECpuTrap trap = run_drw(ctx, (pc + 2) & MEM_MASK);
+                if (trap != TRAP_NONE)
+                    return trap;
+
+                (*retired)++;
+            } break;
+
+            case FUSE_LD_F_DRW: {
+                const int x = ctx->mem[pc] & 0xF;
+                ctx->I      = DIGITS_ADDR + ctx->V[x] * CHAR_SPRITE_H;
+                (*retired)++;
+
+                const ECpuTrap trap = run_drw(ctx, (pc + 2) & MEM_MASK);
+                if (trap != TRAP_NONE)
+                    return trap;
+
+                (*retired)++;
+            } break;
+
+            case FUSE_ADD_SKIP: {
+                const uint16_t add  = read_opcode(ctx, pc);
+                const uint16_t skip = read_opcode(ctx, pc + 2);
+
+                ctx->V[(add >> 8) & 0xF] += add & 0xFF;
+
+                /* SE skips if equal, SNE if not equal */
+                const bool equal = ctx->V[(skip >> 8) & 0xF] == (skip & 0xFF);
+                const bool taken = equal == ((skip & 0xF000) == 0x3000);
+
+                ctx->PC = (pc + (taken ? 6 : 4)) & MEM_MASK;
+                *retired += 2;
+            } break;
+
+            case FUSE_DT_LOOP: {
+                const int x = ctx->mem[pc] & 0xF;
+                ctx->V[x]   = ctx->DT;
+
+                /* When DT is zero, the SE skips the JP */
+                if (ctx->V[x] == 0) {
+                    ctx->PC = (pc + 6) & MEM_MASK;
+                    *retired += 2;
+                } else {
+                    ctx->PC = read_opcode(ctx, pc + 4) & 0xFFF;
+                    *retired += 3;
+                }
+            } break;
+        }
+    }
+
+    return TRAP_NONE;
+}
+
+ECpuTrap fuse_frame(CpuCtx* ctx, FuseCache* cache, int* retired) {
+    const ECpuTrap trap = fuse_step(ctx, cache, CYCLES_PER_FRAME, retired);
+    if (trap != TRAP_NONE)
+        return trap;
+
+    cpu_tick_timers(ctx);
+    return TRAP_NONE;
+}
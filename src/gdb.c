@@ -0,0 +1,546 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "include/util.h"
+#include "include/cpu.h"
+#include "include/debug.h"
+#include "include/gdb.h"
+
+/* Registers in the order of the target description */
+#define NUM_REGS 21
+
+/* Signals reported in the stop replies */
+#define SIG_INT  2
+#define SIG_ILL  4
+#define SIG_TRAP 5
+#define SIG_SEGV 11
+
+static const char target_xml[] =
+  "<?xml version=\"1.0\"?>"
+  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+  "<target version=\"1.0\">"
+  "<feature name=\"org.chip8.core\">"
+  "<reg name=\"v0\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"v1\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"v2\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"v3\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"v4\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"v5\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"v6\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"v7\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"v8\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"v9\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"va\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"vb\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"vc\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"vd\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"ve\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"vf\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"i\" bitsize=\"16\" type=\"data_ptr\"/>"
+  "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+  "<reg name=\"sp\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"dt\" bitsize=\"8\" type=\"uint8\"/>"
+  "<reg name=\"st\" bitsize=\"8\" type=\"uint8\"/>"
+  "</feature>"
+  "</target>";
+
+/* Get the value of a hexadecimal digit, or -1 */
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* Read a byte in hexadecimal, or return -1 */
+static int hex_byte(const char* str) {
+    const int hi = hex_value(str[0]);
+    const int lo = (hi < 0) ? -1 : hex_value(str[1]);
+    return (lo < 0) ? -1 : (hi << 4) | lo;
+}
+
+/* Size of each register in bytes */
+static int reg_size(int reg) {
+    return (reg == 16 || reg == 17) ? 2 : 1;
+}
+
+static uint16_t reg_read(const CpuCtx* ctx, int reg) {
+    if (reg < 16)
+        return ctx->V[reg];
+
+    switch (reg) {
+        case 16: return ctx->I;
+        case 17: return ctx->PC;
+        case 18: return ctx->SP;
+        case 19: return ctx->DT;
+        default: return ctx->ST;
+    }
+}
+
+static void reg_write(CpuCtx* ctx, int reg, uint16_t value) {
+    if (reg < 16) {
+        ctx->V[reg] = value;
+        return;
+    }
+
+    switch (reg) {
+        case 16: ctx->I = value; break;
+        case 17: ctx->PC = value & MEM_MASK; break;
+        case 18: ctx->SP = (value <= 16) ? value : 16; break;
+        case 19: ctx->DT = value; break;
+        default: ctx->ST = value; break;
+    }
+}
+
+/* Send a packet with the checksum. The client is disconnected on error. */
+static void send_packet(GdbStub* gdb, const char* data) {
+    const size_t len = strlen(data);
+
+    char* buf = malloc(len + 5);
+    uint8_t checksum = 0;
+    for (size_t i = 0; i < len; i++)
+        checksum += (uint8_t)data[i];
+    snprintf(buf, len + 5, "$%s#%02x", data, checksum);
+
+    /* The socket is non-blocking, but packets are small */
+    size_t sent = 0;
+    while (sent < len + 4) {
+        const ssize_t ret = write(gdb->fd, buf + sent, len + 4 - sent);
+        if (ret < 0 && errno == EAGAIN)
+            continue;
+        if (ret <= 0) {
+            close(gdb->fd);
+            gdb->fd = -1;
+            break;
+        }
+        sent += ret;
+    }
+
+    free(buf);
+}
+
+/* Remove the breakpoints and watchpoints of the client, let the machine run
+ * on its own, and close the connection */
+static void detach(GdbStub* gdb) {
+    debug_free(gdb->dbg);
+    debug_continue(gdb->dbg);
+    gdb->dbg->stop_pending = false;
+
+    close(gdb->fd);
+    gdb->fd = -1;
+}
+
+/* Send the stop reply for the current state of the debugger */
+static void send_stop(GdbStub* gdb) {
+    const Debugger* dbg = gdb->dbg;
+
+    char reply[32];
+    switch (dbg->stop) {
+        case STOP_REQUEST:
+            snprintf(reply, sizeof(reply), "S%02x", SIG_INT);
+            break;
+
+        case STOP_WATCH_READ:
+            snprintf(reply, sizeof(reply), "T%02xrwatch:%x;", SIG_TRAP,
+                     dbg->stop_addr);
+            break;
+
+        case STOP_WATCH_WRITE:
+            snprintf(reply, sizeof(reply), "T%02xwatch:%x;", SIG_TRAP,
+                     dbg->stop_addr);
+            break;
+
+        case STOP_TRAP:
+            snprintf(reply, sizeof(reply), "S%02x",
+                     (dbg->trap == TRAP_INVALID_OPCODE) ? SIG_ILL : SIG_SEGV);
+            break;
+
+        default:
+            snprintf(reply, sizeof(reply), "S%02x", SIG_TRAP);
+            break;
+    }
+
+    send_packet(gdb, reply);
+}
+
+/* Handle "qXfer:features:read:target.xml:OFFSET,LENGTH" */
+static void send_target_xml(GdbStub* gdb, const char* args) {
+    unsigned long offset, length;
+    if (sscanf(args, "%lx,%lx", &offset, &length) != 2) {
+        send_packet(gdb, "E01");
+        return;
+    }
+
+    const size_t total = sizeof(target_xml) - 1;
+    if (offset >= total) {
+        send_packet(gdb, "l");
+        return;
+    }
+
+    if (length > GDB_PACKET_SZ - 8)
+        length = GDB_PACKET_SZ - 8;
+
+    char reply[GDB_PACKET_SZ];
+    const bool last = offset + length >= total;
+    const size_t sz = last ? total - offset : length;
+    reply[0]        = last ? 'l' : 'm';
+    memcpy(&reply[1], &target_xml[offset], sz);
+    reply[sz + 1] = '\0';
+
+    send_packet(gdb, reply);
+}
+
+/* Handle the "Z" and "z" packets */
+static void set_point(GdbStub* gdb, const char* args, bool set) {
+    int type;
+    unsigned long addr, kind;
+    if (sscanf(args, "%d,%lx,%lx", &type, &addr, &kind) != 3) {
+        send_packet(gdb, "E01");
+        return;
+    }
+
+    switch (type) {
+        case 0:
+        case 1:
+            debug_set_breakpoint(gdb->dbg, addr, set);
+            break;
+
+        case 2:
+            debug_set_watchpoint(gdb->dbg, addr, kind, WATCH_WRITE, set);
+            break;
+
+        case 3:
+            debug_set_watchpoint(gdb->dbg, addr, kind, WATCH_READ, set);
+            break;
+
+        case 4:
+            debug_set_watchpoint(gdb->dbg, addr, kind,
+                                 WATCH_READ | WATCH_WRITE, set);
+            break;
+
+        default:
+            send_packet(gdb, "");
+            return;
+    }
+
+    send_packet(gdb, "OK");
+}
+
+/* Handle a packet, without the framing */
+static void handle_packet(GdbStub* gdb, char* packet) {
+    Debugger* dbg = gdb->dbg;
+    CpuCtx* ctx   = dbg->ctx;
+
+    char reply[GDB_PACKET_SZ];
+    unsigned long addr, len;
+
+    switch (packet[0]) {
+        case '?': {
+            send_stop(gdb);
+        } break;
+
+        case 'g': {
+            char* cur = reply;
+            for (int reg = 0; reg < NUM_REGS; reg++) {
+                const uint16_t value = reg_read(ctx, reg);
+                for (int i = 0; i < reg_size(reg); i++)
+                    cur += sprintf(cur, "%02x", (value >> (i * 8)) & 0xFF);
+            }
+            send_packet(gdb, reply);
+        } break;
+
+        case 'G': {
+            const char* cur = &packet[1];
+            for (int reg = 0; reg < NUM_REGS; reg++) {
+                uint16_t value = 0;
+                for (int i = 0; i < reg_size(reg); i++, cur += 2) {
+                    const int byte = hex_byte(cur);
+                    if (byte < 0) {
+                        send_packet(gdb, "E01");
+                        return;
+                    }
+                    value |= byte << (i * 8);
+                }
+                reg_write(ctx, reg, value);
+            }
+            send_packet(gdb, "OK");
+        } break;
+
+        case 'p': {
+            const unsigned long reg = strtoul(&packet[1], NULL, 16);
+            if (reg >= NUM_REGS) {
+                send_packet(gdb, "E01");
+                break;
+            }
+
+            const uint16_t value = reg_read(ctx, reg);
+            if (reg_size(reg) == 2)
+                snprintf(reply, sizeof(reply), "%02x%02x", value & 0xFF,
+                         value >> 8);
+            else
+                snprintf(reply, sizeof(reply), "%02x", value);
+            send_packet(gdb, reply);
+        } break;
+
+        case 'P': {
+            char* value_str;
+            const unsigned long reg = strtoul(&packet[1], &value_str, 16);
+            if (reg >= NUM_REGS || *value_str != '=') {
+                send_packet(gdb, "E01");
+                break;
+            }
+
+            uint16_t value = 0;
+            for (int i = 0; i < reg_size(reg); i++) {
+                const int byte = hex_byte(&value_str[1 + i * 2]);
+                if (byte < 0) {
+                    send_packet(gdb, "E01");
+                    return;
+                }
+                value |= byte << (i * 8);
+            }
+
+            reg_write(ctx, reg, value);
+            send_packet(gdb, "OK");
+        } break;
+
+        case 'm': {
+            if (sscanf(&packet[1], "%lx,%lx", &addr, &len) != 2) {
+                send_packet(gdb, "E01");
+                break;
+            }
+
+            if (len > (GDB_PACKET_SZ - 8) / 2)
+                len = (GDB_PACKET_SZ - 8) / 2;
+
+            for (unsigned long i = 0; i < len; i++)
+                sprintf(&reply[i * 2], "%02x", ctx->mem[(addr + i) & MEM_MASK]);
+            reply[len * 2] = '\0';
+            send_packet(gdb, reply);
+        } break;
+
+        case 'M': {
+            const char* data = strchr(packet, ':');
+            if (data == NULL ||
+                sscanf(&packet[1], "%lx,%lx", &addr, &len) != 2) {
+                send_packet(gdb, "E01");
+                break;
+            }
+
+            for (unsigned long i = 0; i < len; i++) {
+                const int byte = hex_byte(&data[1 + i * 2]);
+                if (byte < 0) {
+                    send_packet(gdb, "E01");
+                    return;
+                }
+                ctx->mem[(addr + i) & MEM_MASK] = byte;
+            }
+            send_packet(gdb, "OK");
+        } break;
+
+        case 'c': {
+            if (packet[1] != '\0')
+                ctx->PC = strtoul(&packet[1], NULL, 16) & MEM_MASK;
+
+            /* The stop reply is sent by `gdb_poll' */
+            dbg->stop_pending = false;
+            debug_continue(dbg);
+        } break;
+
+        case 's': {
+            if (packet[1] != '\0')
+                ctx->PC = strtoul(&packet[1], NULL, 16) & MEM_MASK;
+
+            dbg->stop_pending = false;
+            debug_step(dbg);
+        } break;
+
+        case 'Z':
+        case 'z': {
+            set_point(gdb, &packet[1], packet[0] == 'Z');
+        } break;
+
+        case 'D': {
+            send_packet(gdb, "OK");
+            if (gdb->fd >= 0)
+                detach(gdb);
+        } break;
+
+        case 'k': {
+            gdb->killed = true;
+        } break;
+
+        case 'H': {
+            send_packet(gdb, "OK");
+        } break;
+
+        case 'q': {
+            if (!strncmp(packet, "qSupported", 10)) {
+                snprintf(reply, sizeof(reply),
+                         "PacketSize=%x;qXfer:features:read+", GDB_PACKET_SZ);
+                send_packet(gdb, reply);
+            } else if (!strncmp(packet, "qXfer:features:read:target.xml:",
+                                31)) {
+                send_target_xml(gdb, &packet[31]);
+            } else if (!strcmp(packet, "qAttached")) {
+                send_packet(gdb, "1");
+            } else if (!strcmp(packet, "qfThreadInfo")) {
+                send_packet(gdb, "m1");
+            } else if (!strcmp(packet, "qsThreadInfo")) {
+                send_packet(gdb, "l");
+            } else if (!strcmp(packet, "qC")) {
+                send_packet(gdb, "QC1");
+            } else {
+                send_packet(gdb, "");
+            }
+        } break;
+
+        default: {
+            /* Unsupported packets get an empty reply */
+            send_packet(gdb, "");
+        } break;
+    }
+}
+
+/* Parse the complete packets received from the client */
+static void parse_input(GdbStub* gdb) {
+    size_t pos = 0;
+
+    while (pos < gdb->in_len && gdb->fd >= 0) {
+        const char c = gdb->in[pos];
+
+        /* Interrupt, sent by the client outside of packets */
+        if (c == '\x03') {
+            debug_stop(gdb->dbg, STOP_REQUEST);
+            pos++;
+            continue;
+        }
+
+        /* Skip the acknowledgments, and anything else between packets */
+        if (c != '$') {
+            pos++;
+            continue;
+        }
+
+        /* Wait for the whole packet, with the 2 digits of the checksum */
+        char* end = memchr(&gdb->in[pos], '#', gdb->in_len - pos);
+        if (end == NULL || end + 3 > gdb->in + gdb->in_len)
+            break;
+
+        *end = '\0';
+
+        uint8_t checksum = 0;
+        for (const char* cur = &gdb->in[pos + 1]; cur < end; cur++)
+            checksum += (uint8_t)*cur;
+
+        const bool valid = hex_byte(end + 1) == checksum;
+        if (write(gdb->fd, valid ? "+" : "-", 1) != 1) {
+            close(gdb->fd);
+            gdb->fd = -1;
+            break;
+        }
+
+        if (valid)
+            handle_packet(gdb, &gdb->in[pos + 1]);
+
+        pos = end + 3 - gdb->in;
+    }
+
+    /* Keep the incomplete packet for the next call */
+    memmove(gdb->in, &gdb->in[pos], gdb->in_len - pos);
+    gdb->in_len -= pos;
+
+    /* A packet that doesn't fit is dropped */
+    if (gdb->in_len == sizeof(gdb->in))
+        gdb->in_len = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool gdb_listen(GdbStub* gdb, Debugger* dbg, int port) {
+    memset(gdb, 0, sizeof(GdbStub));
+    gdb->dbg       = dbg;
+    gdb->fd        = -1;
+    gdb->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (gdb->listen_fd < 0)
+        return false;
+
+    const int yes = 1;
+    setsockopt(gdb->listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family         = AF_INET;
+    addr.sin_port           = htons(port);
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+
+    if (bind(gdb->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(gdb->listen_fd, 1) != 0) {
+        ERR("Could not listen on port %d", port);
+        close(gdb->listen_fd);
+        return false;
+    }
+
+    /* The machine stays stopped until a client continues it */
+    dbg->stop_pending = false;
+    return true;
+}
+
+bool gdb_poll(GdbStub* gdb) {
+    if (gdb->fd < 0) {
+        gdb->fd = accept(gdb->listen_fd, NULL, NULL);
+        if (gdb->fd < 0)
+            return true;
+
+        fcntl(gdb->fd, F_SETFL, O_NONBLOCK);
+
+        /* Stop the machine for the new client */
+        if (!gdb->dbg->stopped)
+            debug_stop(gdb->dbg, STOP_REQUEST);
+        gdb->dbg->stop_pending = false;
+    }
+
+    for (;;) {
+        const ssize_t ret = read(gdb->fd, &gdb->in[gdb->in_len],
+                                 sizeof(gdb->in) - gdb->in_len);
+        if (ret == 0 || (ret < 0 && errno != EAGAIN)) {
+            /* The client is gone, so let the machine run */
+            detach(gdb);
+            return !gdb->killed;
+        }
+
+        if (ret < 0)
+            break;
+
+        gdb->in_len += ret;
+        parse_input(gdb);
+        if (gdb->fd < 0 || gdb->killed)
+            return !gdb->killed;
+    }
+
+    /* Report the stops that happened while running */
+    if (gdb->dbg->stop_pending) {
+        gdb->dbg->stop_pending = false;
+        send_stop(gdb);
+    }
+
+    return !gdb->killed;
+}
+
+void gdb_close(GdbStub* gdb) {
+    if (gdb->fd >= 0)
+        close(gdb->fd);
+    if (gdb->listen_fd >= 0)
+        close(gdb->listen_fd);
+}
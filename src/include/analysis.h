@@ -0,0 +1,103 @@
+
+#ifndef ANALYSIS_H_
+#define ANALYSIS_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+/*
+ * Static analysis of a ROM, following the code that is reachable from
+ * ROM_LOAD_ADDR. It's written by chip-8-analyzer.out into a sidecar file (by
+ * default, the ROM name with ANALYSIS_EXT), so the emulator can reject ROMs
+ * with reachable invalid opcodes and decode the code before running it,
+ * without analyzing the ROM again. The file is text, one item per line, with
+ * addresses in hexadecimal:
+ *
+ *     # Version, size of the ROM, and FNV-1a hash of the memory from
+ *     # ROM_LOAD_ADDR to the end, once the ROM is loaded
+ *     chip8-map 2
+ *     rom 0F6 8C3A0D5E41B72F90
+ *
+ *     # Instructions at START, START+2... up to END (not included)
+ *     code 200 232
+ *     # Bytes of the ROM that are not part of any instruction
+ *     data 232 2F6
+ *     # Targets of JP and CALL
+ *     jump 206
+ *     call 220
+ *     # "JP V0, addr" instructions, whose targets are unknown
+ *     indirect 22A
+ *     # Reachable instructions with unknown opcodes
+ *     invalid 2A0 F0FF
+ *     # Reachable instructions that are not (entirely) in the ROM, like the
+ *     # end of a ROM that runs past its last byte
+ *     outside 2F6
+ *     # Bytes of code that Fx33 or Fx55 might overwrite
+ *     written 206 208
+ *
+ * Only the writes with a known I (set by "LD I, addr" earlier in the same
+ * sequence of instructions) are found, so the self-modifying regions are
+ * just suspected. Anything after a '#' is ignored.
+ */
+
+#define ANALYSIS_VERSION 2
+
+/* Extension of the sidecar file */
+#define ANALYSIS_EXT ".map"
+
+/* Flags for each address */
+typedef enum {
+    ANALYSIS_CODE     = 1 << 0, /* First byte of a reachable instruction */
+    ANALYSIS_JUMP     = 1 << 1, /* Target of a JP */
+    ANALYSIS_CALL     = 1 << 2, /* Target of a CALL */
+    ANALYSIS_INDIRECT = 1 << 3, /* "JP V0, addr" */
+    ANALYSIS_INVALID  = 1 << 4, /* Reachable instruction with unknown opcode */
+    ANALYSIS_WRITTEN  = 1 << 5, /* Byte of code that might be overwritten */
+    ANALYSIS_OUTSIDE  = 1 << 6, /* Reachable, but not in the ROM */
+} EAnalysisFlags;
+
+typedef struct RomAnalysis {
+    /* Size of the ROM, and hash of the memory where it's loaded */
+    size_t rom_sz;
+    uint64_t rom_hash;
+
+    /* EAnalysisFlags of each address */
+    uint8_t flags[MEM_SZ];
+
+    /* Opcode of the instructions marked with ANALYSIS_INVALID */
+    uint16_t invalid_opcodes[MEM_SZ];
+
+    /* Number of reachable instructions, how many are invalid, and the number
+     * of reachable addresses outside of the ROM */
+    int num_code;
+    int num_invalid;
+    int num_outside;
+} RomAnalysis;
+
+/*----------------------------------------------------------------------------*/
+
+/* Analyze a ROM of `sz' bytes, which is loaded at ROM_LOAD_ADDR */
+void analysis_run(RomAnalysis* an, const uint8_t* rom, size_t sz);
+
+/* Write the analysis into a sidecar file. Returns false on error. */
+bool analysis_write(const RomAnalysis* an, const char* filename);
+
+/* Load the analysis from a sidecar file. Returns false on error. */
+bool analysis_load(RomAnalysis* an, const char* filename);
+
+/* Check that the analysis belongs to the ROM loaded in `ctx', before it
+ * started running, and that it has no reachable invalid opcodes or addresses
+ * outside of the ROM. Prints the reason and returns false if the ROM should
+ * not be run. */
+bool analysis_check(const RomAnalysis* an, const CpuCtx* ctx);
+
+/* Check if a byte is part of a reachable instruction */
+static inline bool analysis_is_code(const RomAnalysis* an, uint16_t addr) {
+    return (an->flags[addr & MEM_MASK] & ANALYSIS_CODE) ||
+           (an->flags[(addr - 1) & MEM_MASK] & ANALYSIS_CODE);
+}
+
+#endif /* ANALYSIS_H_ */
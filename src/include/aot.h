@@ -0,0 +1,135 @@
+
+#ifndef AOT_H_
+#define AOT_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+/*
+ * Ahead-of-time compiled ROMs. The AOT tool (aot/main.c) finds the code of a
+ * ROM that is reachable from ROM_LOAD_ADDR, translates it into C, and compiles
+ * it into a shared object with an AotModule named "chip8_aot_module". This
+ * file is included by the generated code, so it must not depend on anything
+ * that is not in the headers.
+ *
+ * The code is split in blocks of consecutive instructions, each one compiled
+ * into a function that can start at any of its instructions, and runs until
+ * the end of the block. Blocks end after each jump, skip, call or return, and
+ * after the instructions that write to memory (Fx33, Fx55), so code that is
+ * modified by the ROM is never run from a stale translation. The ALU, loads,
+ * timers and jumps are translated into C; the rest call the `exec' of the
+ * context, so they behave exactly like the interpreter.
+ *
+ * At runtime, the address of each instruction selects its block. Before
+ * running a block, its bytes are compared with the ones that were translated,
+ * but only once after each write to memory. Addresses without a block (e.g.
+ * the targets of "JP V0, addr"), and blocks whose code has changed, run with
+ * `cpu_cycle'.
+ */
+
+/* Changed whenever the generated code is not compatible anymore */
+#define AOT_ABI_VERSION 1
+
+/* Name of the AotModule in the shared objects */
+#define AOT_SYMBOL "chip8_aot_module"
+
+/* Set by the blocks that stop early */
+typedef struct AotResult {
+    /* Trap of the last instruction, which is not counted as executed */
+    ECpuTrap trap;
+
+    /* The last instruction wrote to memory */
+    bool wrote;
+} AotResult;
+
+/* Run the instructions of a block, starting at the PC, until the end of the
+ * block or until `max' instructions have been executed. Returns the number of
+ * executed instructions. */
+typedef int (*AotBlockFunc)(CpuCtx* ctx, int max, AotResult* result);
+
+typedef struct AotBlock {
+    /* Addresses of the first instruction, and after the last one */
+    uint16_t start, end;
+
+    AotBlockFunc run;
+} AotBlock;
+
+/* Contents of a compiled ROM */
+typedef struct AotModule {
+    int abi_version;
+
+    /* EQuirkFlags the code was translated for */
+    int quirks;
+
+    /* ROM that was translated, loaded at ROM_LOAD_ADDR */
+    const uint8_t* rom;
+    uint32_t rom_sz;
+
+    const AotBlock* blocks;
+    uint32_t num_blocks;
+} AotModule;
+
+/* Loaded module, for running a single machine */
+typedef struct Aot {
+    void* handle;
+    const AotModule* module;
+
+    /* The module was compiled for the ROM and profile of the machine.
+     * Otherwise, only the interpreter is used. */
+    bool enabled;
+
+    /* Index of the block of each instruction, or -1 */
+    int32_t block_at[MEM_SZ];
+
+    /* Incremented on each write to memory. The code of block N was the same
+     * as the translated one when the generation was `block_gen[N]'. */
+    uint32_t gen;
+    uint32_t* block_gen;
+
+    /* Number of instructions run by the compiled code and by the
+     * interpreter */
+    uint64_t native_instrs;
+    uint64_t interp_instrs;
+} Aot;
+
+/*----------------------------------------------------------------------------*/
+
+/* Load a compiled ROM for a machine, after its ROM and profile have been
+ * selected. Returns NULL if the module can't be loaded, or if it was compiled
+ * for a different ROM, profile or ABI version. */
+Aot* aot_load(const char* path, const CpuCtx* ctx);
+
+/* Load a compiled ROM without a machine. It's only used once `aot_reset'
+ * finds a machine that it was compiled for. Returns NULL if the module can't
+ * be loaded, or if it was compiled for a different ABI version. */
+Aot* aot_open(const char* path);
+
+/* Use a loaded module for a machine that was reset, maybe with a different
+ * ROM or profile, without loading it again. Returns false, and only
+ * interprets, if the module was not compiled for it. */
+bool aot_reset(Aot* aot, const CpuCtx* ctx);
+
+/* Unload the module */
+void aot_free(Aot* aot);
+
+/* Select the module used by the "aot" backend (see backend.h). If not set,
+ * the CHIP8_AOT environment variable is used. */
+void aot_set_module_path(const char* path);
+const char* aot_get_module_path(void);
+
+/* Execute at least one and at most `max' instructions, like the `step' of a
+ * backend. If `aot' is NULL, only the interpreter is used. */
+ECpuTrap aot_step(CpuCtx* ctx, Aot* aot, int max, int* retired);
+
+/* Run a whole frame, like `cpu_frame_count' */
+ECpuTrap aot_frame(CpuCtx* ctx, Aot* aot, int* retired);
+
+/* Check the code of every block again, after the memory of the machine was
+ * changed by something other than its own instructions */
+static inline void aot_invalidate(Aot* aot) {
+    aot->gen++;
+}
+
+#endif /* AOT_H_ */
@@ -0,0 +1,81 @@
+
+#ifndef AUDIO_H_
+#define AUDIO_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+/*
+ * Sound timer output. After each emulated frame, the emulation thread
+ * generates the samples of that frame (a tone if ST was nonzero during it, see
+ * `CpuCtx.sound', silence otherwise) into a single-producer, single-consumer
+ * lock-free ring, and the SDL audio callback plays them. The emulation thread
+ * never waits: it only tops up the ring to a frame of samples plus one buffer
+ * of the device. Since the device plays a frame of samples between two
+ * emulated frames, a change of ST is heard after about two buffers of the
+ * device, less than a frame.
+ *
+ * The tone is played from a pattern of 128 1-bit samples, like the audio of
+ * XO-CHIP, so the buffer and pitch can be changed with `audio_set_pattern'.
+ */
+
+/* Requested sample rate, and samples of each call of the callback */
+#define AUDIO_RATE    48000
+#define AUDIO_SAMPLES 256
+
+/* Number of samples in the ring. Must be a power of two, bigger than the
+ * samples of a frame plus AUDIO_SAMPLES. */
+#define AUDIO_RING_SZ 4096
+
+/* Size of the pattern, in bytes, and default playback rate in bits per second
+ * (pitch 64 of XO-CHIP) */
+#define AUDIO_PATTERN_SZ   16
+#define AUDIO_PATTERN_RATE 4000.0
+
+/* Amplitude of the tone */
+#define AUDIO_VOLUME 3000
+
+typedef struct Audio {
+    SDL_AudioDeviceID dev;
+
+    /* Sample rate of the device, and number of samples queued after each
+     * frame */
+    int rate;
+    uint32_t target;
+
+    /* Ring of samples. The producer only writes `head', and the consumer only
+     * writes `tail'. */
+    int16_t ring[AUDIO_RING_SZ];
+    uint64_t head;
+    uint64_t tail;
+
+    /* Tone, owned by the producer. `phase' is the position in the pattern, in
+     * bits, and advances by `step' on each sample. */
+    uint8_t pattern[AUDIO_PATTERN_SZ];
+    double phase;
+    double step;
+
+    /* Number of samples that the callback had to fill with silence, written
+     * by the consumer */
+    uint64_t underruns;
+} Audio;
+
+/*----------------------------------------------------------------------------*/
+
+/* Open the default audio device and start playing silence. Returns NULL on
+ * error. */
+Audio* audio_open(void);
+
+/* Stop the audio device and free the ring */
+void audio_close(Audio* audio);
+
+/* Change the pattern of the tone, and its playback rate in bits per second.
+ * Only called from the emulation thread. */
+void audio_set_pattern(Audio* audio, const uint8_t* pattern, double rate);
+
+/* Queue the samples of the last emulated frame: the tone if `on' is true, or
+ * silence. Never blocks. */
+void audio_frame(Audio* audio, bool on);
+
+#endif /* AUDIO_H_ */
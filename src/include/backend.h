@@ -0,0 +1,53 @@
+
+#ifndef BACKEND_H_
+#define BACKEND_H_ 1
+
+#include "cpu.h"
+
+/*
+ * Execution backends. A backend is a different way of running the
+ * instructions of a machine (e.g. a decode cache), and it must produce exactly
+ * the same results as the reference interpreter (`cpu_cycle' and
+ * `cpu_exec'). This is verified with the lockstep tool, see lockstep.h.
+ */
+typedef struct CpuBackend {
+    /* Name used for selecting the backend */
+    const char* name;
+
+    /* Allocate the state needed by the backend for the specified machine,
+     * after its ROM has been loaded. Can be NULL if the backend needs no
+     * state. */
+    void* (*create)(CpuCtx* ctx);
+
+    /* Free the state returned by `create'. Can be NULL. */
+    void (*destroy)(void* state);
+
+    /* Prepare the state for the same machine after it was reset, maybe with a
+     * different ROM or profile, without allocating it again. Can be NULL if
+     * the state doesn't depend on the machine. */
+    void (*reset)(CpuCtx* ctx, void* state);
+
+    /* Execute at least one and at most `max' instructions, and store the
+     * number of retired instructions in `retired'. Returns as soon as an
+     * instruction traps; in that case, the trapping instruction is not
+     * counted. */
+    ECpuTrap (*step)(CpuCtx* ctx, void* state, int max, int* retired);
+} CpuBackend;
+
+/*----------------------------------------------------------------------------*/
+
+/* Get the backend with the specified name, or NULL if it doesn't exist */
+const CpuBackend* backend_from_str(const char* name);
+
+/* Get the backend at the specified position of the list, or NULL if `i' is
+ * out of bounds. Useful for iterating all the backends. */
+const CpuBackend* backend_get(size_t i);
+
+/* Print the names of all the backends to stderr, separated by commas */
+void backend_print_names(void);
+
+/* Run a whole frame (CYCLES_PER_FRAME instructions) with the specified backend,
+ * and update the timers. Equivalent to `cpu_frame'. */
+ECpuTrap backend_frame(const CpuBackend* backend, CpuCtx* ctx, void* state);
+
+#endif /* BACKEND_H_ */
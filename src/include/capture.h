@@ -0,0 +1,78 @@
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "display.h"
+
+/* Number of frames in the capture queue. Must be a power of two. */
+#define CAPTURE_QUEUE_SZ 1024
+
+typedef enum {
+    CAPTURE_RAW = 0, /* Packed 1-bit rows, MSB first, no headers */
+    CAPTURE_PGM = 1, /* Stream of binary PGM images, in a single file */
+    CAPTURE_PNG = 2, /* Sequence of 1-bit PNG files */
+    CAPTURE_Y4M = 3, /* YUV4MPEG2 video, 60 FPS */
+} ECaptureFormat;
+
+/*
+ * Frame capture. The emulation thread copies each finished framebuffer into a
+ * single-producer, single-consumer lock-free queue, and a background thread
+ * encodes them. If the queue is full, the frame is dropped instead of waiting,
+ * so the emulation never stalls.
+ */
+typedef struct Capture {
+    ECaptureFormat format;
+    int scale;
+
+    /* Output file, or NULL for PNG sequences */
+    FILE* fp;
+
+    /* Filename pattern of PNG sequences (e.g. "%05d.png"), split around the
+     * frame number, with "%%" already replaced. The number is printed with
+     * `width' characters, padded with zeros if `zero_pad' is set, and aligned
+     * to the left if `width' is negative. */
+    char prefix[512];
+    char suffix[512];
+    int width;
+    bool zero_pad;
+
+    /* Queue of framebuffers. The producer only writes `head', and the
+     * consumer only writes `tail'. */
+    uint64_t queue[CAPTURE_QUEUE_SZ][DISP_H];
+    uint64_t head;
+    uint64_t tail;
+
+    /* Set by `capture_stop', so the writer thread exits once the queue is
+     * empty */
+    bool stopping;
+
+    /* Number of frames written and dropped */
+    uint64_t written;
+    uint64_t dropped;
+
+    pthread_t thread;
+} Capture;
+
+/*----------------------------------------------------------------------------*/
+
+/* Get the capture format from the extension of a filename (".raw", ".pgm",
+ * ".png" or ".y4m"). Returns false if the extension is unknown. */
+bool capture_format_from_path(const char* path, ECaptureFormat* format);
+
+/* Open the output and start the writer thread. Each pixel is written as a
+ * square of `scale' pixels. Returns NULL on error. */
+Capture* capture_start(const char* path, ECaptureFormat format, int scale);
+
+/* Queue a copy of the framebuffer. Never blocks; if the writer thread can't
+ * keep up, the frame is dropped. */
+void capture_frame(Capture* capture, const uint64_t* fb);
+
+/* Wait until all the queued frames are written, and close the output */
+void capture_stop(Capture* capture);
+
+#endif /* CAPTURE_H_ */
@@ -2,11 +2,21 @@
 #ifndef CPU_H_
 #define CPU_H_ 1
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-/* Size of the memory we are emulating */
-#define MEM_SZ 0x1000
+#include "display.h"
+#include "keyboard.h"
+
+/* Size of the memory we are emulating. It must be a power of two, since
+ * addresses are wrapped with MEM_MASK. */
+#define MEM_SZ   0x1000
+#define MEM_MASK (MEM_SZ - 1)
+
+#if (MEM_SZ & MEM_MASK) != 0
+#error "MEM_SZ must be a power of two"
+#endif
 
 /* Address where the ROMs are loaded, and the initial value of PC */
 #define ROM_LOAD_ADDR 0x200
@@ -21,9 +31,55 @@
  * words, each instruction will run at (60*N) Hz. */
 #define CYCLES_PER_FRAME 10
 
-typedef struct CpuCtx {
+/* Behaviors that differ between CHIP-8 variants. Each quirk profile is a
+ * combination of these flags. See `cpu_set_profile'. */
+enum EQuirkFlags {
+    QUIRK_VF_RESET   = (1 << 0), /* OR, AND and XOR reset VF to zero */
+    QUIRK_SHIFT_VX   = (1 << 1), /* SHR and SHL shift Vx, ignoring Vy */
+    QUIRK_MEM_INC_I  = (1 << 2), /* Fx55 and Fx65 leave I at I+x+1 */
+    QUIRK_MEM_INC_IX = (1 << 3), /* Fx55 and Fx65 leave I at I+x */
+    QUIRK_JUMP_VX    = (1 << 5), /* Bxnn jumps to xnn+Vx instead of V0 */
+};
+
+/* Quirk profiles that can be selected for each ROM. */
+typedef enum {
+    PROFILE_DEFAULT = 0, /* Behavior of this emulator before the profiles */
+    PROFILE_VIP     = 1, /* Original COSMAC VIP interpreter */
+    PROFILE_CHIP48  = 2, /* CHIP-48, for the HP-48 calculators */
+    PROFILE_SCHIP   = 3, /* SUPER-CHIP 1.1 */
+
+    PROFILE_COUNT,
+} EQuirkProfile;
+
+/* Reasons why the CPU can stop executing a ROM. When an instruction traps,
+ * the machine state is left as it was before the instruction, so it can be
+ * inspected. */
+typedef enum {
+    TRAP_NONE            = 0, /* The instruction was executed normally */
+    TRAP_INVALID_OPCODE  = 1, /* Unknown instruction */
+    TRAP_STACK_OVERFLOW  = 2, /* CALL with a full stack */
+    TRAP_STACK_UNDERFLOW = 3, /* RET with an empty stack */
+    TRAP_MEM_RANGE       = 4, /* Access outside of the emulated memory */
+} ECpuTrap;
+
+/* What to do when an instruction accesses memory outside of MEM_SZ, usually
+ * because I was incremented past the end with `ADD I, Vx'. In both modes, the
+ * host memory outside of the emulated memory is never accessed. */
+typedef enum {
+    MEM_WRAP = 0, /* Wrap around to the start, without checks (default) */
+    MEM_TRAP = 1, /* Stop with TRAP_MEM_RANGE */
+} EMemMode;
+
+typedef struct CpuCtx CpuCtx;
+
+/* Specialized version of `cpu_exec' for a quirk profile */
+typedef ECpuTrap (*CpuExecFunc)(CpuCtx* ctx, uint16_t opcode);
+
+/* State of a single machine. It doesn't point to any external memory, so an
+ * instance can be copied or reset with a single `memcpy'. */
+struct CpuCtx {
     /* Memory, array of MEM_SZ bytes */
-    uint8_t* mem;
+    uint8_t mem[MEM_SZ];
 
     /* General purpose registers. V[0xF] is used for flags. */
     uint8_t V[16];
@@ -34,7 +90,7 @@ typedef struct CpuCtx {
     /* Delay and sound timers */
     uint8_t DT, ST;
 
-    /* Program counter */
+    /* Program counter, always inside the emulated memory */
     uint16_t PC;
 
     /* Stack pointer */
@@ -42,34 +98,112 @@ typedef struct CpuCtx {
 
     /* Stack */
     uint16_t stack[16];
-} CpuCtx;
+
+    /* Framebuffer, see display.h */
+    uint64_t fb[DISP_H];
+
+    /* Virtual keyboard */
+    Keyboard kb;
+
+    /* State of the random number generator used by RND */
+    uint32_t rng;
+
+    /* Selected quirk profile and memory mode, and their specialized
+     * `cpu_exec' */
+    EQuirkProfile profile;
+    EMemMode mem_mode;
+    CpuExecFunc exec;
+
+    /* Whether ST was nonzero when the timers were last decremented. The tone
+     * of a frame is played even if ST reached zero at its end. */
+    bool sound;
+};
 
 /*----------------------------------------------------------------------------*/
 
 /* Initialize a CPU context structure */
 void cpu_init(CpuCtx* ctx);
 
-/* Free a CPU context structure recursively */
+/* Free a CPU context structure, allocated with `malloc' */
 void cpu_free(CpuCtx* ctx);
 
-/* Load a ROM file into memory, at the current Program Counter (PC) address */
-void cpu_load_rom(CpuCtx* ctx, const char* rom_filename);
+/* Seed the random number generator used by the RND instruction. Machines with
+ * the same seed and inputs produce the same results. */
+void cpu_seed_rng(CpuCtx* ctx, uint32_t seed);
+
+/* Select the quirk profile used by the CPU. Each profile is compiled as its
+ * own specialized interpreter, so this should be called once, before running
+ * the ROM. */
+void cpu_set_profile(CpuCtx* ctx, EQuirkProfile profile);
+
+/* Select what happens on out-of-range memory accesses. Like with the
+ * profiles, each mode is a different specialized interpreter. */
+void cpu_set_mem_mode(CpuCtx* ctx, EMemMode mode);
+
+/* Get the quirk profile with the specified name (e.g. "vip"). Returns
+ * PROFILE_COUNT if the name is not valid. */
+EQuirkProfile cpu_profile_from_str(const char* name);
+
+/* Get the name of the specified quirk profile */
+const char* cpu_profile_str(EQuirkProfile profile);
+
+/* Get the EQuirkFlags of the specified quirk profile */
+int cpu_profile_quirks(EQuirkProfile profile);
+
+/* Load a ROM file into memory, at ROM_LOAD_ADDR. Returns false if the file
+ * could not be opened. */
+bool cpu_load_rom(CpuCtx* ctx, const char* rom_filename);
+
+/* Load a ROM of `sz' bytes from memory, at ROM_LOAD_ADDR */
+void cpu_load_rom_data(CpuCtx* ctx, const uint8_t* data, size_t sz);
 
 /* This function should be called at a rate of 60Hz. It will run
  * CYCLES_PER_FRAME cycles by calling `cpu_cycle', and then decrement the timers
- * if needed. */
-void cpu_frame(CpuCtx* ctx);
+ * if needed. If an instruction traps, the frame stops there, without
+ * decrementing the timers, and the trap is returned. */
+ECpuTrap cpu_frame(CpuCtx* ctx);
+
+/* Like `cpu_frame', and store the number of retired instructions in `retired'.
+ * If an instruction traps, it's not counted. */
+ECpuTrap cpu_frame_count(CpuCtx* ctx, int* retired);
+
+/* Decrement the delay and sound timers, if needed, and update `sound'. Called
+ * by `cpu_frame' once all the instructions of the frame have been executed. */
+void cpu_tick_timers(CpuCtx* ctx);
 
 /* Increment the Program Counter and execute the next instruction by calling
- * `cpu_exec'. */
-void cpu_cycle(CpuCtx* ctx);
+ * `cpu_exec'. If the instruction traps, the Program Counter is left pointing
+ * to it. */
+ECpuTrap cpu_cycle(CpuCtx* ctx);
 
 /* Parse, execute and (optionally) print the instruction with the specified
- * opcode. */
-void cpu_exec(CpuCtx* ctx, uint16_t opcode);
+ * opcode, using the quirks of the current profile. Returns TRAP_NONE on
+ * success. */
+ECpuTrap cpu_exec(CpuCtx* ctx, uint16_t opcode);
+
+/* Check if an opcode is a known instruction, i.e. if `cpu_exec' never traps
+ * with TRAP_INVALID_OPCODE on it. Doesn't depend on the quirk profile. */
+bool cpu_opcode_valid(uint16_t opcode);
+
+/* Read the opcode at the Program Counter, without executing it */
+static inline uint16_t cpu_fetch(const CpuCtx* ctx) {
+    /* CHIP-8 is always big-endian */
+    return (ctx->mem[ctx->PC & MEM_MASK] << 8) |
+           ctx->mem[(ctx->PC + 1) & MEM_MASK];
+}
+
+/* Get a human-readable description of a trap */
+const char* cpu_trap_str(ECpuTrap trap);
 
 /* Dump the specified number of bytes from the emulated memory, starting at
  * ROM_LOAD_ADDR. */
 void cpu_dump_mem(CpuCtx* ctx, size_t sz);
 
+/* Get a 64-bit hash of the emulated memory */
+uint64_t cpu_hash_mem(const CpuCtx* ctx);
+
+/* Get a 64-bit hash of the framebuffer. It doesn't depend on the endianness of
+ * the host. */
+uint64_t cpu_hash_fb(const CpuCtx* ctx);
+
 #endif /* CPU_H_ */
@@ -0,0 +1,141 @@
+
+#ifndef DEBUG_H_
+#define DEBUG_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cpu.h"
+#include "ramsearch.h"
+
+/*
+ * Debugger for a single machine, with breakpoints on the PC, watchpoints on
+ * the memory accessed by DRW, Fx33, Fx55 and Fx65, and single-stepping.
+ *
+ * None of this costs anything while it's not used: the caller keeps using
+ * `cpu_frame' until `debug_is_active' returns true, and only then switches to
+ * `debug_frame', which checks the breakpoints before each instruction. While
+ * there are watchpoints, the `exec' function of the context is replaced by one
+ * that checks the accesses of those 4 instructions before running the
+ * original. Only one debugger can have watchpoints at a time.
+ *
+ * The debugger is controlled with text commands (see `debug_command'), or
+ * with the GDB remote protocol (see gdb.h).
+ */
+
+/* Why the machine stopped */
+typedef enum {
+    STOP_NONE        = 0,
+    STOP_REQUEST     = 1, /* Stopped by the user */
+    STOP_STEP        = 2, /* Finished a step */
+    STOP_BREAKPOINT  = 3, /* Reached a breakpoint, before running it */
+    STOP_WATCH_READ  = 4, /* Read a watched address */
+    STOP_WATCH_WRITE = 5, /* Wrote a watched address */
+    STOP_TRAP        = 6, /* An instruction trapped, see `trap' */
+} EDebugStop;
+
+/* Flags of each watched address */
+enum EDebugWatch {
+    WATCH_READ  = (1 << 0),
+    WATCH_WRITE = (1 << 1),
+};
+
+typedef struct Debugger {
+    CpuCtx* ctx;
+
+    /* Non-zero for the addresses with a breakpoint, and EDebugWatch flags for
+     * the watched ones */
+    uint8_t breakpoints[MEM_SZ];
+    uint8_t watchpoints[MEM_SZ];
+    int num_breakpoints;
+    int num_watchpoints;
+
+    /* Original `exec' of the context, while it's replaced for the
+     * watchpoints */
+    CpuExecFunc exec;
+
+    /* Number of instructions already run in the current frame. The timers
+     * are decremented once it reaches CYCLES_PER_FRAME. */
+    int cycle;
+
+    /* Whether the machine is stopped, and why. `stop_pending' is set on each
+     * stop, and cleared by whoever reports it. */
+    bool stopped;
+    bool stop_pending;
+    EDebugStop stop;
+    uint16_t stop_addr;
+    ECpuTrap trap;
+
+    /* Don't stop on the breakpoint at the PC, when resuming from it */
+    bool resume;
+
+    /* Step over a CALL, stopping when the PC is back at `step_over_addr' with
+     * the same stack pointer */
+    bool step_over;
+    uint16_t step_over_addr;
+    uint8_t step_over_sp;
+
+    /* Watchpoint hit by the last instruction, set by the replaced `exec' */
+    EDebugStop watch_hit;
+    uint16_t watch_addr;
+
+    /* Candidates and snapshots of the "ram" command */
+    RamSearch ram;
+
+    /* Partial command line read by `debug_console_poll' */
+    char line[256];
+    size_t line_len;
+} Debugger;
+
+/*----------------------------------------------------------------------------*/
+
+/* Initialize a debugger for a context. The machine starts stopped. */
+void debug_init(Debugger* dbg, CpuCtx* ctx);
+
+/* Remove all the breakpoints and watchpoints, restoring the `exec' of the
+ * context, and free the snapshots of the RAM search */
+void debug_free(Debugger* dbg);
+
+/* Whether `debug_frame' has to be used instead of `cpu_frame' */
+static inline bool debug_is_active(const Debugger* dbg) {
+    return dbg->stopped || dbg->num_breakpoints > 0 ||
+           dbg->num_watchpoints > 0 || dbg->step_over || dbg->cycle != 0;
+}
+
+/* Add or remove a breakpoint */
+void debug_set_breakpoint(Debugger* dbg, uint16_t addr, bool set);
+
+/* Add or remove the EDebugWatch flags of `len' addresses */
+void debug_set_watchpoint(Debugger* dbg, uint16_t addr, size_t len, int flags,
+                          bool set);
+
+/* Stop the machine, or resume it */
+void debug_stop(Debugger* dbg, EDebugStop reason);
+void debug_continue(Debugger* dbg);
+
+/* Run a single instruction and stop. Returns its trap. */
+ECpuTrap debug_step(Debugger* dbg);
+
+/* Like `debug_step', but a CALL runs until it returns */
+ECpuTrap debug_next(Debugger* dbg);
+
+/* Run the rest of the current frame, like `cpu_frame', stopping on the
+ * breakpoints and watchpoints. Does nothing while stopped. The number of
+ * instructions retired is stored in `retired'. */
+ECpuTrap debug_frame(Debugger* dbg, int* retired);
+
+/* Get a human-readable description of why the machine stopped */
+const char* debug_stop_str(const Debugger* dbg);
+
+/* Run a text command (see "help"), writing the output to `fp'. Returns false
+ * if the command was "quit". */
+bool debug_command(Debugger* dbg, const char* line, FILE* fp);
+
+/* Read the commands available on the standard input without blocking, and
+ * report the stops on the standard output. Returns false on "quit" or at the
+ * end of the input. */
+bool debug_console_poll(Debugger* dbg);
+
+#endif /* DEBUG_H_ */
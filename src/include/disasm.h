@@ -0,0 +1,15 @@
+
+#ifndef DISASM_H_
+#define DISASM_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Size of a buffer that fits any disassembled instruction */
+#define DISASM_SZ 32
+
+/* Write the assembly of an opcode into `buf', e.g. "LD V1, 2A". Unknown
+ * opcodes are written as "???" followed by the opcode. */
+void disasm(uint16_t opcode, char* buf, size_t sz);
+
+#endif /* DISASM_H_ */
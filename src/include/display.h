@@ -10,23 +10,102 @@
 #define DISP_W 64
 #define DISP_H 32
 
-/* Scaling used when rendering each pixel */
+/* Initial scale of the window. The window can be resized, see
+ * `display_resize'. */
 #define DISP_SCALE 10
 
 /* Frames per second when rendering */
 #define FPS 60
 
+/* The framebuffer of each machine is an array of DISP_H rows, each one stored
+ * in a 64-bit integer. The most significant bit is the left-most pixel. */
+#if DISP_W != 64
+#error "The framebuffer rows are stored in 64-bit integers"
+#endif
+
 /*----------------------------------------------------------------------------*/
 
-/* Clear the display to black */
-void display_clear(void);
+/* Clear the framebuffer to black */
+static inline void display_clear(uint64_t* fb) {
+    for (int y = 0; y < DISP_H; y++)
+        fb[y] = 0;
+}
+
+/* Check if the pixel at (x,y) of the framebuffer is set */
+static inline bool display_get_pixel(const uint64_t* fb, int x, int y) {
+    return (fb[y] >> (DISP_W - 1 - x)) & 1;
+}
+
+/* Draw a sprite into the framebuffer, starting at display position (x,y). The
+ * pixels outside of the screen are clipped. Returns true if a pixel was
+ * cleared. */
+static inline bool display_draw_sprite(uint64_t* fb, int x, int y,
+                                       const uint8_t* bytes, int sz) {
+    uint64_t collision = 0;
+
+    /* Make sure the coordinates don't exceed the screen size */
+    x %= DISP_W;
+    y %= DISP_H;
+
+    /*
+     * Each bit of each byte of the sprite represents a pixel on the
+     * screen. For example, this is a 3 byte sprite:
+     *
+     *     Hex     Binary      Pixels
+     *     --------------------------
+     *     0xF0    11110000    ****
+     *     0x80    10000000    *
+     *     0xF0    11110000    ****
+     *
+     * Since each row of the framebuffer is a single integer, each byte is
+     * moved to its position and XOR'd with the whole row at once.
+     */
+    for (int cur_y = 0; cur_y < sz; cur_y++) {
+        const int row = y + cur_y;
+        if (row >= DISP_H)
+            break;
+
+        /* The bits shifted past the right edge are lost */
+        const uint64_t line = (uint64_t)bytes[cur_y] << (DISP_W - 8);
+        const uint64_t mask = line >> x;
+
+        /* A pixel is cleared if it was set in both the row and the sprite */
+        collision |= fb[row] & mask;
+        fb[row] ^= mask;
+    }
+
+    return collision != 0;
+}
+
+typedef enum {
+    DISPLAY_SDL  = 0, /* SDL window, the default */
+    DISPLAY_TERM = 1, /* Terminal characters, see term.h */
+} EDisplayBackend;
+
+/* Select where `display_render' draws the framebuffer */
+void display_set_backend(EDisplayBackend backend);
+
+/* Draw the intensities of a persistence filter (see phosphor.h) updated with
+ * each rendered framebuffer, instead of the framebuffer itself. NULL disables
+ * the filter. */
+struct Phosphor;
+void display_set_phosphor(struct Phosphor* ph);
+
+/* Scale the display to the largest integer scale that fits in the window
+ * (the default), or to fill the window with nearest-neighbor sampling if
+ * `fill' is true. The aspect ratio is kept in both cases. Takes effect on the
+ * next `display_resize'. */
+void display_set_fill(bool fill);
+
+/* Update the scaled display for the new output size of the SDL renderer, in
+ * pixels. Called when the window is created and resized. Returns false on
+ * error. */
+bool display_resize(int w, int h);
 
-/* Render the virtual display into the SDL window */
-void display_render(void);
+/* Free the texture and the scaler of the SDL window */
+void display_free(void);
 
-/* Draw a sprite into the virtual display, starting at display position
- * (x,y). For more information on the sprite format, see the comment inside the
- * function itself. */
-bool display_draw_sprite(int x, int y, const uint8_t* bytes, int sz);
+/* Render the specified framebuffer into the SDL window or the terminal */
+void display_render(const uint64_t* fb);
 
 #endif /* DISPLAY_H_ */
@@ -0,0 +1,71 @@
+
+#ifndef FUSE_H_
+#define FUSE_H_ 1
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "analysis.h"
+
+/*
+ * Interpreter with superinstructions, used by the "fused" backend (see
+ * backend.h). The first time an address is run, the instructions at it are
+ * decoded into one of the kinds below, and common sequences run as a single
+ * handler instead of going through `cpu_cycle' for each instruction:
+ *
+ *   - "LD I, addr" or "LD F, Vx", followed by "DRW"
+ *   - "ADD Vx, byte", followed by "SE" or "SNE" with a byte
+ *   - The delay timer loop: "LD Vx, DT", "SE Vx, 0", "JP addr"
+ *
+ * The kind is stored for the address of the first instruction, so jumping to
+ * the middle of a sequence just runs the instructions from there. A sequence
+ * is only fused if the budget of the step allows running all of it, and the
+ * addresses whose code is overwritten by Fx33 or Fx55 are decoded again.
+ */
+
+typedef enum {
+    FUSE_UNKNOWN   = 0, /* Not decoded yet */
+    FUSE_SINGLE    = 1, /* Not part of a sequence, run with `cpu_cycle' */
+    FUSE_LD_I_DRW  = 2, /* LD I, addr; DRW Vx, Vy, n */
+    FUSE_LD_F_DRW  = 3, /* LD F, Vx; DRW Vx, Vy, n */
+    FUSE_ADD_SKIP  = 4, /* ADD Vx, byte; SE/SNE Vy, byte */
+    FUSE_DT_LOOP   = 5, /* LD Vx, DT; SE Vx, 0; JP addr */
+
+    FUSE_COUNT,
+} EFuseKind;
+
+typedef struct FuseCache {
+    /* EFuseKind of the sequence starting at each address */
+    uint8_t kind[MEM_SZ];
+
+    /* Number of times each kind was run */
+    uint64_t runs[FUSE_COUNT];
+} FuseCache;
+
+/*----------------------------------------------------------------------------*/
+
+/* Allocate an empty cache. Returns NULL if there is not enough memory. */
+FuseCache* fuse_create(void);
+
+/* Free a cache */
+void fuse_destroy(FuseCache* cache);
+
+/* Execute at least one and at most `max' instructions, like the `step' of a
+ * backend */
+ECpuTrap fuse_step(CpuCtx* ctx, FuseCache* cache, int max, int* retired);
+
+/* Decode the code found by a ROM analysis up front, instead of the first time
+ * it's run. The ROM must already be loaded. */
+void fuse_predecode(FuseCache* cache, const CpuCtx* ctx, const RomAnalysis* an);
+
+/* Run a whole frame, like `cpu_frame_count' */
+ECpuTrap fuse_frame(CpuCtx* ctx, FuseCache* cache, int* retired);
+
+/* Decode every address again, after the memory of the machine was changed by
+ * something other than its own instructions */
+static inline void fuse_invalidate(FuseCache* cache) {
+    memset(cache->kind, FUSE_UNKNOWN, sizeof(cache->kind));
+}
+
+#endif /* FUSE_H_ */
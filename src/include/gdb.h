@@ -0,0 +1,53 @@
+
+#ifndef GDB_H_
+#define GDB_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "debug.h"
+
+/*
+ * Stub for the GDB remote serial protocol, listening on a local TCP port, on
+ * top of the debugger in debug.h. The registers are described to the client
+ * with a target description, in this order: V0 to VF (8 bits each), I and PC
+ * (16 bits, little-endian), and SP, DT and ST (8 bits). Memory addresses are
+ * the addresses of the emulated memory.
+ *
+ * Supported packets: ?, g, G, p, P, m, M, c, s, Z0-Z4, z0-z4, D, k, the
+ * interrupt character, and the queries needed to connect.
+ */
+
+/* Size of the packet buffer, also sent to the client as PacketSize */
+#define GDB_PACKET_SZ 4096
+
+typedef struct GdbStub {
+    Debugger* dbg;
+
+    /* Listening socket, and the connected client or -1 */
+    int listen_fd;
+    int fd;
+
+    /* Data received from the client, not yet parsed */
+    char in[GDB_PACKET_SZ];
+    size_t in_len;
+
+    /* Set when the client sends a kill packet */
+    bool killed;
+} GdbStub;
+
+/*----------------------------------------------------------------------------*/
+
+/* Listen on `port' of the loopback interface. Returns false on error. */
+bool gdb_listen(GdbStub* gdb, Debugger* dbg, int port);
+
+/* Accept a client and handle its packets without blocking, and report the
+ * stops of the machine to it. Returns false if the client killed the
+ * machine. */
+bool gdb_poll(GdbStub* gdb);
+
+/* Close the sockets */
+void gdb_close(GdbStub* gdb);
+
+#endif /* GDB_H_ */
@@ -0,0 +1,55 @@
+
+#ifndef INPUT_H_
+#define INPUT_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Input scripts are text files with the keypad state for each frame, used by
+ * the headless tools. Each line has a frame number and a keypad mask in
+ * hexadecimal, where bit N is set if key N is held:
+ *
+ *     # Hold key 5 on frame 60, and release it on frame 65
+ *     60 0020
+ *     65 0000
+ *
+ * The mask is kept until the next line. Lines must be sorted by frame, and
+ * anything after a '#' is ignored.
+ */
+
+typedef struct InputEvent {
+    uint64_t frame;
+    uint16_t mask;
+} InputEvent;
+
+typedef struct InputScript {
+    InputEvent* events;
+    size_t events_num;
+
+    /* Used by `input_mask_at' to avoid searching from the start on each
+     * frame */
+    size_t cursor;
+} InputScript;
+
+/*----------------------------------------------------------------------------*/
+
+/* Load an input script from the specified file. Returns false on error. */
+bool input_load(InputScript* script, const char* filename);
+
+/* Free the events of an input script */
+void input_free(InputScript* script);
+
+/* Get the keypad mask at the specified frame. Fastest when called with
+ * increasing frame numbers. */
+uint16_t input_mask_at(InputScript* script, uint64_t frame);
+
+/* Record the keypad mask of the specified frame at the end of a script, if it
+ * changed. Frames must not decrease between calls. */
+void input_record(InputScript* script, uint64_t frame, uint16_t mask);
+
+/* Drop the events after the specified frame, for recording again from it */
+void input_truncate(InputScript* script, uint64_t frame);
+
+#endif /* INPUT_H_ */
@@ -2,6 +2,7 @@
 #ifndef KEYBOARD_H_
 #define KEYBOARD_H_ 1
 
+#include <stdint.h>
 #include <stdbool.h>
 
 typedef enum {
@@ -10,28 +11,45 @@ typedef enum {
     KB_HAS_KEY = 2, /* Was waiting, but received a key */
 } EKeyboardStatus;
 
+/* Virtual keyboard of a single machine */
+typedef struct Keyboard {
+    /* See EKeyboardStatus */
+    EKeyboardStatus status;
+
+    /* Last key released while waiting */
+    uint8_t last_key;
+
+    /* Bit N is set if key N is being held */
+    uint16_t held;
+} Keyboard;
+
 /*----------------------------------------------------------------------------*/
 
-/* Store status of key in internal keyboard */
-void kb_store(int key, bool held);
+/* Store status of key in the keyboard */
+void kb_store(Keyboard* kb, int key, bool held);
+
+/* Store the status of all the keys at once. Bit N of `mask' is set if key N is
+ * being held. Keys are released with `kb_store', so a key waited by
+ * "LD Vx, K" is still detected. */
+void kb_store_mask(Keyboard* kb, uint16_t mask);
 
 /* Check if a key is being held in the virtual keyboard */
-bool kb_is_held(int key);
+bool kb_is_held(const Keyboard* kb, int key);
 
 /* Print the layout of the keyboard */
-void kb_print(void);
+void kb_print(const Keyboard* kb);
 
 /* Set the keyboard status to KB_WAITING. See EKeyboardStatus enum for more
  * information. */
-void kb_wait_for_key(void);
+void kb_wait_for_key(Keyboard* kb);
 
 /* Get the current keyboard status. See EKeyboardStatus enum for more
  * information. */
-EKeyboardStatus kb_get_status(void);
+EKeyboardStatus kb_get_status(const Keyboard* kb);
 
 /* After waiting, the keyboard detected a key release and stored it. This
  * function returns that key. The caller must make sure that the keyboard status
  * is KB_HAS_KEY by calling `kb_get_status'. */
-int kb_get_last_key(void);
+int kb_get_last_key(Keyboard* kb);
 
 #endif /* KEYBOARD_H_ */
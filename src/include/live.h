@@ -0,0 +1,99 @@
+
+#ifndef LIVE_H_
+#define LIVE_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+/*
+ * Live state export. The contexts of the running machines are placed directly
+ * in a named POSIX shared memory segment (see shm_open(3)), so external
+ * monitors can map it and watch the registers, memory and framebuffer of each
+ * instance without slowing down the emulator.
+ *
+ * Each context is protected by a sequence lock: the emulator makes the
+ * sequence odd before changing the context, and even again after it. Readers
+ * copy the context, and retry if the sequence was odd or changed in the
+ * meantime. Writing never blocks and never makes a system call.
+ *
+ * Layout of the segment:
+ *
+ *   LiveHeader
+ *   LiveSlot[num], each one `slot_sz' bytes
+ */
+
+#define LIVE_MAGIC   0x4D534338 /* "8CSM" */
+#define LIVE_VERSION 1
+
+typedef struct LiveHeader {
+    uint32_t magic;
+    uint32_t version;
+
+    /* Number of slots, and size of each slot and of the context inside it,
+     * for checking that the reader uses the same layout */
+    uint32_t num;
+    uint32_t slot_sz;
+    uint32_t ctx_sz;
+    uint32_t reserved;
+} __attribute__((aligned(64))) LiveHeader;
+
+typedef struct LiveSlot {
+    /* Odd while the context is being written */
+    uint32_t seq;
+    uint32_t reserved;
+
+    /* Number of frames run by this instance when the context was last
+     * written. Instances parked by the scheduler keep the state of the last
+     * frame they ran. */
+    uint64_t frame;
+
+    CpuCtx ctx;
+} __attribute__((aligned(64))) LiveSlot;
+
+/* Mapped segment, in the emulator or in a reader */
+typedef struct LiveState {
+    char name[256];
+    bool owner;
+
+    LiveHeader* header;
+    LiveSlot* slots;
+    size_t size;
+} LiveState;
+
+/*----------------------------------------------------------------------------*/
+
+/* Create the segment `name' with room for `num' contexts, replacing it if it
+ * already exists. The contexts are zeroed, so they still need `cpu_init'. The
+ * segment is removed by `live_close'. Returns NULL on error. */
+LiveState* live_create(const char* name, uint32_t num);
+
+/* Map an existing segment, read-only. Returns NULL on error, or if it was
+ * created with a different layout. */
+LiveState* live_open(const char* name);
+
+/* Unmap the segment, and remove it if it was created by `live_create' */
+void live_close(LiveState* live);
+
+/* Start and finish changing the context of a slot. The writes in between are
+ * seen by readers all at once. Only one thread may write to a slot. */
+static inline void live_write_begin(LiveSlot* slot) {
+    const uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void live_write_end(LiveSlot* slot) {
+    const uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy a consistent snapshot of slot `i' into `ctx', and its frame number into
+ * `frame' if not NULL. Returns false if the emulator kept writing to it for
+ * too long. */
+bool live_read(const LiveState* live, uint32_t i, CpuCtx* ctx,
+               uint64_t* frame);
+
+#endif /* LIVE_H_ */
@@ -0,0 +1,64 @@
+
+#ifndef LOCKSTEP_H_
+#define LOCKSTEP_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "backend.h"
+
+typedef enum {
+    LOCKSTEP_OK       = 0, /* Both machines are still identical */
+    LOCKSTEP_TRAPPED  = 1, /* Both machines trapped identically */
+    LOCKSTEP_DIVERGED = 2, /* The machines are different, see the report */
+} ELockstepStatus;
+
+/* Two machines, running the same ROM and inputs with different backends. The
+ * first backend is used as the reference. */
+typedef struct Lockstep {
+    CpuCtx* ctx[2];
+    const CpuBackend* backend[2];
+    void* state[2];
+
+    /* If true, the machines are compared every time their number of retired
+     * instructions is the same. Otherwise, only at the end of each frame. */
+    bool per_instruction;
+
+    /* Number of completed frames, and retired instructions in those frames */
+    uint64_t frame;
+    uint64_t retired;
+
+    /* Trap that stopped both machines, for LOCKSTEP_TRAPPED */
+    ECpuTrap trap;
+
+    /* Description of the first difference, for LOCKSTEP_DIVERGED */
+    char report[1024];
+} Lockstep;
+
+/*----------------------------------------------------------------------------*/
+
+/* Initialize a lockstep context with two machines, which must be identical and
+ * have the ROM already loaded, and create the state of each backend. The
+ * machines are still owned by the caller. */
+void lockstep_init(Lockstep* ls, CpuCtx* ref_ctx, const CpuBackend* ref,
+                   CpuCtx* other_ctx, const CpuBackend* other);
+
+/* Start again after the caller reset both machines to identical states, maybe
+ * with a different ROM or profile, keeping the state of the backends */
+void lockstep_reset(Lockstep* ls);
+
+/* Free the state of the backends */
+void lockstep_free(Lockstep* ls);
+
+/* Run a frame on both machines with the specified keypad mask, comparing them
+ * as they run. */
+ELockstepStatus lockstep_frame(Lockstep* ls, uint16_t keypad);
+
+/* Compare the guest-visible state of two machines. If they are different,
+ * describe the first difference in `report' and return false. */
+bool lockstep_compare(const CpuCtx* a, const CpuCtx* b, char* report,
+                      size_t report_sz);
+
+#endif /* LOCKSTEP_H_ */
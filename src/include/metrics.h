@@ -0,0 +1,96 @@
+
+#ifndef METRICS_H_
+#define METRICS_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Lightweight timing of each phase of the main loop. The clock is read once at
+ * the start of the frame and once at the end of each phase, and the durations
+ * are added to histograms with fixed buckets.
+ */
+
+/* Bucket N of a histogram counts the durations in [2^N, 2^(N+1))
+ * microseconds. The first one also counts everything below 1us, and the last
+ * one everything above. */
+#define METRICS_BUCKETS 24
+
+/* Phases of a frame, in the order they happen */
+typedef enum {
+    PHASE_EVENTS  = 0, /* Polling the input events */
+    PHASE_CPU     = 1, /* Running the instructions of the frame */
+    PHASE_RENDER  = 2, /* Drawing the framebuffer, `display_render' */
+    PHASE_PRESENT = 3, /* Showing the frame, `SDL_RenderPresent' */
+    PHASE_DELAY   = 4, /* Waiting for the next frame, `SDL_Delay' */
+
+    PHASE_COUNT,
+} EMetricsPhase;
+
+typedef struct MetricsHistogram {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns, max_ns;
+    uint64_t buckets[METRICS_BUCKETS];
+} MetricsHistogram;
+
+typedef struct Metrics {
+    MetricsHistogram phases[PHASE_COUNT];
+
+    /* Duration of the whole frame, from start to start */
+    MetricsHistogram frame;
+
+    /* Frames whose work (everything but the delay) took longer than the
+     * deadline */
+    uint64_t missed;
+    uint64_t deadline_ns;
+
+    uint64_t frames;
+    uint64_t instructions;
+
+    /* Clock when the metrics started, when the frame started, and at the end
+     * of the last phase */
+    uint64_t start_ns, frame_ns, last_ns;
+
+    /* Duration of each phase in the current frame, for the CSV file */
+    uint64_t current_ns[PHASE_COUNT];
+
+    /* Optional CSV output, with a line for each frame */
+    FILE* csv;
+} Metrics;
+
+/*----------------------------------------------------------------------------*/
+
+/* Read the monotonic clock, in nanoseconds */
+static inline uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Initialize the metrics. A frame misses its deadline if its work takes more
+ * than `deadline_ns'. */
+void metrics_init(Metrics* metrics, uint64_t deadline_ns);
+
+/* Write the duration of the phases of each frame into a CSV file. Returns false
+ * if the file could not be opened. */
+bool metrics_open_csv(Metrics* metrics, const char* path);
+
+/* Close the CSV file, if any */
+void metrics_close(Metrics* metrics);
+
+/* Mark the start of a frame. The first phase starts here. */
+void metrics_frame_start(Metrics* metrics);
+
+/* Mark the end of a phase. The next phase starts here. */
+void metrics_phase_end(Metrics* metrics, EMetricsPhase phase);
+
+/* Mark the end of a frame, where `instructions' were executed */
+void metrics_frame_end(Metrics* metrics, uint64_t instructions);
+
+/* Print a summary of the metrics */
+void metrics_print(const Metrics* metrics, FILE* fp);
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,44 @@
+
+#ifndef PHOSPHOR_H_
+#define PHOSPHOR_H_ 1
+
+#include <stdint.h>
+
+#include "display.h"
+
+/*
+ * Persistence filter, like the phosphor of a CRT, for hiding the flicker of
+ * sprites that are erased and drawn again with XOR. Each pixel has an
+ * intensity, which is set to the maximum while the pixel is lit, and fades out
+ * by a fixed step on each frame after it's cleared. The intensities are
+ * updated PHOSPHOR_VEC pixels at a time with vectors, when rendering, so the
+ * framebuffer of the machine is not changed.
+ */
+
+/* Pixels updated at once, half a row */
+#define PHOSPHOR_VEC 32
+
+typedef uint8_t PhosphorVec __attribute__((vector_size(PHOSPHOR_VEC)));
+
+typedef struct Phosphor {
+    /* Intensity of each pixel, from 0 (off) to 255 (lit) */
+    uint8_t intensity[DISP_H][DISP_W];
+
+    /* Intensity lost on each frame */
+    uint8_t step;
+} Phosphor;
+
+/*----------------------------------------------------------------------------*/
+
+/* Initialize the filter, with every pixel off. Cleared pixels fade out in
+ * about `frames' frames. */
+void phosphor_init(Phosphor* ph, int frames);
+
+/* Fade out the pixels, and light the ones that are set in the framebuffer */
+void phosphor_update(Phosphor* ph, const uint64_t* fb);
+
+/* Get a framebuffer with the pixels that are at least half lit, for the
+ * displays that can only show two colors */
+void phosphor_threshold(const Phosphor* ph, uint64_t* fb);
+
+#endif /* PHOSPHOR_H_ */
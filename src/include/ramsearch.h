@@ -0,0 +1,80 @@
+
+#ifndef RAMSEARCH_H_
+#define RAMSEARCH_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cpu.h"
+
+/*
+ * Search for the addresses that hold some variable of a ROM, like the score or
+ * the position of the player. The memory is saved in snapshots at the
+ * interesting moments, and the candidate addresses are filtered by comparing
+ * the last two snapshots ("the score increased") or the last one with a value
+ * ("there are 3 lives left"). Each filter runs over the whole memory with
+ * vectors of RAM_SEARCH_VEC bytes, keeping a byte mask of candidates.
+ *
+ * Used by the "ram" command of the debugger, and by chip-8-ramsearch.out.
+ */
+
+/* Bytes compared at once */
+#define RAM_SEARCH_VEC 32
+
+typedef uint8_t RamVec __attribute__((vector_size(RAM_SEARCH_VEC)));
+
+typedef enum {
+    RAM_CHANGED   = 0, /* Different in both snapshots */
+    RAM_UNCHANGED = 1, /* Same in both snapshots */
+    RAM_INCREASED = 2, /* Greater in the new snapshot */
+    RAM_DECREASED = 3, /* Smaller in the new snapshot */
+    RAM_EQUAL     = 4, /* Equal to a value in the new snapshot */
+    RAM_NOT_EQUAL = 5, /* Not equal to a value in the new snapshot */
+
+    RAM_PREDICATE_COUNT,
+} ERamPredicate;
+
+typedef struct RamSearch {
+    /* 0xFF for the addresses that are still candidates, 0 for the rest */
+    uint8_t candidates[MEM_SZ];
+    uint32_t num_candidates;
+
+    /* Copies of the memory, MEM_SZ bytes each */
+    uint8_t (*snapshots)[MEM_SZ];
+    uint32_t num_snapshots, snapshots_cap;
+} RamSearch;
+
+/*----------------------------------------------------------------------------*/
+
+/* Initialize a search where every address is a candidate */
+void ram_search_init(RamSearch* rs);
+
+/* Free the snapshots of a search */
+void ram_search_free(RamSearch* rs);
+
+/* Make every address a candidate again, and remove the snapshots */
+void ram_search_reset(RamSearch* rs);
+
+/* Save the memory of a machine, and return the index of the snapshot */
+uint32_t ram_search_snapshot(RamSearch* rs, const CpuCtx* ctx);
+
+/* Keep the candidates where the predicate is true between snapshots `old' and
+ * `new' (or for `new' and `value'). Returns the number of candidates left. */
+uint32_t ram_search_filter(RamSearch* rs, ERamPredicate pred, uint32_t old,
+                           uint32_t new, uint8_t value);
+
+/* Check if the predicate compares with a value, instead of two snapshots */
+static inline bool ram_predicate_has_value(ERamPredicate pred) {
+    return pred == RAM_EQUAL || pred == RAM_NOT_EQUAL;
+}
+
+/* Get the predicate with the specified name (e.g. "increased" or "eq"), or
+ * RAM_PREDICATE_COUNT if it doesn't exist */
+ERamPredicate ram_predicate_from_str(const char* name);
+
+/* Print up to `max' candidates, with their value in the last snapshots */
+void ram_search_print(const RamSearch* rs, size_t max, FILE* fp);
+
+#endif /* RAMSEARCH_H_ */
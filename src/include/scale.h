@@ -0,0 +1,48 @@
+
+#ifndef SCALE_H_
+#define SCALE_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "display.h"
+
+/*
+ * Software scaler, for drawing the framebuffer into a streaming texture of any
+ * size with nearest-neighbor sampling. Each output row is expanded from the
+ * packed 1-bit row of the framebuffer SCALE_VEC pixels at a time with vectors,
+ * and output rows that sample the same framebuffer row are copied. The cost
+ * only depends on the size of the output.
+ */
+
+/* Output pixels computed at once */
+#define SCALE_VEC 8
+
+typedef uint32_t ScaleVec __attribute__((vector_size(SCALE_VEC * 4)));
+
+typedef struct Scaler {
+    /* Size of the output, in pixels */
+    int w, h;
+
+    /* Framebuffer column and row sampled by each output column and row */
+    uint32_t* src_x;
+    uint8_t* src_y;
+} Scaler;
+
+/*----------------------------------------------------------------------------*/
+
+/* Initialize a scaler for an output of w*h pixels. Returns false if there is
+ * not enough memory. */
+bool scale_init(Scaler* sc, int w, int h);
+
+/* Free the tables of a scaler, but not the scaler itself */
+void scale_free(Scaler* sc);
+
+/* Draw a framebuffer into `pixels', with `pitch' bytes per row, using the
+ * `set' and `unset' colors (ARGB8888). If `intensity' is not NULL, it's drawn
+ * instead of the framebuffer, as gray levels (see phosphor.h). */
+void scale_frame(const Scaler* sc, const uint64_t* fb,
+                 const uint8_t (*intensity)[DISP_W], uint32_t set,
+                 uint32_t unset, void* pixels, int pitch);
+
+#endif /* SCALE_H_ */
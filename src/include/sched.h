@@ -0,0 +1,131 @@
+
+#ifndef SCHED_H_
+#define SCHED_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "cpu.h"
+#include "live.h"
+
+/*
+ * Scheduler for hosting many machines at once. On each frame, only the
+ * runnable instances call `cpu_frame', split between the worker threads, and
+ * the rest stay parked:
+ *
+ *   - Instances waiting for a key with "LD Vx, K" are parked until a key event
+ *     wakes them up (see `sched_key').
+ *   - Instances spinning on the delay timer, with the usual loop below, are
+ *     put on a timer wheel until DT is about to expire:
+ *
+ *         loop:  LD Vx, DT
+ *                SE Vx, 0
+ *                JP loop
+ *
+ * In both cases, the state that the instance would have reached after the
+ * skipped frames is computed when it's woken up, so the results are the same
+ * as calling `cpu_frame' on every instance.
+ */
+
+/* Number of slots of the timer wheel. Since DT is 8 bits, an instance never
+ * waits for more than 255 frames, so one turn of the wheel is enough. */
+#define SCHED_WHEEL_SZ 256
+
+/* Number of instances taken from a queue at once */
+#define SCHED_CHUNK 16
+
+typedef enum {
+    SCHED_RUNNABLE     = 0, /* Runs on the next frame */
+    SCHED_PARKED_KEY   = 1, /* Waiting for a key, see `sched_key' */
+    SCHED_PARKED_TIMER = 2, /* Spinning on DT, on the timer wheel */
+    SCHED_STOPPED      = 3, /* Trapped, see `trap' */
+} ESchedState;
+
+typedef struct SchedInstance {
+    /* Machine, owned by the caller */
+    CpuCtx* ctx;
+
+    ESchedState state;
+    ECpuTrap trap;
+
+    /* First frame that was skipped after parking */
+    uint64_t parked_frame;
+
+    /* Address of the "LD Vx, DT" of the loop, and index of the next instance
+     * in the same slot of the wheel (or -1), when parked on the timer */
+    uint16_t spin_addr;
+    int32_t wheel_next;
+
+    /* Slot of the live state export holding the context, or NULL. See
+     * `sched_set_live'. */
+    LiveSlot* live;
+} SchedInstance;
+
+/* Runnable instances of one worker, as a range of `Sched.runnable'. Other
+ * workers steal from it when they are done with their own. */
+typedef struct SchedQueue {
+    uint32_t start, end;
+    uint32_t next;
+} __attribute__((aligned(64))) SchedQueue;
+
+typedef struct Sched {
+    SchedInstance* instances;
+    uint32_t num, cap;
+
+    /* Number of the next frame */
+    uint64_t frame;
+
+    /* Indexes of the runnable instances, with room for all of them */
+    uint32_t* runnable;
+    uint32_t runnable_num;
+
+    /* First instance of each slot of the timer wheel, or -1 */
+    int32_t wheel[SCHED_WHEEL_SZ];
+
+    /* Worker threads, besides the caller of `sched_frame' */
+    int threads;
+    struct SchedWorker* workers;
+    SchedQueue* queues;
+    pthread_barrier_t start, done;
+    bool quit;
+
+    /* Number of calls to `cpu_frame' */
+    uint64_t frames_run;
+} Sched;
+
+/*----------------------------------------------------------------------------*/
+
+/* Initialize a scheduler that runs the instances with the specified number of
+ * threads, including the caller. Returns false on error. */
+bool sched_init(Sched* sched, int threads);
+
+/* Stop the worker threads and free the scheduler, but not the contexts */
+void sched_free(Sched* sched);
+
+/* Add an instance to the scheduler, and return its index. The context is not
+ * copied, so it must be valid until `sched_free'. */
+uint32_t sched_add(Sched* sched, CpuCtx* ctx);
+
+/* Mark the context of instance `i' as living in a slot of the live state
+ * export (see live.h), so every change the scheduler makes to it is protected
+ * by the sequence lock of the slot. */
+void sched_set_live(Sched* sched, uint32_t i, LiveSlot* slot);
+
+/* Store the keypad mask of an instance for the next frames (see
+ * `kb_store_mask'), waking it up if it was waiting for a key. Only needs to be
+ * called when the mask changes. */
+void sched_key(Sched* sched, uint32_t i, uint16_t mask);
+
+/* Run the next frame on all the instances. Returns the number of instances
+ * that actually called `cpu_frame'. */
+uint32_t sched_frame(Sched* sched);
+
+/* Make a parked instance runnable, updating its context to the current frame,
+ * so it can be inspected. */
+void sched_wake(Sched* sched, uint32_t i);
+
+/* Count the instances in the specified state */
+uint32_t sched_count(const Sched* sched, ESchedState state);
+
+#endif /* SCHED_H_ */
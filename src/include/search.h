@@ -0,0 +1,96 @@
+
+#ifndef SEARCH_H_
+#define SEARCH_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+/*
+ * Search for a sequence of keypad masks that takes a machine to a target
+ * state, e.g. a value in memory or a PC. Starting from the initial machine,
+ * each step holds one of the candidate masks for a number of frames, and the
+ * states are explored in breadth-first order (so the sequence found is the
+ * shortest one) or best-first, by distance to the targets.
+ *
+ * Many sequences lead to the same state, for example while the ROM is not
+ * reading the keypad. Every state is identified by its incremental hash (see
+ * statehash.h), and the ones that were already visited are not explored
+ * again. The hash is trusted: two states with the same 64-bit hash are
+ * considered the same one.
+ *
+ * Each batch of states is expanded by several threads, and the results don't
+ * depend on the number of threads.
+ */
+
+/* Number of states expanded at once, split between the threads */
+#define SEARCH_BATCH 256
+
+/* Distance added by each target that is not met, when it can't be measured */
+#define SEARCH_MISS_DISTANCE 256
+
+typedef enum {
+    TARGET_MEM     = 0, /* mem[addr] == value */
+    TARGET_REG     = 1, /* V[addr] == value */
+    TARGET_PC      = 2, /* PC == value */
+    TARGET_PIXEL   = 3, /* Pixel (addr, y) is set */
+    TARGET_FB_HASH = 4, /* cpu_hash_fb() == value */
+} ESearchTargetKind;
+
+typedef struct SearchTarget {
+    ESearchTargetKind kind;
+    uint16_t addr, y;
+    uint64_t value;
+} SearchTarget;
+
+typedef struct SearchParams {
+    /* All the targets must be met at the end of a frame */
+    const SearchTarget* targets;
+    int num_targets;
+
+    /* Keypad masks tried on each step, and number of frames of a step */
+    const uint16_t* masks;
+    int num_masks;
+    int step_frames;
+
+    /* Maximum number of steps, and of different states visited */
+    int max_depth;
+    uint32_t max_states;
+
+    int threads;
+    bool best_first;
+} SearchParams;
+
+typedef struct SearchResult {
+    bool found;
+
+    /* Keypad mask of each frame until the targets are met, allocated with
+     * malloc */
+    uint16_t* masks;
+    uint64_t frames;
+
+    /* Different states visited, states pruned because they were already
+     * visited, and states expanded */
+    uint64_t states;
+    uint64_t duplicates;
+    uint64_t expanded;
+
+    /* The search stopped because of `max_states' */
+    bool limit_reached;
+} SearchResult;
+
+/*----------------------------------------------------------------------------*/
+
+/* Distance of a machine to a target, 0 if it's met */
+uint32_t search_target_distance(const SearchTarget* target, const CpuCtx* ctx);
+
+/* Search from the `initial' machine. Returns false on error; whether a
+ * sequence was found is stored in `result'. */
+bool search_run(const CpuCtx* initial, const SearchParams* params,
+                SearchResult* result);
+
+/* Free the sequence of a result */
+void search_result_free(SearchResult* result);
+
+#endif /* SEARCH_H_ */
@@ -0,0 +1,112 @@
+
+#ifndef SIMD_H_
+#define SIMD_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+/*
+ * Engine for running many instances of the same ROM at once. The registers of
+ * the instances are stored as a structure of arrays, in groups of SIMD_LANES
+ * instances. On each cycle, the lanes of a group that are at the same PC, with
+ * the same opcode, execute it together with vector instructions (AVX2 when
+ * the host supports it). The rest of the state (memory, stack, framebuffer and
+ * keyboard) stays in a CpuCtx for each instance.
+ *
+ * Only the instructions that use registers (ALU, compares, skips, jumps,
+ * timers, RND and the ones that change I) are vectorized. The common ones that
+ * use the rest of the state (DRW, CALL, key skips, BCD...) run one lane at a
+ * time, directly on the registers of the lane. Everything else, including the
+ * instructions that would trap and the lanes waiting for a key, goes through
+ * `cpu_cycle', so the results are always the same as with `cpu_frame'.
+ */
+
+/* Number of instances in each group. With AVX2, the 8-bit registers of a
+ * group fit in a single vector register. */
+#define SIMD_LANES 32
+
+/* Memory is split in pages of 1 << SIMD_PAGE_SHIFT bytes, for tracking which
+ * parts of the memory of each instance are different from the ROM. */
+#define SIMD_PAGE_SHIFT 8
+
+#define SIMD_PAGES (MEM_SZ >> SIMD_PAGE_SHIFT)
+
+typedef uint8_t SimdU8 __attribute__((vector_size(SIMD_LANES)));
+typedef uint16_t SimdU16 __attribute__((vector_size(SIMD_LANES * 2)));
+typedef uint32_t SimdU32 __attribute__((vector_size(SIMD_LANES * 4)));
+
+/* Registers of SIMD_LANES instances. Element N of each vector belongs to lane
+ * N. */
+typedef struct SimdGroup {
+    SimdU8 V[16];
+    SimdU8 DT, ST;
+    SimdU16 I, PC;
+    SimdU32 rng;
+
+    /* Bit N is set if lane N is running, or if its keyboard is not KB_NONE,
+     * respectively */
+    uint32_t active;
+    uint32_t busy;
+
+    /* Bit N of `dirty[page]' is set if that memory page of lane N might be
+     * different from the ROM, so its opcodes have to be read from its own
+     * memory. */
+    uint32_t dirty[SIMD_PAGES];
+} SimdGroup;
+
+typedef struct SimdBatch {
+    /* Registers, in groups of SIMD_LANES instances */
+    SimdGroup* groups;
+    uint32_t num_groups;
+
+    /* Rest of the state of each instance. The registers of these contexts
+     * are only updated by `simd_store'. */
+    CpuCtx* ctx;
+    uint32_t num;
+
+    /* Trap that stopped each instance, or TRAP_NONE */
+    uint8_t* trap;
+
+    /* Initial memory, shared by the instances until they write to it */
+    uint8_t code[MEM_SZ];
+
+    /* EQuirkFlags of the profile, and whether out-of-range accesses trap */
+    int quirks;
+    bool mem_trap;
+
+    /* Number of instructions executed with vectors, and one lane at a time */
+    uint64_t vector_instrs;
+    uint64_t scalar_instrs;
+} SimdBatch;
+
+/*----------------------------------------------------------------------------*/
+
+/* Initialize a batch of `num' copies of the `initial' context, which must have
+ * the ROM already loaded. Returns false if there is not enough memory. */
+bool simd_init(SimdBatch* batch, const CpuCtx* initial, uint32_t num);
+
+/* Reset every instance of a batch to a copy of `initial', which can have a
+ * different ROM and profile than the last one. Doesn't allocate anything, so
+ * it's cheaper than `simd_free' and `simd_init'. */
+void simd_reset(SimdBatch* batch, const CpuCtx* initial);
+
+/* Free the memory used by a batch, but not the batch itself */
+void simd_free(SimdBatch* batch);
+
+/* Load the registers of instance `i' from its context, after it was changed by
+ * the caller. The instance is resumed if it was stopped. */
+void simd_load(SimdBatch* batch, uint32_t i);
+
+/* Store the registers of instance `i' into its context, so the whole context
+ * can be inspected. */
+void simd_store(SimdBatch* batch, uint32_t i);
+
+/* Run a frame in all the instances, like `cpu_frame', holding the keys of
+ * `keys[N]' in instance N (see `kb_store_mask'). If `keys' is NULL, the
+ * keyboards are not changed. Instances that trap are stopped, and their trap is
+ * stored in `batch->trap'. Returns the number of stopped instances. */
+uint32_t simd_frame(SimdBatch* batch, const uint16_t* keys);
+
+#endif /* SIMD_H_ */
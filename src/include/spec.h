@@ -0,0 +1,96 @@
+
+#ifndef SPEC_H_
+#define SPEC_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "cpu.h"
+
+/*
+ * Speculative execution while the machine waits for a key with "LD Vx, K".
+ * Once the waiting machine stops changing between frames (the timers reached
+ * zero), it's copied into 16 branches, and worker threads run each branch for
+ * SPEC_FRAMES frames as if that key was pressed and released, with no other
+ * keys changing afterwards.
+ *
+ * When the real key is released, the branch of that key is followed as long
+ * as the machine is exactly in the state the branch expected before each
+ * frame, copying the finished frames instead of running them. As soon as
+ * anything differs (e.g. another key is pressed), the machine runs normally
+ * again, so the results are always the same as with `cpu_frame'.
+ */
+
+/* Number of branches, one for each key */
+#define SPEC_KEYS 16
+
+/* Frames run by each branch */
+#define SPEC_FRAMES 30
+
+typedef struct SpecBranch {
+    /* The waiting machine, after pressing and releasing the key */
+    CpuCtx start;
+
+    /* State after each frame, its trap, which ends the branch, and the
+     * instructions it retired. Only the first `num_frames' are finished, and
+     * they don't change afterwards. */
+    CpuCtx frames[SPEC_FRAMES];
+    ECpuTrap traps[SPEC_FRAMES];
+    int retired[SPEC_FRAMES];
+    uint32_t num_frames;
+} SpecBranch;
+
+typedef struct Spec {
+    /* Waiting machine that the branches were copied from, if `has_base' */
+    CpuCtx base;
+    bool has_base;
+
+    /* State after the last frame, to detect that the machine stopped
+     * changing */
+    CpuCtx prev;
+
+    SpecBranch branches[SPEC_KEYS];
+
+    /* Branch being followed and its next frame, or -1 */
+    int following;
+    uint32_t pos;
+
+    /* Worker threads. A new job is started by incrementing `job' when no
+     * worker is `busy', and the workers take the branches in order from
+     * `next_key'. Setting `abort' stops the branches of the current job. */
+    int threads;
+    pthread_t* workers;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t job;
+    uint32_t next_key;
+    uint32_t busy;
+    bool abort;
+    bool quit;
+
+    /* Number of jobs started, branches followed, and frames copied from the
+     * branches */
+    uint64_t jobs;
+    uint64_t hits;
+    uint64_t frames_reused;
+} Spec;
+
+/*----------------------------------------------------------------------------*/
+
+/* Create the branches and start the worker threads. Returns NULL on error. */
+Spec* spec_create(int threads);
+
+/* Stop the worker threads and free the branches */
+void spec_destroy(Spec* spec);
+
+/* Run a frame like `cpu_frame_count', copying it from a branch if one of them
+ * matches the state of the machine, and start a new job if the machine is
+ * waiting for a key. Called after storing the keys of the frame. */
+ECpuTrap spec_frame(Spec* spec, CpuCtx* ctx, int* retired);
+
+/* Print the number of jobs and the frames copied from the branches */
+void spec_print(const Spec* spec, FILE* fp);
+
+#endif /* SPEC_H_ */
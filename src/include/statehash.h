@@ -0,0 +1,45 @@
+
+#ifndef STATEHASH_H_
+#define STATEHASH_H_ 1
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/*
+ * Incremental 64-bit hash of the state of a machine, for finding machines in
+ * the same state without comparing or hashing their whole memory. The memory
+ * and the framebuffer are hashed as the sum of a hash of each byte (or row)
+ * and its position, so when an instruction writes to them, only the written
+ * part has to be hashed again. The registers are small, so they are hashed
+ * from scratch by `state_hash_get'.
+ *
+ * The machine must only run through `state_hash_cycle' or `state_hash_frame'
+ * after `state_hash_init', or the hash has to be initialized again.
+ */
+
+typedef struct StateHash {
+    /* Sum of the hashes of each byte of the memory, and of each row of the
+     * framebuffer */
+    uint64_t mem;
+    uint64_t fb;
+} StateHash;
+
+/*----------------------------------------------------------------------------*/
+
+/* Hash the whole memory and framebuffer of a machine */
+void state_hash_init(StateHash* hash, const CpuCtx* ctx);
+
+/* Run an instruction with `cpu_cycle', updating the hash with the memory and
+ * the rows of the framebuffer that it writes */
+ECpuTrap state_hash_cycle(StateHash* hash, CpuCtx* ctx);
+
+/* Run a whole frame, like `cpu_frame' */
+ECpuTrap state_hash_frame(StateHash* hash, CpuCtx* ctx);
+
+/* Get the hash of the whole state: memory, framebuffer, registers, live part
+ * of the stack, keyboard and random number generator. The quirk profile and
+ * memory mode are not included. */
+uint64_t state_hash_get(const StateHash* hash, const CpuCtx* ctx);
+
+#endif /* STATEHASH_H_ */
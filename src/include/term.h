@@ -0,0 +1,38 @@
+
+#ifndef TERM_H_
+#define TERM_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "keyboard.h"
+
+/* Number of frames that a key stays held after being pressed in the terminal,
+ * since terminals don't report key releases. */
+#define TERM_KEY_FRAMES 8
+
+typedef enum {
+    TERM_HALF_BLOCK = 0, /* Each character is 1x2 pixels, 64x16 characters */
+    TERM_BRAILLE    = 1, /* Each character is 2x4 pixels, 32x8 characters */
+} ETermGlyphs;
+
+/*----------------------------------------------------------------------------*/
+
+/* Put the terminal in raw mode, with non-blocking input, and clear it.
+ * Returns false if stdin is not a terminal. */
+bool term_init(ETermGlyphs glyphs);
+
+/* Restore the original terminal mode. Does nothing if `term_init' was not
+ * called. */
+void term_restore(void);
+
+/* Draw the framebuffer into the terminal. Only the characters that changed
+ * since the last call are written, with a single `write' call. */
+void term_render(const uint64_t* fb);
+
+/* Read the pending keys from stdin, and release the ones that were pressed
+ * TERM_KEY_FRAMES calls ago. Should be called once per frame. Returns false if
+ * the user wants to quit (Escape or Ctrl+C). */
+bool term_poll_keys(Keyboard* kb);
+
+#endif /* TERM_H_ */
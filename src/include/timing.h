@@ -0,0 +1,55 @@
+
+#ifndef TIMING_H_
+#define TIMING_H_ 1
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/*
+ * Optional timing model of the original COSMAC VIP interpreter. Instead of
+ * running CYCLES_PER_FRAME instructions on each frame, each instruction is
+ * charged its approximate cost in machine cycles of the CDP1802, and each frame
+ * has a fixed budget. This engine is separate from `cpu_frame', so the default
+ * path doesn't pay for it.
+ *
+ * The VIP runs at 1.76064MHz, and each machine cycle takes 8 clock cycles, so
+ * there are 3668 machine cycles on each 60Hz frame. Part of them are used by
+ * the display DMA and the interrupt routine.
+ */
+#define VIP_FRAME_CYCLES     3668
+#define VIP_DMA_CYCLES       1024
+#define VIP_INTERRUPT_CYCLES 46
+
+/* Machine cycles available to the interpreter on each frame */
+#define VIP_BUDGET_CYCLES \
+    (VIP_FRAME_CYCLES - VIP_DMA_CYCLES - VIP_INTERRUPT_CYCLES)
+
+typedef struct VipTiming {
+    /* Machine cycles left in the current frame. Can be negative if the last
+     * instruction of the previous frame didn't fit, and the debt is paid in
+     * the next one. */
+    int32_t balance;
+
+    /* Total machine cycles and instructions executed */
+    uint64_t cycles;
+    uint64_t instructions;
+} VipTiming;
+
+/*----------------------------------------------------------------------------*/
+
+/* Initialize the timing state of a machine */
+void timing_init(VipTiming* timing);
+
+/* Get the cost, in machine cycles, of executing the specified opcode with the
+ * current state of the machine. Skips are charged as not taken. */
+int timing_cost(const CpuCtx* ctx, uint16_t opcode);
+
+/* Run the instructions that fit in the cycle budget of a 60Hz frame, and then
+ * update the timers. Like on the VIP, DRW waits for the vertical blank: if a
+ * DRW is found after the start of the frame, the rest of the frame is spent
+ * waiting, and it's executed at the start of the next one. Returns the trap
+ * of the last instruction, like `cpu_frame'. */
+ECpuTrap timing_frame(VipTiming* timing, CpuCtx* ctx);
+
+#endif /* TIMING_H_ */
@@ -2,6 +2,9 @@
 #ifndef UTIL_H_
 #define UTIL_H_ 1
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define LENGTH(ARR) (sizeof(ARR) / (sizeof((ARR)[0])))
 
 /* Wrapper for err_msg() */
@@ -21,10 +24,16 @@
 /*----------------------------------------------------------------------------*/
 
 /* Print error message to stderr, call all the relevant SDL functions, and exit
- * the program. */
+ * the program. Defined in main.c, since it cleans up the global SDL state. */
 void die(const char* fmt, ...);
 
 /* Print error message to stderr, along with the function name */
 void err_msg(const char* func, const char* fmt, ...);
 
+/* Initial value for `hash_fnv1a' */
+#define FNV1A_INIT 0xCBF29CE484222325ULL
+
+/* Update a 64-bit FNV-1a hash with `sz' bytes of data */
+uint64_t hash_fnv1a(uint64_t hash, const void* data, size_t sz);
+
 #endif /* UTIL_H_ */
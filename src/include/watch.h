@@ -0,0 +1,45 @@
+
+#ifndef WATCH_H_
+#define WATCH_H_ 1
+
+#include <stdbool.h>
+
+/*
+ * Watch the ROM file for changes with inotify, for reloading it without
+ * restarting the emulator. The directory of the file is watched instead of the
+ * file itself, since most editors save by writing a new file and renaming it
+ * over the old one, which would end a watch on the file.
+ */
+
+typedef enum {
+    RELOAD_NONE    = 0, /* Don't watch the ROM */
+    RELOAD_RESTART = 1, /* Start the new ROM from the first frame */
+    RELOAD_REPLAY  = 2, /* Replay the recorded keys up to the same frame */
+} EReloadMode;
+
+typedef struct RomWatch {
+    /* inotify descriptor, non-blocking */
+    int fd;
+
+    /* Name of the file inside the watched directory */
+    char name[256];
+} RomWatch;
+
+/*----------------------------------------------------------------------------*/
+
+/* Get the reload mode from its name ("restart" or "replay"). Returns false if
+ * the name is unknown. */
+bool watch_mode_from_str(const char* str, EReloadMode* mode);
+
+/* Start watching the specified file. Returns NULL on error. */
+RomWatch* watch_start(const char* path);
+
+/* Stop watching the file, and free the watch */
+void watch_stop(RomWatch* watch);
+
+/* Check, without blocking, whether the file was written or replaced since the
+ * last call. Consumes all the pending events, so several writes in a row only
+ * count once. */
+bool watch_poll(RomWatch* watch);
+
+#endif /* WATCH_H_ */
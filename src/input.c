@@ -0,0 +1,109 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/util.h"
+#include "include/input.h"
+
+bool input_load(InputScript* script, const char* filename) {
+    script->events     = NULL;
+    script->events_num = 0;
+    script->cursor     = 0;
+
+    FILE* fp = fopen(filename, "r");
+    if (!fp) {
+        ERR("Failed to open file: '%s'", filename);
+        return false;
+    }
+
+    size_t events_sz = 0;
+    char line[256];
+    for (int line_num = 1; fgets(line, sizeof(line), fp); line_num++) {
+        /* Ignore comments and empty lines */
+        char* comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        unsigned long long frame;
+        unsigned int mask;
+        char dummy;
+        if (sscanf(line, " %c", &dummy) != 1)
+            continue;
+
+        if (sscanf(line, "%llu %x", &frame, &mask) != 2 || mask > 0xFFFF) {
+            ERR("%s:%d: Invalid line.", filename, line_num);
+            goto fail;
+        }
+
+        if (script->events_num > 0 &&
+            frame < script->events[script->events_num - 1].frame) {
+            ERR("%s:%d: Frames are not sorted.", filename, line_num);
+            goto fail;
+        }
+
+        if (script->events_num >= events_sz) {
+            events_sz      = (events_sz == 0) ? 64 : events_sz * 2;
+            script->events = realloc(script->events,
+                                     events_sz * sizeof(InputEvent));
+        }
+
+        script->events[script->events_num].frame = frame;
+        script->events[script->events_num].mask  = mask;
+        script->events_num++;
+    }
+
+    fclose(fp);
+    return true;
+
+fail:
+    fclose(fp);
+    input_free(script);
+    return false;
+}
+
+void input_free(InputScript* script) {
+    free(script->events);
+    script->events     = NULL;
+    script->events_num = 0;
+    script->cursor     = 0;
+}
+
+uint16_t input_mask_at(InputScript* script, uint64_t frame) {
+    /* If we went back in time, start from the beginning */
+    if (script->cursor > 0 && script->events[script->cursor - 1].frame > frame)
+        script->cursor = 0;
+
+    while (script->cursor < script->events_num &&
+           script->events[script->cursor].frame <= frame)
+        script->cursor++;
+
+    return (script->cursor > 0) ? script->events[script->cursor - 1].mask : 0;
+}
+
+void input_record(InputScript* script, uint64_t frame, uint16_t mask) {
+    const uint16_t last = (script->events_num > 0)
+                            ? script->events[script->events_num - 1].mask
+                            : 0;
+    if (mask == last)
+        return;
+
+    /* Keys change a few times per second at most, so the array grows one
+     * event at a time */
+    script->events = realloc(script->events,
+                             (script->events_num + 1) * sizeof(InputEvent));
+    script->events[script->events_num].frame = frame;
+    script->events[script->events_num].mask  = mask;
+    script->events_num++;
+}
+
+void input_truncate(InputScript* script, uint64_t frame) {
+    while (script->events_num > 0 &&
+           script->events[script->events_num - 1].frame > frame)
+        script->events_num--;
+
+    if (script->cursor > script->events_num)
+        script->cursor = script->events_num;
+}
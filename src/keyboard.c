@@ -3,44 +3,55 @@
 #include <stdio.h>
 #include "include/keyboard.h"
 
-static EKeyboardStatus kb_status = KB_NONE;
-static int last_key              = 0;
-
-static bool key_states[16];
-
-void kb_store(int key, bool held) {
-    key_states[key] = held;
+void kb_store(Keyboard* kb, int key, bool held) {
+    if (held)
+        kb->held |= (1 << key);
+    else
+        kb->held &= ~(1 << key);
 
     /* If we are releasing, and we are waiting for a key, store it */
-    if (kb_status == KB_WAITING && !held) {
-        last_key  = key;
-        kb_status = KB_HAS_KEY;
+    if (kb->status == KB_WAITING && !held) {
+        kb->last_key = key;
+        kb->status   = KB_HAS_KEY;
     }
 }
 
-bool kb_is_held(int key) {
-    return key_states[key];
+void kb_store_mask(Keyboard* kb, uint16_t mask) {
+    const uint16_t changed = kb->held ^ mask;
+    if (changed == 0)
+        return;
+
+    for (int key = 0; key < 16; key++)
+        if ((changed >> key) & 1)
+            kb_store(kb, key, (mask >> key) & 1);
+}
+
+bool kb_is_held(const Keyboard* kb, int key) {
+    return (kb->held >> key) & 1;
 }
 
 /*----------------------------------------------------------------------------*/
 
-void kb_wait_for_key(void) {
-    kb_status = KB_WAITING;
+void kb_wait_for_key(Keyboard* kb) {
+    kb->status = KB_WAITING;
 }
 
-EKeyboardStatus kb_get_status(void) {
-    return kb_status;
+EKeyboardStatus kb_get_status(const Keyboard* kb) {
+    return kb->status;
 }
 
-int kb_get_last_key(void) {
-    kb_status = KB_NONE;
-    return last_key;
+int kb_get_last_key(Keyboard* kb) {
+    kb->status = KB_NONE;
+    return kb->last_key;
 }
 
 /*----------------------------------------------------------------------------*/
 
-void kb_print(void) {
-    const bool* k = key_states;
+void kb_print(const Keyboard* kb) {
+    bool k[16];
+    for (int key = 0; key < 16; key++)
+        k[key] = kb_is_held(kb, key);
+
     printf("+---+---+---+---+\n"
            "| %d | %d | %d | %d |\n"
            "+---+---+---+---+\n"
@@ -0,0 +1,149 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "include/util.h"
+#include "include/cpu.h"
+#include "include/live.h"
+
+/* Number of times `live_read' retries before giving up */
+#define READ_TRIES 10000
+
+/* Store the name of the segment, which must start with a slash */
+static void set_name(LiveState* live, const char* name) {
+    snprintf(live->name, sizeof(live->name), "%s%s",
+             (name[0] == '/') ? "" : "/", name);
+}
+
+LiveState* live_create(const char* name, uint32_t num) {
+    LiveState* live = calloc(1, sizeof(LiveState));
+    if (live == NULL)
+        return NULL;
+
+    set_name(live, name);
+    live->owner = true;
+    live->size  = sizeof(LiveHeader) + (size_t)num * sizeof(LiveSlot);
+
+    /* Start from an empty segment, even if an old one was left behind */
+    shm_unlink(live->name);
+    const int fd = shm_open(live->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        ERR("Could not create shared memory: '%s'", live->name);
+        free(live);
+        return NULL;
+    }
+
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, live->size) == 0)
+        map = mmap(NULL, live->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        ERR("Could not map shared memory: '%s'", live->name);
+        shm_unlink(live->name);
+        free(live);
+        return NULL;
+    }
+
+    live->header = map;
+    live->slots  = (LiveSlot*)(live->header + 1);
+
+    /* The magic is written last, so readers never see a half-written
+     * header */
+    live->header->version = LIVE_VERSION;
+    live->header->num     = num;
+    live->header->slot_sz = sizeof(LiveSlot);
+    live->header->ctx_sz  = sizeof(CpuCtx);
+    __atomic_store_n(&live->header->magic, LIVE_MAGIC, __ATOMIC_RELEASE);
+
+    return live;
+}
+
+LiveState* live_open(const char* name) {
+    LiveState* live = calloc(1, sizeof(LiveState));
+    if (live == NULL)
+        return NULL;
+
+    set_name(live, name);
+
+    const int fd = shm_open(live->name, O_RDONLY, 0);
+    if (fd < 0) {
+        ERR("Could not open shared memory: '%s'", live->name);
+        free(live);
+        return NULL;
+    }
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(LiveHeader))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        ERR("Could not map shared memory: '%s'", live->name);
+        free(live);
+        return NULL;
+    }
+
+    live->header = map;
+    live->slots  = (LiveSlot*)(live->header + 1);
+    live->size   = st.st_size;
+
+    const LiveHeader* header = live->header;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != LIVE_MAGIC ||
+        header->version != LIVE_VERSION ||
+        header->slot_sz != sizeof(LiveSlot) ||
+        header->ctx_sz != sizeof(CpuCtx) ||
+        sizeof(LiveHeader) + (size_t)header->num * sizeof(LiveSlot) >
+          live->size) {
+        ERR("Unknown shared memory layout: '%s'", live->name);
+        munmap(map, live->size);
+        free(live);
+        return NULL;
+    }
+
+    return live;
+}
+
+void live_close(LiveState* live) {
+    munmap(live->header, live->size);
+
+    if (live->owner)
+        shm_unlink(live->name);
+
+    free(live);
+}
+
+bool live_read(const LiveState* live, uint32_t i, CpuCtx* ctx,
+               uint64_t* frame) {
+    const LiveSlot* slot = &live->slots[i];
+
+    for (int tries = 0; tries < READ_TRIES; tries++) {
+        const uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        memcpy(ctx, &slot->ctx, sizeof(CpuCtx));
+        const uint64_t slot_frame = slot->frame;
+
+        /* If the sequence didn't change, nothing was written during the
+         * copy */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+            if (frame != NULL)
+                *frame = slot_frame;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,220 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "include/util.h"
+#include "include/cpu.h"
+#include "include/backend.h"
+#include "include/lockstep.h"
+
+/* Write the description of a difference and return false, for
+ * `lockstep_compare' */
+#define DIFF(...)                                 \
+    do {                                          \
+        snprintf(report, report_sz, __VA_ARGS__); \
+        return false;                             \
+    } while (0)
+
+bool lockstep_compare(const CpuCtx* a, const CpuCtx* b, char* report,
+                      size_t report_sz) {
+    /* Registers are compared first, since they are the most likely to
+     * differ, and the cheapest to compare. */
+    for (int i = 0; i < 16; i++)
+        if (a->V[i] != b->V[i])
+            DIFF("V%X: 0x%X != 0x%X", i, a->V[i], b->V[i]);
+
+    if (a->I != b->I)
+        DIFF("I: 0x%X != 0x%X", a->I, b->I);
+    if (a->PC != b->PC)
+        DIFF("PC: 0x%X != 0x%X", a->PC, b->PC);
+    if (a->SP != b->SP)
+        DIFF("SP: 0x%X != 0x%X", a->SP, b->SP);
+    if (a->DT != b->DT)
+        DIFF("DT: 0x%X != 0x%X", a->DT, b->DT);
+    if (a->ST != b->ST)
+        DIFF("ST: 0x%X != 0x%X", a->ST, b->ST);
+
+    for (size_t i = 0; i < LENGTH(a->stack); i++)
+        if (a->stack[i] != b->stack[i])
+            DIFF("stack[%zu]: 0x%X != 0x%X", i, a->stack[i], b->stack[i]);
+
+    if (a->kb.status != b->kb.status)
+        DIFF("Keyboard status: 0x%X != 0x%X", a->kb.status, b->kb.status);
+    if (a->rng != b->rng)
+        DIFF("RNG state: 0x%X != 0x%X", a->rng, b->rng);
+
+    /* Comparing the memory and the framebuffer directly is as fast as hashing
+     * them, and lets us report the exact address. */
+    if (memcmp(a->mem, b->mem, sizeof(a->mem)) != 0)
+        for (int i = 0; i < MEM_SZ; i++)
+            if (a->mem[i] != b->mem[i])
+                DIFF("mem[%03X]: 0x%X != 0x%X", i, a->mem[i], b->mem[i]);
+
+    if (memcmp(a->fb, b->fb, sizeof(a->fb)) != 0)
+        for (int y = 0; y < DISP_H; y++)
+            if (a->fb[y] != b->fb[y]) {
+                DIFF("Framebuffer row %d: %016llX != %016llX", y,
+                     (unsigned long long)a->fb[y],
+                     (unsigned long long)b->fb[y]);
+            }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void lockstep_init(Lockstep* ls, CpuCtx* ref_ctx, const CpuBackend* ref,
+                   CpuCtx* other_ctx, const CpuBackend* other) {
+    ls->ctx[0]     = ref_ctx;
+    ls->ctx[1]     = other_ctx;
+    ls->backend[0] = ref;
+    ls->backend[1] = other;
+
+    for (int i = 0; i < 2; i++)
+        ls->state[i] = (ls->backend[i]->create != NULL)
+                         ? ls->backend[i]->create(ls->ctx[i])
+                         : NULL;
+
+    ls->per_instruction = true;
+    ls->frame           = 0;
+    ls->retired         = 0;
+    ls->trap            = TRAP_NONE;
+    ls->report[0]       = '\0';
+}
+
+void lockstep_reset(Lockstep* ls) {
+    for (int i = 0; i < 2; i++)
+        if (ls->backend[i]->reset != NULL)
+            ls->backend[i]->reset(ls->ctx[i], ls->state[i]);
+
+    ls->frame     = 0;
+    ls->retired   = 0;
+    ls->trap      = TRAP_NONE;
+    ls->report[0] = '\0';
+}
+
+void lockstep_free(Lockstep* ls) {
+    for (int i = 0; i < 2; i++)
+        if (ls->backend[i]->destroy != NULL)
+            ls->backend[i]->destroy(ls->state[i]);
+}
+
+/* Describe a divergence in the report of the lockstep context. The `what'
+ * string is the difference itself. */
+static ELockstepStatus diverged(Lockstep* ls, const int done[2],
+                                const uint16_t last_pc[2], const char* what) {
+    char last[2][64];
+    for (int i = 0; i < 2; i++) {
+        const CpuCtx* ctx = ls->ctx[i];
+        const uint16_t pc = last_pc[i];
+        snprintf(last[i], sizeof(last[i]), "%s at %03X (%02X%02X)",
+                 ls->backend[i]->name, pc, ctx->mem[pc],
+                 ctx->mem[(pc + 1) & MEM_MASK]);
+    }
+
+    snprintf(ls->report, sizeof(ls->report),
+             "Frame %llu, instruction %llu (%s: %d, %s: %d)\n"
+             "  %s (%s / %s)\n"
+             "  Last step: %s; %s",
+             (unsigned long long)ls->frame,
+             (unsigned long long)(ls->retired + done[0]),
+             ls->backend[0]->name, done[0], ls->backend[1]->name, done[1],
+             what, ls->backend[0]->name, ls->backend[1]->name, last[0],
+             last[1]);
+    return LOCKSTEP_DIVERGED;
+}
+
+ELockstepStatus lockstep_frame(Lockstep* ls, uint16_t keypad) {
+    int done[2]          = { 0, 0 };
+    bool stopped[2]      = { false, false };
+    ECpuTrap trap[2]     = { TRAP_NONE, TRAP_NONE };
+    uint16_t last_pc[2]  = { ls->ctx[0]->PC, ls->ctx[1]->PC };
+    char what[512];
+
+    for (int i = 0; i < 2; i++)
+        kb_store_mask(&ls->ctx[i]->kb, keypad);
+
+    for (;;) {
+        /* The machine with less retired instructions runs next. When both are
+         * synchronized, the second one runs first, so its blocks are not split
+         * by the reference. */
+        int i;
+        if (done[0] < done[1]) {
+            i = 0;
+        } else if (done[1] < done[0]) {
+            i = 1;
+        } else if (stopped[0] || stopped[1]) {
+            if (stopped[0] && stopped[1]) {
+                if (trap[0] != trap[1]) {
+                    snprintf(what, sizeof(what), "Different traps: %s, %s",
+                             cpu_trap_str(trap[0]), cpu_trap_str(trap[1]));
+                    return diverged(ls, done, last_pc, what);
+                }
+
+                if (!lockstep_compare(ls->ctx[0], ls->ctx[1], what,
+                                      sizeof(what)))
+                    return diverged(ls, done, last_pc, what);
+
+                ls->trap = trap[0];
+                return LOCKSTEP_TRAPPED;
+            }
+
+            /* The other machine must trap on this same instruction */
+            i = stopped[0] ? 1 : 0;
+        } else {
+            if (ls->per_instruction &&
+                !lockstep_compare(ls->ctx[0], ls->ctx[1], what, sizeof(what)))
+                return diverged(ls, done, last_pc, what);
+
+            if (done[0] >= CYCLES_PER_FRAME)
+                break;
+
+            i = 1;
+        }
+
+        const int other = !i;
+        if (stopped[i]) {
+            snprintf(what, sizeof(what),
+                     "%s trapped (%s), but %s kept running",
+                     ls->backend[i]->name, cpu_trap_str(trap[i]),
+                     ls->backend[other]->name);
+            return diverged(ls, done, last_pc, what);
+        }
+
+        /* Catch up with the other machine, or run until the end of the frame
+         * if they are synchronized. */
+        int max;
+        if (done[i] < done[other])
+            max = done[other] - done[i];
+        else if (stopped[other])
+            max = 1;
+        else
+            max = CYCLES_PER_FRAME - done[i];
+
+        int retired;
+        last_pc[i] = ls->ctx[i]->PC;
+        trap[i]    = ls->backend[i]->step(ls->ctx[i], ls->state[i], max,
+                                          &retired);
+        done[i] += retired;
+
+        if (trap[i] != TRAP_NONE)
+            stopped[i] = true;
+        else if (retired == 0) {
+            snprintf(what, sizeof(what), "%s did not retire any instruction",
+                     ls->backend[i]->name);
+            return diverged(ls, done, last_pc, what);
+        }
+    }
+
+    for (int i = 0; i < 2; i++)
+        cpu_tick_timers(ls->ctx[i]);
+
+    if (!lockstep_compare(ls->ctx[0], ls->ctx[1], what, sizeof(what)))
+        return diverged(ls, done, last_pc, what);
+
+    ls->frame++;
+    ls->retired += CYCLES_PER_FRAME;
+    return LOCKSTEP_OK;
+}
@@ -1,9 +1,13 @@
 
+#include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <SDL2/SDL.h>
 
 #include "include/util.h"
@@ -11,24 +15,108 @@
 #include "include/display.h"
 #include "include/cpu.h"
 #include "include/keyboard.h"
+#include "include/timing.h"
+#include "include/capture.h"
+#include "include/term.h"
+#include "include/metrics.h"
+#include "include/live.h"
+#include "include/debug.h"
+#include "include/gdb.h"
+#include "include/aot.h"
+#include "include/fuse.h"
+#include "include/analysis.h"
+#include "include/audio.h"
+#include "include/input.h"
+#include "include/watch.h"
+#include "include/phosphor.h"
+#include "include/spec.h"
 
 SDL_Window* g_window     = NULL;
 SDL_Renderer* g_renderer = NULL;
 CpuCtx* g_cpu_ctx        = NULL;
 
-int main(int argc, char** argv) {
-    if (argc < 2)
-        die("Usage: %s <rom>\n", argv[0]);
+/* Optional frame capture, stopped on exit */
+static Capture* capture = NULL;
+
+/* Optional live state export. If set, `g_cpu_ctx' lives in its only slot. */
+static LiveState* live = NULL;
+
+/* Set by SIGUSR1, to print the metrics from the main loop */
+static volatile sig_atomic_t metrics_requested = 0;
+
+static void on_sigusr1(int sig) {
+    (void)sig;
+    metrics_requested = 1;
+}
+
+void die(const char* fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+
+    vfprintf(stderr, fmt, va);
+    putc('\n', stderr);
+
+    term_restore();
+
+    if (capture != NULL)
+        capture_stop(capture);
+
+    if (live != NULL)
+        live_close(live);
+    else if (g_cpu_ctx != NULL)
+        cpu_free(g_cpu_ctx);
+
+    if (g_window != NULL)
+        SDL_DestroyWindow(g_window);
+
+    SDL_Quit();
+    exit(1);
+}
+
+/* Get the CHIP-8 key associated to a scancode, or -1 if it has none */
+static int get_key(SDL_Scancode scancode) {
+    switch (scancode) {
+        /* clang-format off */
+        case SDL_SCANCODE_1: return 0x1;
+        case SDL_SCANCODE_2: return 0x2;
+        case SDL_SCANCODE_3: return 0x3;
+        case SDL_SCANCODE_4: return 0xC;
+        case SDL_SCANCODE_Q: return 0x4;
+        case SDL_SCANCODE_W: return 0x5;
+        case SDL_SCANCODE_E: return 0x6;
+        case SDL_SCANCODE_R: return 0xD;
+        case SDL_SCANCODE_A: return 0x7;
+        case SDL_SCANCODE_S: return 0x8;
+        case SDL_SCANCODE_D: return 0x9;
+        case SDL_SCANCODE_F: return 0xE;
+        case SDL_SCANCODE_Z: return 0xA;
+        case SDL_SCANCODE_X: return 0x0;
+        case SDL_SCANCODE_C: return 0xB;
+        case SDL_SCANCODE_V: return 0xF;
+        /* clang-format on */
+
+        default:
+            return -1;
+    }
+}
 
-    const char* rom_filename = argv[1];
+/* Scale the display for the current size of the window */
+static void resize_display(void) {
+    int w, h;
+    if (SDL_GetRendererOutputSize(g_renderer, &w, &h) != 0 ||
+        !display_resize(w, h))
+        die("Error scaling the display.");
+}
 
+/* Start SDL and create the emulator window */
+static void init_window(void) {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0)
         die("Unable to start SDL.");
 
     /* Create SDL window */
     g_window = SDL_CreateWindow("CHIP-8 Emulator", SDL_WINDOWPOS_CENTERED,
                                 SDL_WINDOWPOS_CENTERED, DISP_W * DISP_SCALE,
-                                DISP_H * DISP_SCALE, 0);
+                                DISP_H * DISP_SCALE, SDL_WINDOW_RESIZABLE);
     if (!g_window)
         die("Error creating SDL window.");
 
@@ -36,115 +124,591 @@ int main(int argc, char** argv) {
     g_renderer =
       SDL_CreateRenderer(g_window, -1,
                          SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if (!g_renderer) {
-        SDL_DestroyWindow(g_window);
+    if (!g_renderer)
         die("Error creating SDL renderer.");
+
+    resize_display();
+}
+
+/* Parse the SDL events, storing the keys in `kb'. Returns false if the user
+ * wants to quit. */
+static bool poll_events(Keyboard* kb) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+            case SDL_QUIT:
+                return false;
+
+            case SDL_KEYDOWN: {
+                if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE)
+                    return false;
+
+                const int key = get_key(event.key.keysym.scancode);
+                if (key >= 0)
+                    kb_store(kb, key, true);
+            } break;
+
+            case SDL_KEYUP: {
+                const int key = get_key(event.key.keysym.scancode);
+                if (key >= 0)
+                    kb_store(kb, key, false);
+            } break;
+
+            case SDL_WINDOWEVENT: {
+                if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+                    resize_display();
+            } break;
+
+            default:
+                break;
+        }
+    }
+
+    return true;
+}
+
+/* Load the ROM file again into a fresh machine with the same settings, and
+ * replace `ctx' with it. With RELOAD_REPLAY, the keys recorded in `recorded'
+ * are replayed up to `frame', and the number of the frame reached is returned;
+ * if a trap stops the replay earlier, the keys recorded after that frame are
+ * dropped. Otherwise, the machine starts from the first frame, and 0 is
+ * returned. If the file can't be read, `ctx' is not changed. */
+static uint64_t reload_rom(CpuCtx* ctx, const char* rom_filename,
+                           uint32_t seed, EReloadMode mode,
+                           InputScript* recorded, uint64_t frame,
+                           VipTiming* timing, FuseCache* fuse) {
+    static CpuCtx fresh;
+    cpu_init(&fresh);
+    cpu_seed_rng(&fresh, seed);
+    cpu_set_mem_mode(&fresh, ctx->mem_mode);
+    cpu_set_profile(&fresh, ctx->profile);
+
+    if (!cpu_load_rom(&fresh, rom_filename)) {
+        ERR("Keeping the old ROM.");
+        return frame;
+    }
+
+    /* The decoded instructions and the timing debt belong to the old ROM */
+    if (fuse != NULL)
+        fuse_invalidate(fuse);
+    if (timing != NULL)
+        timing_init(timing);
+
+    uint64_t replayed = 0;
+    if (mode == RELOAD_REPLAY) {
+        for (; replayed < frame; replayed++) {
+            kb_store_mask(&fresh.kb, input_mask_at(recorded, replayed));
+
+            ECpuTrap trap;
+            int retired;
+            if (timing != NULL)
+                trap = timing_frame(timing, &fresh);
+            else if (fuse != NULL)
+                trap = fuse_frame(&fresh, fuse, &retired);
+            else
+                trap = cpu_frame(&fresh);
+
+            if (trap != TRAP_NONE) {
+                ERR("%s at %03X while replaying frame %llu.",
+                    cpu_trap_str(trap), fresh.PC,
+                    (unsigned long long)replayed);
+                break;
+            }
+        }
+
+        /* If the replay stopped early, the keys after that frame never
+         * happened in the new ROM */
+        input_truncate(recorded, replayed);
+    } else {
+        /* Keep the keys that are being held */
+        fresh.kb.held = ctx->kb.held;
     }
 
-    /* Initialize the random seed for RND instruction */
-    srand(time(NULL));
+    /* Keep the `exec' of the context, which the debugger replaces while there
+     * are watchpoints. The profile and memory mode didn't change, so it's
+     * still valid for the new ROM. */
+    fresh.exec = ctx->exec;
+
+    if (live != NULL)
+        live_write_begin(&live->slots[0]);
+    memcpy(ctx, &fresh, sizeof(CpuCtx));
+    if (live != NULL)
+        live_write_end(&live->slots[0]);
+
+    fprintf(stderr, "Reloaded '%s' at frame %llu.\n", rom_filename,
+            (unsigned long long)replayed);
+    return replayed;
+}
+
+static void usage(const char* self) {
+    die("Usage: %s [options] <rom>\n"
+        "Options:\n"
+        "  -p PROFILE  Quirk profile: default, vip, chip48 or schip\n"
+        "  -t          Trap on out-of-range memory accesses, instead of "
+        "wrapping\n"
+        "  -c          Use the cycle-accurate COSMAC VIP timing\n"
+        "  -o FILE     Capture the frames into FILE (.raw, .pgm, .y4m, or a\n"
+        "              pattern like frame%%05d.png)\n"
+        "  -s SCALE    Scale of the captured frames (default: 1)\n"
+        "  -T GLYPHS   Draw in the terminal instead of a window, using half\n"
+        "              or braille characters\n"
+        "  -m          Print the timing metrics on exit, or on SIGUSR1\n"
+        "  -M FILE     Write the timing of each frame into a CSV file\n"
+        "  -S NAME     Export the state of the machine in the shared memory\n"
+        "              segment NAME, for external monitors\n"
+        "  -g          Start stopped, with the debugger on the standard input\n"
+        "  -G PORT     Start stopped, waiting for a GDB remote protocol\n"
+        "              client on PORT of localhost\n"
+        "  -A FILE     Run the ROM compiled with chip-8-aot.out into FILE\n"
+        "  -F          Run common instruction sequences as superinstructions\n"
+        "  -a FILE     Check the ROM with the analysis in FILE, written by\n"
+        "              chip-8-analyzer.out\n"
+        "  -q          Don't play the sound timer\n"
+        "  -r MODE     Reload the ROM when the file changes, and restart it\n"
+        "              (restart) or replay the keys up to the same frame\n"
+        "              (replay)\n"
+        "  -d FRAMES   Fade out cleared pixels over FRAMES frames, to hide\n"
+        "              the flicker of sprites\n"
+        "  -f          Scale the display to fill the window, instead of\n"
+        "              using integer scales\n"
+        "  -k THREADS  While waiting for a key, run each key ahead of time\n"
+        "              with THREADS threads\n",
+        self);
+}
+
+int main(int argc, char** argv) {
+    EQuirkProfile profile    = PROFILE_DEFAULT;
+    EMemMode mem_mode        = MEM_WRAP;
+    bool vip_timing          = false;
+    const char* capture_path = NULL;
+    int capture_scale        = 1;
+    bool use_term            = false;
+    ETermGlyphs term_glyphs  = TERM_HALF_BLOCK;
+    bool print_metrics       = false;
+    const char* metrics_path = NULL;
+    const char* live_name    = NULL;
+    bool use_debugger        = false;
+    int gdb_port             = 0;
+    const char* aot_path     = NULL;
+    bool use_fuse            = false;
+    const char* analysis     = NULL;
+    bool use_audio           = true;
+    EReloadMode reload_mode  = RELOAD_NONE;
+    int phosphor_frames      = 0;
+    int spec_threads         = 0;
+
+    const char* options = "p:tco:s:T:mM:S:gG:A:Fa:qr:d:fk:";
+
+    int opt;
+    while ((opt = getopt(argc, argv, options)) != -1) {
+        switch (opt) {
+            case 'p': {
+                profile = cpu_profile_from_str(optarg);
+                if (profile == PROFILE_COUNT)
+                    die("Unknown quirk profile: '%s'", optarg);
+            } break;
+
+            case 't': {
+                mem_mode = MEM_TRAP;
+            } break;
+
+            case 'c': {
+                vip_timing = true;
+            } break;
+
+            case 'o': {
+                capture_path = optarg;
+            } break;
+
+            case 's': {
+                capture_scale = atoi(optarg);
+            } break;
+
+            case 'T': {
+                use_term = true;
+                if (strcmp(optarg, "half") == 0)
+                    term_glyphs = TERM_HALF_BLOCK;
+                else if (strcmp(optarg, "braille") == 0)
+                    term_glyphs = TERM_BRAILLE;
+                else
+                    die("Unknown terminal glyphs: '%s'", optarg);
+            } break;
+
+            case 'm': {
+                print_metrics = true;
+            } break;
+
+            case 'M': {
+                metrics_path = optarg;
+            } break;
+
+            case 'S': {
+                live_name = optarg;
+            } break;
+
+            case 'g': {
+                use_debugger = true;
+            } break;
+
+            case 'G': {
+                gdb_port = atoi(optarg);
+                if (gdb_port <= 0 || gdb_port > 0xFFFF)
+                    die("Invalid port: '%s'", optarg);
+            } break;
+
+            case 'A': {
+                aot_path = optarg;
+            } break;
+
+            case 'F': {
+                use_fuse = true;
+            } break;
+
+            case 'a': {
+                analysis = optarg;
+            } break;
+
+            case 'q': {
+                use_audio = false;
+            } break;
+
+            case 'r': {
+                if (!watch_mode_from_str(optarg, &reload_mode))
+                    die("Unknown reload mode: '%s'", optarg);
+            } break;
+
+            case 'd': {
+                phosphor_frames = atoi(optarg);
+                if (phosphor_frames <= 0)
+                    die("Invalid number of frames: '%s'", optarg);
+            } break;
 
-    /* Initialize the cpu */
-    g_cpu_ctx = malloc(sizeof(CpuCtx));
+            case 'f': {
+                display_set_fill(true);
+            } break;
+
+            case 'k': {
+                spec_threads = atoi(optarg);
+                if (spec_threads <= 0)
+                    die("Invalid number of threads: '%s'", optarg);
+            } break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+        usage(argv[0]);
+
+    const char* rom_filename = argv[optind];
+
+    /* The debugger runs a frame at a time with a fixed number of
+     * instructions, and the console reads from the standard input */
+    if ((use_debugger || gdb_port != 0) && vip_timing)
+        die("The debugger can't be used with -c.");
+    if (use_debugger && use_term)
+        die("The debugger can't be used with -T.");
+    if (use_debugger && gdb_port != 0)
+        die("Only one of -g and -G can be used.");
+    if (aot_path != NULL && vip_timing)
+        die("Compiled ROMs can't be used with -c.");
+    if (use_fuse && (vip_timing || aot_path != NULL))
+        die("Superinstructions can't be used with -c or -A.");
+    if (reload_mode != RELOAD_NONE && (aot_path != NULL || analysis != NULL))
+        die("Compiled ROMs and analyses can't be used with -r.");
+    if (reload_mode == RELOAD_REPLAY && (use_debugger || gdb_port != 0))
+        die("The keys can't be replayed with the debugger.");
+    if (spec_threads > 0 && (vip_timing || aot_path != NULL || use_fuse ||
+                             use_debugger || gdb_port != 0))
+        die("Keys can't be run ahead of time with -c, -A, -F or the "
+            "debugger.");
+
+    if (use_term) {
+        /* SDL is only used for SDL_Delay */
+        if (SDL_Init(0) != 0)
+            die("Unable to start SDL.");
+
+        if (!term_init(term_glyphs))
+            die("Standard input is not a terminal.");
+
+        display_set_backend(DISPLAY_TERM);
+    } else {
+        init_window();
+    }
+
+    /* Optional persistence filter, only used when rendering */
+    static Phosphor phosphor;
+    if (phosphor_frames > 0) {
+        phosphor_init(&phosphor, phosphor_frames);
+        display_set_phosphor(&phosphor);
+    }
+
+    /* Initialize the cpu, along with its display and keyboard. With the live
+     * state export, the context is placed in the shared memory. */
+    if (live_name != NULL) {
+        live = live_create(live_name, 1);
+        if (live == NULL)
+            die("Could not export the state.");
+
+        g_cpu_ctx = &live->slots[0].ctx;
+    } else {
+        g_cpu_ctx = malloc(sizeof(CpuCtx));
+    }
     cpu_init(g_cpu_ctx);
 
+    /* Initialize the random seed for RND instruction. It's kept for reloading
+     * the ROM. */
+    const uint32_t seed = time(NULL);
+    cpu_seed_rng(g_cpu_ctx, seed);
+
+    /* Select the specialized interpreter for the quirk profile */
+    cpu_set_mem_mode(g_cpu_ctx, mem_mode);
+    cpu_set_profile(g_cpu_ctx, profile);
+
     /* Load the ROM file to memory */
-    cpu_load_rom(g_cpu_ctx, rom_filename);
+    if (!cpu_load_rom(g_cpu_ctx, rom_filename))
+        die("Could not load ROM.");
+
+    /* Refuse to run ROMs with known problems before they start */
+    static RomAnalysis an;
+    if (analysis != NULL) {
+        if (!analysis_load(&an, analysis))
+            die("Could not load the ROM analysis.");
+        if (!analysis_check(&an, g_cpu_ctx))
+            die("The ROM failed the analysis.");
+    }
+
+    /* Load the compiled ROM, which must match the loaded one */
+    Aot* aot = NULL;
+    if (aot_path != NULL) {
+        aot = aot_load(aot_path, g_cpu_ctx);
+        if (aot == NULL)
+            die("Could not load the compiled ROM.");
+    }
+
+    /* Decode cache for the superinstructions, filled while running */
+    FuseCache* fuse = NULL;
+    if (use_fuse) {
+        fuse = fuse_create();
+        if (fuse == NULL)
+            die("Could not allocate the decode cache.");
+
+        if (analysis != NULL)
+            fuse_predecode(fuse, g_cpu_ctx, &an);
+    }
+
+    /* Start the frame capture, if needed */
+    if (capture_path != NULL) {
+        ECaptureFormat format;
+        if (!capture_format_from_path(capture_path, &format))
+            die("Unknown capture format: '%s'", capture_path);
 
-    /* Initialize the display */
-    display_clear();
+        capture = capture_start(capture_path, format, capture_scale);
+        if (capture == NULL)
+            die("Could not start the capture.");
+    }
+
+    /* Optional debugger. It only slows down the emulation while it has
+     * breakpoints or watchpoints, or while it's stopped. */
+    static Debugger debugger;
+    static GdbStub gdb;
+    Debugger* dbg = NULL;
+    if (use_debugger || gdb_port != 0) {
+        dbg = &debugger;
+        debug_init(dbg, g_cpu_ctx);
+
+        if (gdb_port != 0 && !gdb_listen(&gdb, dbg, gdb_port))
+            die("Could not start the GDB stub.");
+    }
+
+    /* Watch the ROM for changes. With RELOAD_REPLAY, the keys of each frame
+     * are recorded for replaying them in the new ROM. */
+    RomWatch* watch = NULL;
+    if (reload_mode != RELOAD_NONE) {
+        watch = watch_start(rom_filename);
+        if (watch == NULL)
+            die("Could not watch the ROM file.");
+    }
+    InputScript recorded = { NULL, 0, 0 };
+    uint64_t frame       = 0;
+
+    /* Branches for each key while waiting for one */
+    Spec* spec = NULL;
+    if (spec_threads > 0) {
+        spec = spec_create(spec_threads);
+        if (spec == NULL)
+            die("Could not start the speculation threads.");
+    }
+
+    /* Sound timer output. Running without sound is not an error. */
+    Audio* audio = use_audio ? audio_open() : NULL;
+
+    /* State of the optional timing model */
+    VipTiming timing;
+    timing_init(&timing);
+
+    /* Timing of each phase of the main loop. A frame misses its deadline if
+     * it takes longer than the delay between frames. */
+    Metrics metrics;
+    metrics_init(&metrics, 1000000000 / FPS);
+    if (metrics_path != NULL && !metrics_open_csv(&metrics, metrics_path))
+        die("Could not open metrics file: '%s'", metrics_path);
+
+    if (print_metrics)
+        signal(SIGUSR1, on_sigusr1);
 
     /* Main loop */
     bool running = true;
     while (running) {
-        /* Parse SDL events */
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-                case SDL_QUIT: {
-                    running = false;
-                } break;
-
-                case SDL_KEYDOWN: {
-                    switch (event.key.keysym.scancode) {
-                        case SDL_SCANCODE_ESCAPE: {
-                            running = false;
-                        } break;
-
-                        /* clang-format off */
-                        case SDL_SCANCODE_1: kb_store(0x1, true); break;
-                        case SDL_SCANCODE_2: kb_store(0x2, true); break;
-                        case SDL_SCANCODE_3: kb_store(0x3, true); break;
-                        case SDL_SCANCODE_4: kb_store(0xC, true); break;
-                        case SDL_SCANCODE_Q: kb_store(0x4, true); break;
-                        case SDL_SCANCODE_W: kb_store(0x5, true); break;
-                        case SDL_SCANCODE_E: kb_store(0x6, true); break;
-                        case SDL_SCANCODE_R: kb_store(0xD, true); break;
-                        case SDL_SCANCODE_A: kb_store(0x7, true); break;
-                        case SDL_SCANCODE_S: kb_store(0x8, true); break;
-                        case SDL_SCANCODE_D: kb_store(0x9, true); break;
-                        case SDL_SCANCODE_F: kb_store(0xE, true); break;
-                        case SDL_SCANCODE_Z: kb_store(0xA, true); break;
-                        case SDL_SCANCODE_X: kb_store(0x0, true); break;
-                        case SDL_SCANCODE_C: kb_store(0xB, true); break;
-                        case SDL_SCANCODE_V: kb_store(0xF, true); break;
-
-                        /* clang-format on */
-                        default:
-                            break;
-                    }
-                } break;
-
-                case SDL_KEYUP: {
-                    switch (event.key.keysym.scancode) {
-                        /* clang-format off */
-                        case SDL_SCANCODE_1: kb_store(0x1, false); break;
-                        case SDL_SCANCODE_2: kb_store(0x2, false); break;
-                        case SDL_SCANCODE_3: kb_store(0x3, false); break;
-                        case SDL_SCANCODE_4: kb_store(0xC, false); break;
-                        case SDL_SCANCODE_Q: kb_store(0x4, false); break;
-                        case SDL_SCANCODE_W: kb_store(0x5, false); break;
-                        case SDL_SCANCODE_E: kb_store(0x6, false); break;
-                        case SDL_SCANCODE_R: kb_store(0xD, false); break;
-                        case SDL_SCANCODE_A: kb_store(0x7, false); break;
-                        case SDL_SCANCODE_S: kb_store(0x8, false); break;
-                        case SDL_SCANCODE_D: kb_store(0x9, false); break;
-                        case SDL_SCANCODE_F: kb_store(0xE, false); break;
-                        case SDL_SCANCODE_Z: kb_store(0xA, false); break;
-                        case SDL_SCANCODE_X: kb_store(0x0, false); break;
-                        case SDL_SCANCODE_C: kb_store(0xB, false); break;
-                        case SDL_SCANCODE_V: kb_store(0xF, false); break;
-
-                        /* clang-format on */
-                        default:
-                            break;
-                    }
-                } break;
-
-                default:
-                    break;
-            }
-        }
+        metrics_frame_start(&metrics);
+
+        /* Parse the input events into a copy of the keyboard, so the context
+         * only changes while the live state is being written */
+        Keyboard kb = g_cpu_ctx->kb;
+        running     = use_term ? term_poll_keys(&kb) : poll_events(&kb);
+
+        if (live != NULL)
+            live_write_begin(&live->slots[0]);
+        g_cpu_ctx->kb = kb;
+        if (live != NULL)
+            live_write_end(&live->slots[0]);
+
+        /* Handle the debugger commands. They can change the registers and
+         * memory at any point, and never block. */
+        if (live != NULL && dbg != NULL)
+            live_write_begin(&live->slots[0]);
+        if (use_debugger && !debug_console_poll(dbg))
+            running = false;
+        if (gdb_port != 0 && !gdb_poll(&gdb))
+            running = false;
+        if (live != NULL && dbg != NULL)
+            live_write_end(&live->slots[0]);
+
+        /* Reload the ROM if it changed, keeping the same window */
+        if (watch != NULL && watch_poll(watch))
+            frame = reload_rom(g_cpu_ctx, rom_filename, seed, reload_mode,
+                               &recorded, frame,
+                               vip_timing ? &timing : NULL, fuse);
+        if (reload_mode == RELOAD_REPLAY)
+            input_record(&recorded, frame, g_cpu_ctx->kb.held);
+
+        metrics_phase_end(&metrics, PHASE_EVENTS);
 
         /* Clear window */
-        set_render_color(g_renderer, 0x000000);
-        SDL_RenderClear(g_renderer);
+        if (!use_term) {
+            set_render_color(g_renderer, 0x000000);
+            SDL_RenderClear(g_renderer);
+        }
 
         /* Render and CPU frequency is the same, 60Hz */
-        cpu_frame(g_cpu_ctx);
+        const uint64_t instructions = timing.instructions;
+        if (live != NULL)
+            live_write_begin(&live->slots[0]);
+
+        ECpuTrap trap;
+        int retired = 0;
+        if (vip_timing)
+            trap = timing_frame(&timing, g_cpu_ctx);
+        else if (dbg != NULL && debug_is_active(dbg))
+            trap = debug_frame(dbg, &retired);
+        else if (aot != NULL)
+            trap = aot_frame(g_cpu_ctx, aot, &retired);
+        else if (fuse != NULL)
+            trap = fuse_frame(g_cpu_ctx, fuse, &retired);
+        else if (spec != NULL)
+            trap = spec_frame(spec, g_cpu_ctx, &retired);
+        else
+            trap = cpu_frame_count(g_cpu_ctx, &retired);
 
-        /* Render the virtual display into the SDL window */
-        display_render();
+        /* The debugger might change the memory at any time */
+        if (aot != NULL && dbg != NULL)
+            aot_invalidate(aot);
+        if (fuse != NULL && dbg != NULL)
+            fuse_invalidate(fuse);
+
+        /* With the debugger, traps just stop the machine */
+        if (trap != TRAP_NONE && dbg == NULL)
+            die("%s at %03X", cpu_trap_str(trap), g_cpu_ctx->PC);
+        if (trap != TRAP_NONE && !dbg->stopped) {
+            dbg->trap = trap;
+            debug_stop(dbg, STOP_TRAP);
+        }
+
+        frame++;
+
+        if (live != NULL) {
+            live->slots[0].frame++;
+            live_write_end(&live->slots[0]);
+        }
+
+        /* Queue the sound of this frame. A stopped machine is silent. */
+        if (audio != NULL)
+            audio_frame(audio, g_cpu_ctx->sound &&
+                                 (dbg == NULL || !dbg->stopped));
+
+        metrics_phase_end(&metrics, PHASE_CPU);
+
+        /* Queue the finished frame for the capture thread */
+        if (capture != NULL)
+            capture_frame(capture, g_cpu_ctx->fb);
+
+        /* Render the virtual display into the SDL window or the terminal */
+        display_render(g_cpu_ctx->fb);
+        metrics_phase_end(&metrics, PHASE_RENDER);
 
         /* Send to renderer and delay depending on FPS */
-        SDL_RenderPresent(g_renderer);
+        if (!use_term)
+            SDL_RenderPresent(g_renderer);
+        metrics_phase_end(&metrics, PHASE_PRESENT);
+
         SDL_Delay(1000 / FPS);
+        metrics_phase_end(&metrics, PHASE_DELAY);
+
+        metrics_frame_end(&metrics, vip_timing
+                                      ? timing.instructions - instructions
+                                      : (uint64_t)retired);
+
+        if (metrics_requested) {
+            metrics_requested = 0;
+            metrics_print(&metrics, stderr);
+        }
+    }
+
+    if (print_metrics) {
+        metrics_print(&metrics, stderr);
+        if (spec != NULL)
+            spec_print(spec, stderr);
     }
+    metrics_close(&metrics);
+
+    aot_free(aot);
+    fuse_destroy(fuse);
+    audio_close(audio);
+    spec_destroy(spec);
+    watch_stop(watch);
+    input_free(&recorded);
 
-    cpu_free(g_cpu_ctx);
+    if (dbg != NULL)
+        debug_free(dbg);
+    if (gdb_port != 0)
+        gdb_close(&gdb);
 
-    SDL_DestroyRenderer(g_renderer);
-    SDL_DestroyWindow(g_window);
+    if (capture != NULL)
+        capture_stop(capture);
+
+    if (live != NULL)
+        live_close(live);
+    else
+        cpu_free(g_cpu_ctx);
+
+    term_restore();
+
+    display_free();
+    if (g_renderer != NULL)
+        SDL_DestroyRenderer(g_renderer);
+    if (g_window != NULL)
+        SDL_DestroyWindow(g_window);
     SDL_Quit();
 
     return 0;
@@ -0,0 +1,163 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "include/metrics.h"
+
+static const char* phase_names[PHASE_COUNT] = {
+    [PHASE_EVENTS]  = "events",
+    [PHASE_CPU]     = "cpu",
+    [PHASE_RENDER]  = "render",
+    [PHASE_PRESENT] = "present",
+    [PHASE_DELAY]   = "delay",
+};
+
+/* Add a duration to a histogram */
+static void histogram_add(MetricsHistogram* hist, uint64_t ns) {
+    if (hist->count == 0 || ns < hist->min_ns)
+        hist->min_ns = ns;
+    if (ns > hist->max_ns)
+        hist->max_ns = ns;
+
+    hist->count++;
+    hist->total_ns += ns;
+
+    /* Index of the highest bit of the microseconds, or 0 */
+    const uint64_t us = ns / 1000;
+    int bucket = (us == 0) ? 0 : 63 - __builtin_clzll(us);
+    if (bucket >= METRICS_BUCKETS)
+        bucket = METRICS_BUCKETS - 1;
+
+    hist->buckets[bucket]++;
+}
+
+/* Print a histogram, skipping the empty buckets */
+static void histogram_print(const MetricsHistogram* hist, const char* name,
+                            FILE* fp) {
+    if (hist->count == 0) {
+        fprintf(fp, "  %-8s no samples\n", name);
+        return;
+    }
+
+    fprintf(fp, "  %-8s avg %9.1fus  min %9.1fus  max %9.1fus\n", name,
+            hist->total_ns / 1000.0 / hist->count, hist->min_ns / 1000.0,
+            hist->max_ns / 1000.0);
+
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        if (hist->buckets[i] == 0)
+            continue;
+
+        /* Lower bound of the bucket, and upper bound if it has one */
+        char range[48];
+        const unsigned long long low = (i == 0) ? 0 : 1ULL << i;
+        if (i == METRICS_BUCKETS - 1)
+            snprintf(range, sizeof(range), "%llu+ us", low);
+        else
+            snprintf(range, sizeof(range), "%llu-%llu us", low,
+                     1ULL << (i + 1));
+
+        fprintf(fp, "    %20s %10llu  %5.1f%%\n", range,
+                (unsigned long long)hist->buckets[i],
+                100.0 * hist->buckets[i] / hist->count);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+void metrics_init(Metrics* metrics, uint64_t deadline_ns) {
+    memset(metrics, 0, sizeof(Metrics));
+    metrics->deadline_ns = deadline_ns;
+    metrics->start_ns    = metrics_now();
+}
+
+bool metrics_open_csv(Metrics* metrics, const char* path) {
+    metrics->csv = fopen(path, "w");
+    if (metrics->csv == NULL)
+        return false;
+
+    fprintf(metrics->csv, "frame");
+    for (int i = 0; i < PHASE_COUNT; i++)
+        fprintf(metrics->csv, ",%s_ns", phase_names[i]);
+    fprintf(metrics->csv, ",instructions\n");
+
+    return true;
+}
+
+void metrics_close(Metrics* metrics) {
+    if (metrics->csv != NULL) {
+        fclose(metrics->csv);
+        metrics->csv = NULL;
+    }
+}
+
+void metrics_frame_start(Metrics* metrics) {
+    const uint64_t now = metrics_now();
+
+    /* The whole frame is measured from start to start, so it includes the
+     * time between `metrics_frame_end' and the next frame. */
+    if (metrics->frame_ns != 0)
+        histogram_add(&metrics->frame, now - metrics->frame_ns);
+
+    metrics->frame_ns = now;
+    metrics->last_ns  = now;
+    memset(metrics->current_ns, 0, sizeof(metrics->current_ns));
+}
+
+void metrics_phase_end(Metrics* metrics, EMetricsPhase phase) {
+    const uint64_t now = metrics_now();
+    const uint64_t ns  = now - metrics->last_ns;
+
+    histogram_add(&metrics->phases[phase], ns);
+    metrics->current_ns[phase] = ns;
+    metrics->last_ns           = now;
+}
+
+void metrics_frame_end(Metrics* metrics, uint64_t instructions) {
+    metrics->frames++;
+    metrics->instructions += instructions;
+
+    /* Everything but the delay is work that has to fit in a frame */
+    const uint64_t work_ns =
+      metrics->last_ns - metrics->frame_ns - metrics->current_ns[PHASE_DELAY];
+    if (work_ns > metrics->deadline_ns)
+        metrics->missed++;
+
+    if (metrics->csv != NULL) {
+        fprintf(metrics->csv, "%llu", (unsigned long long)metrics->frames - 1);
+        for (int i = 0; i < PHASE_COUNT; i++)
+            fprintf(metrics->csv, ",%llu",
+                    (unsigned long long)metrics->current_ns[i]);
+        fprintf(metrics->csv, ",%llu\n", (unsigned long long)instructions);
+    }
+}
+
+void metrics_print(const Metrics* metrics, FILE* fp) {
+    const double secs = (metrics_now() - metrics->start_ns) / 1e9;
+
+    fprintf(fp, "Metrics: %llu frames in %.3fs (%.1f FPS)\n",
+            (unsigned long long)metrics->frames, secs,
+            (secs > 0) ? metrics->frames / secs : 0.0);
+
+    /* Instructions per second of the emulated machine, and the host time
+     * spent running them */
+    const MetricsHistogram* cpu = &metrics->phases[PHASE_CPU];
+    fprintf(fp, "Instructions: %llu (%.0f/s, %.1f MIPS while running)\n",
+            (unsigned long long)metrics->instructions,
+            (secs > 0) ? metrics->instructions / secs : 0.0,
+            (cpu->total_ns > 0) ? metrics->instructions * 1e3 / cpu->total_ns
+                                : 0.0);
+
+    fprintf(fp, "Missed deadlines: %llu (%.1f%%), deadline %.1fus\n",
+            (unsigned long long)metrics->missed,
+            (metrics->frames > 0) ? 100.0 * metrics->missed / metrics->frames
+                                  : 0.0,
+            metrics->deadline_ns / 1000.0);
+
+    for (int i = 0; i < PHASE_COUNT; i++)
+        histogram_print(&metrics->phases[i], phase_names[i], fp);
+    histogram_print(&metrics->frame, "frame", fp);
+
+    fflush(fp);
+}
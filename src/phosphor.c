@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "include/display.h"
+#include "include/phosphor.h"
+
+/* Load and store vectors with `memcpy', since the filter might not be
+ * aligned */
+#define LOAD_VEC(DST, SRC)  memcpy(&(DST), (SRC), sizeof(PhosphorVec))
+#define STORE_VEC(DST, SRC) memcpy((DST), &(SRC), sizeof(PhosphorVec))
+
+void phosphor_init(Phosphor* ph, int frames) {
+    memset(ph->intensity, 0, sizeof(ph->intensity));
+
+    if (frames < 1)
+        frames = 1;
+    if (frames > 255)
+        frames = 255;
+    ph->step = (255 + frames - 1) / frames;
+}
+
+__attribute__((target_clones("avx2", "default"))) void
+phosphor_update(Phosphor* ph, const uint64_t* fb) {
+    const PhosphorVec step = (PhosphorVec){ 0 } + ph->step;
+
+    /* Bit of each pixel inside its byte of the row, MSB first */
+    const PhosphorVec bits = {
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+    };
+
+    /* Byte of the row of each pixel, for the left and right halves */
+    const PhosphorVec bytes[DISP_W / PHOSPHOR_VEC] = {
+        { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+          2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3 },
+        { 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5,
+          6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7 },
+    };
+
+    for (int y = 0; y < DISP_H; y++) {
+        /* The bytes of the row, with the left-most one first. Built with
+         * shifts, so it doesn't depend on the byte order of the host. */
+        PhosphorVec row = { 0 };
+        for (int i = 0; i < 8; i++)
+            row[i] = (fb[y] >> (56 - 8 * i)) & 0xFF;
+
+        for (int half = 0; half < DISP_W / PHOSPHOR_VEC; half++) {
+            uint8_t* dst = &ph->intensity[y][half * PHOSPHOR_VEC];
+
+            /* 0xFF for the lit pixels, 0 for the rest */
+            const PhosphorVec lit =
+              (PhosphorVec)((__builtin_shuffle(row, bytes[half]) & bits) != 0);
+
+            /* Saturating subtraction, and the maximum with the lit pixels,
+             * which are either 0 or 255 */
+            PhosphorVec cur;
+            LOAD_VEC(cur, dst);
+            cur = ((cur - step) & (PhosphorVec)(cur > step)) | lit;
+            STORE_VEC(dst, cur);
+        }
+    }
+}
+
+void phosphor_threshold(const Phosphor* ph, uint64_t* fb) {
+    for (int y = 0; y < DISP_H; y++) {
+        uint64_t row = 0;
+        for (int x = 0; x < DISP_W; x++)
+            row = (row << 1) | (ph->intensity[y][x] >= 0x80);
+
+        fb[y] = row;
+    }
+}
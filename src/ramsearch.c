@@ -0,0 +1,156 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/util.h"
+#include "include/cpu.h"
+#include "include/ramsearch.h"
+
+/* Number of snapshots shown for each candidate by `ram_search_print' */
+#define PRINT_SNAPSHOTS 8
+
+static const char* const predicate_names[RAM_PREDICATE_COUNT] = {
+    [RAM_CHANGED] = "changed",     [RAM_UNCHANGED] = "unchanged",
+    [RAM_INCREASED] = "increased", [RAM_DECREASED] = "decreased",
+    [RAM_EQUAL] = "eq",            [RAM_NOT_EQUAL] = "ne",
+};
+
+/* Load and store vectors with `memcpy', since the snapshots and the
+ * candidates (e.g. inside a Debugger) might not be aligned */
+#define LOAD_VEC(DST, SRC)  memcpy(&(DST), (SRC), sizeof(RamVec))
+#define STORE_VEC(DST, SRC) memcpy((DST), &(SRC), sizeof(RamVec))
+
+static uint32_t count_candidates(const RamSearch* rs) {
+    /* Each lane adds at most MEM_SZ / RAM_SEARCH_VEC ones, which fits in a
+     * byte */
+    RamVec sum = { 0 };
+    for (int i = 0; i < MEM_SZ; i += RAM_SEARCH_VEC) {
+        RamVec v;
+        LOAD_VEC(v, &rs->candidates[i]);
+        sum += v & 1;
+    }
+
+    uint32_t total = 0;
+    for (int i = 0; i < RAM_SEARCH_VEC; i++)
+        total += sum[i];
+
+    return total;
+}
+
+/* Clear the candidates where the predicate is false, RAM_SEARCH_VEC bytes at
+ * a time */
+__attribute__((target_clones("avx2", "default"))) static void
+filter_mem(uint8_t* candidates, const uint8_t* a, const uint8_t* b,
+           ERamPredicate pred, uint8_t value) {
+    const RamVec val = (RamVec){ 0 } + value;
+
+    for (int i = 0; i < MEM_SZ; i += RAM_SEARCH_VEC) {
+        RamVec va, vb, cur;
+        LOAD_VEC(va, &a[i]);
+        LOAD_VEC(vb, &b[i]);
+        LOAD_VEC(cur, &candidates[i]);
+
+        /* Comparisons set all the bits of the lanes where they are true */
+        RamVec keep;
+        switch (pred) {
+            case RAM_CHANGED:
+                keep = (RamVec)(vb != va);
+                break;
+            case RAM_UNCHANGED:
+                keep = (RamVec)(vb == va);
+                break;
+            case RAM_INCREASED:
+                keep = (RamVec)(vb > va);
+                break;
+            case RAM_DECREASED:
+                keep = (RamVec)(vb < va);
+                break;
+            case RAM_EQUAL:
+                keep = (RamVec)(vb == val);
+                break;
+            case RAM_NOT_EQUAL:
+                keep = (RamVec)(vb != val);
+                break;
+            default:
+                keep = (RamVec){ 0 } + 0xFF;
+                break;
+        }
+
+        cur &= keep;
+        STORE_VEC(&candidates[i], cur);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+void ram_search_init(RamSearch* rs) {
+    rs->snapshots     = NULL;
+    rs->snapshots_cap = 0;
+    ram_search_reset(rs);
+}
+
+void ram_search_free(RamSearch* rs) {
+    free(rs->snapshots);
+    rs->snapshots     = NULL;
+    rs->num_snapshots = 0;
+    rs->snapshots_cap = 0;
+}
+
+void ram_search_reset(RamSearch* rs) {
+    memset(rs->candidates, 0xFF, sizeof(rs->candidates));
+    rs->num_candidates = MEM_SZ;
+    rs->num_snapshots  = 0;
+}
+
+uint32_t ram_search_snapshot(RamSearch* rs, const CpuCtx* ctx) {
+    if (rs->num_snapshots >= rs->snapshots_cap) {
+        rs->snapshots_cap = (rs->snapshots_cap == 0) ? 16
+                                                     : rs->snapshots_cap * 2;
+        rs->snapshots =
+          realloc(rs->snapshots, rs->snapshots_cap * sizeof(rs->snapshots[0]));
+    }
+
+    memcpy(rs->snapshots[rs->num_snapshots], ctx->mem, MEM_SZ);
+    return rs->num_snapshots++;
+}
+
+uint32_t ram_search_filter(RamSearch* rs, ERamPredicate pred, uint32_t old,
+                           uint32_t new, uint8_t value) {
+    filter_mem(rs->candidates, rs->snapshots[old], rs->snapshots[new], pred,
+               value);
+
+    rs->num_candidates = count_candidates(rs);
+    return rs->num_candidates;
+}
+
+ERamPredicate ram_predicate_from_str(const char* name) {
+    for (int i = 0; i < RAM_PREDICATE_COUNT; i++)
+        if (strcmp(predicate_names[i], name) == 0)
+            return i;
+
+    return RAM_PREDICATE_COUNT;
+}
+
+void ram_search_print(const RamSearch* rs, size_t max, FILE* fp) {
+    const uint32_t first = (rs->num_snapshots > PRINT_SNAPSHOTS)
+                             ? rs->num_snapshots - PRINT_SNAPSHOTS
+                             : 0;
+
+    size_t printed = 0;
+    for (int addr = 0; addr < MEM_SZ && printed < max; addr++) {
+        if (!rs->candidates[addr])
+            continue;
+
+        fprintf(fp, "%03X:", addr);
+        for (uint32_t i = first; i < rs->num_snapshots; i++)
+            fprintf(fp, " %02X", rs->snapshots[i][addr]);
+        fputc('\n', fp);
+
+        printed++;
+    }
+
+    if (rs->num_candidates > printed)
+        fprintf(fp, "... %zu more\n", (size_t)rs->num_candidates - printed);
+}
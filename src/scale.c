@@ -0,0 +1,93 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/display.h"
+#include "include/scale.h"
+
+/* Load and store vectors with `memcpy', since the texture rows are not
+ * aligned to the size of a vector */
+#define LOAD_VEC(DST, SRC)  memcpy(&(DST), (SRC), sizeof(ScaleVec))
+#define STORE_VEC(DST, SRC) memcpy((DST), &(SRC), sizeof(ScaleVec))
+
+bool scale_init(Scaler* sc, int w, int h) {
+    sc->w     = w;
+    sc->h     = h;
+    sc->src_x = malloc(w * sizeof(uint32_t));
+    sc->src_y = malloc(h * sizeof(uint8_t));
+    if (sc->src_x == NULL || sc->src_y == NULL) {
+        scale_free(sc);
+        return false;
+    }
+
+    for (int x = 0; x < w; x++)
+        sc->src_x[x] = (uint64_t)x * DISP_W / w;
+    for (int y = 0; y < h; y++)
+        sc->src_y[y] = (uint64_t)y * DISP_H / h;
+
+    return true;
+}
+
+void scale_free(Scaler* sc) {
+    free(sc->src_x);
+    free(sc->src_y);
+    sc->src_x = NULL;
+    sc->src_y = NULL;
+}
+
+/* Expand a packed 1-bit row into a row of output pixels */
+__attribute__((target_clones("avx2", "default"))) static void
+expand_row(const Scaler* sc, uint64_t row, uint32_t set, uint32_t unset,
+           uint32_t* dst) {
+    /* Column N of the framebuffer is bit (31 - N % 32) of one of the halves
+     * of the row */
+    const ScaleVec hi    = (ScaleVec){ 0 } + (uint32_t)(row >> 32);
+    const ScaleVec lo    = (ScaleVec){ 0 } + (uint32_t)row;
+    const ScaleVec v_set = (ScaleVec){ 0 } + set;
+    const ScaleVec v_off = (ScaleVec){ 0 } + unset;
+
+    int x = 0;
+    for (; x + SCALE_VEC <= sc->w; x += SCALE_VEC) {
+        ScaleVec col;
+        LOAD_VEC(col, &sc->src_x[x]);
+
+        const ScaleVec left = (ScaleVec)(col < 32);
+        const ScaleVec word = (hi & left) | (lo & ~left);
+        const ScaleVec lit  = -((word >> (31 - (col & 31))) & 1);
+
+        const ScaleVec out = (v_set & lit) | (v_off & ~lit);
+        STORE_VEC(&dst[x], out);
+    }
+
+    for (; x < sc->w; x++)
+        dst[x] = display_get_pixel(&row, sc->src_x[x], 0) ? set : unset;
+}
+
+/* Expand a row of intensities into gray output pixels */
+static void expand_gray_row(const Scaler* sc, const uint8_t* intensity,
+                            uint32_t* dst) {
+    for (int x = 0; x < sc->w; x++)
+        dst[x] = 0xFF000000 | (intensity[sc->src_x[x]] * 0x010101);
+}
+
+void scale_frame(const Scaler* sc, const uint64_t* fb,
+                 const uint8_t (*intensity)[DISP_W], uint32_t set,
+                 uint32_t unset, void* pixels, int pitch) {
+    uint8_t* out = pixels;
+
+    for (int y = 0; y < sc->h; y++) {
+        uint32_t* dst = (uint32_t*)&out[y * pitch];
+
+        /* Most output rows sample the same row as the one above */
+        if (y > 0 && sc->src_y[y] == sc->src_y[y - 1]) {
+            memcpy(dst, &out[(y - 1) * pitch], sc->w * sizeof(uint32_t));
+            continue;
+        }
+
+        if (intensity != NULL)
+            expand_gray_row(sc, intensity[sc->src_y[y]], dst);
+        else
+            expand_row(sc, fb[sc->src_y[y]], set, unset, dst);
+    }
+}
@@ -0,0 +1,348 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "include/cpu.h"
+#include "include/keyboard.h"
+#include "include/sched.h"
+
+/* The DT loop has 3 instructions, and `unpark' assumes that each frame runs
+ * the whole loop at least once. */
+#if CYCLES_PER_FRAME < 3
+#error "The DT loop must run at least once per frame"
+#endif
+
+typedef struct SchedWorker {
+    pthread_t thread;
+    Sched* sched;
+    int index;
+} SchedWorker;
+
+/*----------------------------------------------------------------------------*/
+
+/* Read the opcode at any address, wrapping around the memory */
+static inline uint16_t read_opcode(const CpuCtx* ctx, uint16_t addr) {
+    return (ctx->mem[addr & MEM_MASK] << 8) | ctx->mem[(addr + 1) & MEM_MASK];
+}
+
+/* Check if the DT loop (see sched.h) starts at `addr' */
+static bool is_spin_loop(const CpuCtx* ctx, uint16_t addr) {
+    const uint16_t ld = read_opcode(ctx, addr);
+    const uint16_t se = read_opcode(ctx, addr + 2);
+    const uint16_t jp = read_opcode(ctx, addr + 4);
+
+    return (ld & 0xF0FF) == 0xF007 && se == (0x3000 | (ld & 0x0F00)) &&
+           jp == (0x1000 | addr);
+}
+
+/* Start and finish changing the context of an instance, for the live state
+ * export. `frame' is the number of frames the context has run. */
+static inline void begin_write(SchedInstance* inst) {
+    if (inst->live != NULL)
+        live_write_begin(inst->live);
+}
+
+static inline void end_write(SchedInstance* inst, uint64_t frame) {
+    if (inst->live != NULL) {
+        inst->live->frame = frame;
+        live_write_end(inst->live);
+    }
+}
+
+/* Remove an instance from its slot of the timer wheel */
+static void wheel_remove(Sched* sched, uint32_t i) {
+    for (int32_t* link = sched->wheel; link < sched->wheel + SCHED_WHEEL_SZ;
+         link++) {
+        for (int32_t* cur = link; *cur >= 0;
+             cur = &sched->instances[*cur].wheel_next) {
+            if (*cur == (int32_t)i) {
+                *cur = sched->instances[i].wheel_next;
+                return;
+            }
+        }
+    }
+}
+
+/* Make a parked instance runnable again. The frames skipped since it was
+ * parked only changed the timers and, for the DT loop, the position in the
+ * loop and the register that reads DT. */
+static void unpark(Sched* sched, uint32_t i) {
+    SchedInstance* inst = &sched->instances[i];
+    CpuCtx* ctx         = inst->ctx;
+    const uint64_t k    = sched->frame - inst->parked_frame;
+
+    begin_write(inst);
+
+    if (inst->state == SCHED_PARKED_TIMER && k > 0) {
+        /* The loop ran CYCLES_PER_FRAME instructions on each skipped frame,
+         * and DT was never zero, so it never exited. The last "LD Vx, DT" read
+         * DT before the last decrement. */
+        const int x   = ctx->mem[inst->spin_addr] & 0xF;
+        const int pos = ((ctx->PC - inst->spin_addr) & MEM_MASK) / 2;
+
+        ctx->V[x] = ctx->DT - k + 1;
+        ctx->PC   = (inst->spin_addr + (pos + CYCLES_PER_FRAME * k) % 3 * 2) &
+                  MEM_MASK;
+    }
+
+    ctx->DT = (ctx->DT > k) ? ctx->DT - k : 0;
+    ctx->ST = (ctx->ST > k) ? ctx->ST - k : 0;
+
+    end_write(inst, sched->frame);
+
+    inst->state                              = SCHED_RUNNABLE;
+    sched->runnable[sched->runnable_num++] = i;
+}
+
+/* After running a frame, park the instance if the next frames are not going to
+ * do anything but waiting. Returns true if it was parked. */
+static bool try_park(Sched* sched, uint32_t i) {
+    SchedInstance* inst = &sched->instances[i];
+    const CpuCtx* ctx   = inst->ctx;
+
+    /* Waiting for a key, "LD Vx, K" runs again on each cycle */
+    if (kb_get_status(&ctx->kb) == KB_WAITING &&
+        (cpu_fetch(ctx) & 0xF0FF) == 0xF00A) {
+        inst->state        = SCHED_PARKED_KEY;
+        inst->parked_frame = sched->frame;
+        return true;
+    }
+
+    /* Spinning on DT. It has to be at least 2, so the instance is woken up
+     * one frame before it expires, and leaves the loop by itself. */
+    if (ctx->DT < 2)
+        return false;
+
+    for (int pos = 0; pos < 3; pos++) {
+        const uint16_t addr = (ctx->PC - pos * 2) & MEM_MASK;
+        if (!is_spin_loop(ctx, addr))
+            continue;
+
+        /* Right before the SE, Vx has to be non-zero, like in the loop */
+        if (pos == 1 && ctx->V[ctx->mem[addr] & 0xF] == 0)
+            return false;
+
+        const int slot = (sched->frame + ctx->DT - 1) % SCHED_WHEEL_SZ;
+
+        inst->state        = SCHED_PARKED_TIMER;
+        inst->parked_frame = sched->frame;
+        inst->spin_addr    = addr;
+        inst->wheel_next   = sched->wheel[slot];
+        sched->wheel[slot] = i;
+        return true;
+    }
+
+    return false;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* Run the instances of a queue, taking SCHED_CHUNK at a time. Other workers
+ * might be taking them at the same time. */
+static void run_queue(Sched* sched, SchedQueue* queue) {
+    for (;;) {
+        uint32_t i = __atomic_fetch_add(&queue->next, SCHED_CHUNK,
+                                        __ATOMIC_RELAXED);
+        if (i >= queue->end)
+            return;
+
+        const uint32_t end =
+          (i + SCHED_CHUNK < queue->end) ? i + SCHED_CHUNK : queue->end;
+        for (; i < end; i++) {
+            SchedInstance* inst = &sched->instances[sched->runnable[i]];
+            begin_write(inst);
+            inst->trap = cpu_frame(inst->ctx);
+            end_write(inst, sched->frame + 1);
+        }
+    }
+}
+
+/* Run the own queue of a worker, and then steal from the others */
+static void run_worker(Sched* sched, int index) {
+    for (int i = 0; i < sched->threads; i++)
+        run_queue(sched, &sched->queues[(index + i) % sched->threads]);
+}
+
+static void* worker_main(void* arg) {
+    SchedWorker* worker = arg;
+    Sched* sched        = worker->sched;
+
+    for (;;) {
+        pthread_barrier_wait(&sched->start);
+        if (sched->quit)
+            break;
+
+        run_worker(sched, worker->index);
+        pthread_barrier_wait(&sched->done);
+    }
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool sched_init(Sched* sched, int threads) {
+    memset(sched, 0, sizeof(Sched));
+
+    if (threads < 1)
+        threads = 1;
+    sched->threads = threads;
+
+    for (int i = 0; i < SCHED_WHEEL_SZ; i++)
+        sched->wheel[i] = -1;
+
+    void* queues;
+    if (posix_memalign(&queues, sizeof(SchedQueue),
+                       threads * sizeof(SchedQueue)) != 0)
+        return false;
+    sched->queues = queues;
+
+    if (threads == 1)
+        return true;
+
+    pthread_barrier_init(&sched->start, NULL, threads);
+    pthread_barrier_init(&sched->done, NULL, threads);
+
+    /* The caller of `sched_frame' is worker 0 */
+    sched->workers = calloc(threads, sizeof(SchedWorker));
+    for (int i = 1; i < threads; i++) {
+        sched->workers[i].sched = sched;
+        sched->workers[i].index = i;
+        pthread_create(&sched->workers[i].thread, NULL, worker_main,
+                       &sched->workers[i]);
+    }
+
+    return true;
+}
+
+void sched_free(Sched* sched) {
+    if (sched->threads > 1) {
+        sched->quit = true;
+        pthread_barrier_wait(&sched->start);
+
+        for (int i = 1; i < sched->threads; i++)
+            pthread_join(sched->workers[i].thread, NULL);
+
+        pthread_barrier_destroy(&sched->start);
+        pthread_barrier_destroy(&sched->done);
+        free(sched->workers);
+    }
+
+    free(sched->queues);
+    free(sched->instances);
+    free(sched->runnable);
+}
+
+uint32_t sched_add(Sched* sched, CpuCtx* ctx) {
+    if (sched->num >= sched->cap) {
+        sched->cap       = (sched->cap == 0) ? 64 : sched->cap * 2;
+        sched->instances = realloc(sched->instances,
+                                   sched->cap * sizeof(SchedInstance));
+        sched->runnable =
+          realloc(sched->runnable, sched->cap * sizeof(uint32_t));
+    }
+
+    const uint32_t i    = sched->num++;
+    SchedInstance* inst = &sched->instances[i];
+    inst->ctx           = ctx;
+    inst->state         = SCHED_RUNNABLE;
+    inst->trap          = TRAP_NONE;
+    inst->wheel_next    = -1;
+    inst->live          = NULL;
+
+    sched->runnable[sched->runnable_num++] = i;
+    return i;
+}
+
+void sched_set_live(Sched* sched, uint32_t i, LiveSlot* slot) {
+    sched->instances[i].live = slot;
+}
+
+void sched_key(Sched* sched, uint32_t i, uint16_t mask) {
+    SchedInstance* inst = &sched->instances[i];
+
+    /* The keyboard is not a new frame, so the frame number stays */
+    begin_write(inst);
+    kb_store_mask(&inst->ctx->kb, mask);
+    if (inst->live != NULL)
+        live_write_end(inst->live);
+
+    /* Releasing a key while waiting stores it for "LD Vx, K" */
+    if (inst->state == SCHED_PARKED_KEY &&
+        kb_get_status(&inst->ctx->kb) != KB_WAITING)
+        unpark(sched, i);
+}
+
+void sched_wake(Sched* sched, uint32_t i) {
+    switch (sched->instances[i].state) {
+        case SCHED_PARKED_TIMER:
+            wheel_remove(sched, i);
+            unpark(sched, i);
+            break;
+
+        case SCHED_PARKED_KEY:
+            unpark(sched, i);
+            break;
+
+        default:
+            break;
+    }
+}
+
+uint32_t sched_frame(Sched* sched) {
+    /* Wake up the instances whose DT is about to expire. Since they wait less
+     * than SCHED_WHEEL_SZ frames, they are all for this frame. */
+    const int slot = sched->frame % SCHED_WHEEL_SZ;
+    while (sched->wheel[slot] >= 0) {
+        const int32_t i    = sched->wheel[slot];
+        sched->wheel[slot] = sched->instances[i].wheel_next;
+        unpark(sched, i);
+    }
+
+    /* Split the runnable instances between the workers */
+    const uint32_t num = sched->runnable_num;
+    for (int i = 0; i < sched->threads; i++) {
+        SchedQueue* queue = &sched->queues[i];
+        queue->start      = (uint64_t)num * i / sched->threads;
+        queue->end        = (uint64_t)num * (i + 1) / sched->threads;
+        queue->next       = queue->start;
+    }
+
+    if (sched->threads > 1) {
+        pthread_barrier_wait(&sched->start);
+        run_worker(sched, 0);
+        pthread_barrier_wait(&sched->done);
+    } else {
+        run_worker(sched, 0);
+    }
+
+    sched->frames_run += num;
+    sched->frame++;
+
+    /* Keep the instances that are still runnable, in the same order */
+    uint32_t kept = 0;
+    for (uint32_t j = 0; j < num; j++) {
+        const uint32_t i    = sched->runnable[j];
+        SchedInstance* inst = &sched->instances[i];
+
+        if (inst->trap != TRAP_NONE)
+            inst->state = SCHED_STOPPED;
+        else if (!try_park(sched, i))
+            sched->runnable[kept++] = i;
+    }
+    sched->runnable_num = kept;
+
+    return num;
+}
+
+uint32_t sched_count(const Sched* sched, ESchedState state) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < sched->num; i++)
+        if (sched->instances[i].state == state)
+            count++;
+
+    return count;
+}
@@ -0,0 +1,450 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "include/cpu.h"
+#include "include/display.h"
+#include "include/keyboard.h"
+#include "include/statehash.h"
+#include "include/search.h"
+
+/* State waiting to be expanded */
+typedef struct SearchNode {
+    CpuCtx ctx;
+    StateHash hash;
+
+    /* Index of the step that led here in `Search.steps' */
+    uint32_t step;
+
+    /* Order in the queue: lowest score first, then lowest depth, then the
+     * order in which they were added */
+    uint32_t score;
+    uint32_t depth;
+    uint64_t seq;
+} SearchNode;
+
+/* Step of a sequence, as a tree of all the steps explored */
+typedef struct SearchStep {
+    uint32_t parent;
+    uint16_t mask;
+} SearchStep;
+
+/* Result of running a step from a node of the batch */
+typedef struct SearchChild {
+    SearchNode* node;
+
+    /* Frame of the step where the targets were met, starting at 1, or 0 */
+    int goal_frame;
+
+    /* Hash of the state, checked against the visited set when merging */
+    uint64_t hash;
+} SearchChild;
+
+typedef struct Search {
+    const SearchParams* params;
+
+    /* Queue of nodes, as a binary heap */
+    SearchNode** heap;
+    uint32_t heap_num, heap_cap;
+    uint64_t next_seq;
+
+    /* Every step explored. The first one is the initial state. */
+    SearchStep* steps;
+    uint32_t steps_num, steps_cap;
+
+    /* Hashes of the visited states, with open addressing. 0 is empty. */
+    uint64_t* visited;
+    uint64_t visited_mask;
+    uint64_t states;
+    uint64_t duplicates;
+
+    /* Nodes being expanded, and their children, `num_masks' for each */
+    SearchNode* batch[SEARCH_BATCH];
+    SearchChild* children;
+    uint32_t batch_num;
+    uint32_t batch_next;
+
+    /* Worker threads, besides the caller of `search_run' */
+    pthread_t* workers;
+    pthread_barrier_t start, done;
+    bool quit;
+} Search;
+
+/*----------------------------------------------------------------------------*/
+
+static bool node_before(const SearchNode* a, const SearchNode* b) {
+    if (a->score != b->score)
+        return a->score < b->score;
+    if (a->depth != b->depth)
+        return a->depth < b->depth;
+    return a->seq < b->seq;
+}
+
+static void heap_push(Search* s, SearchNode* node) {
+    if (s->heap_num >= s->heap_cap) {
+        s->heap_cap = (s->heap_cap == 0) ? 1024 : s->heap_cap * 2;
+        s->heap     = realloc(s->heap, s->heap_cap * sizeof(SearchNode*));
+    }
+
+    node->seq = s->next_seq++;
+
+    uint32_t i = s->heap_num++;
+    while (i > 0) {
+        const uint32_t parent = (i - 1) / 2;
+        if (!node_before(node, s->heap[parent]))
+            break;
+
+        s->heap[i] = s->heap[parent];
+        i          = parent;
+    }
+    s->heap[i] = node;
+}
+
+static SearchNode* heap_pop(Search* s) {
+    SearchNode* top  = s->heap[0];
+    SearchNode* last = s->heap[--s->heap_num];
+
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= s->heap_num)
+            break;
+        if (child + 1 < s->heap_num &&
+            node_before(s->heap[child + 1], s->heap[child]))
+            child++;
+        if (!node_before(s->heap[child], last))
+            break;
+
+        s->heap[i] = s->heap[child];
+        i          = child;
+    }
+    if (s->heap_num > 0)
+        s->heap[i] = last;
+
+    return top;
+}
+
+static uint32_t add_step(Search* s, uint32_t parent, uint16_t mask) {
+    if (s->steps_num >= s->steps_cap) {
+        s->steps_cap = (s->steps_cap == 0) ? 1024 : s->steps_cap * 2;
+        s->steps     = realloc(s->steps, s->steps_cap * sizeof(SearchStep));
+    }
+
+    s->steps[s->steps_num].parent = parent;
+    s->steps[s->steps_num].mask   = mask;
+    return s->steps_num++;
+}
+
+/* Add a hash to the visited set. Returns false if it was already there. Only
+ * called by the thread of `search_run', so the first of two equal states is
+ * always the one kept. */
+static bool visit(Search* s, uint64_t hash) {
+    if (hash == 0)
+        hash = 1;
+
+    for (uint64_t i = hash & s->visited_mask;; i = (i + 1) & s->visited_mask) {
+        if (s->visited[i] == 0) {
+            s->visited[i] = hash;
+            s->states++;
+            return true;
+        }
+
+        if (s->visited[i] == hash) {
+            s->duplicates++;
+            return false;
+        }
+    }
+}
+
+static uint32_t distance(const SearchParams* params, const CpuCtx* ctx) {
+    uint32_t sum = 0;
+    for (int i = 0; i < params->num_targets; i++)
+        sum += search_target_distance(&params->targets[i], ctx);
+
+    return sum;
+}
+
+/* Run every mask for a step from a node of the batch */
+static void expand(Search* s, uint32_t index) {
+    const SearchParams* params = s->params;
+    const SearchNode* parent   = s->batch[index];
+
+    for (int m = 0; m < params->num_masks; m++) {
+        SearchChild* out = &s->children[index * params->num_masks + m];
+        out->node        = NULL;
+        out->goal_frame  = 0;
+        out->hash        = 0;
+
+        SearchNode* node = malloc(sizeof(SearchNode));
+        memcpy(node, parent, sizeof(SearchNode));
+        node->depth++;
+
+        bool dead = false;
+        for (int f = 0; f < params->step_frames; f++) {
+            kb_store_mask(&node->ctx.kb, params->masks[m]);
+            if (state_hash_frame(&node->hash, &node->ctx) != TRAP_NONE) {
+                dead = true;
+                break;
+            }
+
+            node->score = distance(params, &node->ctx);
+            if (node->score == 0) {
+                out->goal_frame = f + 1;
+                break;
+            }
+        }
+
+        if (dead) {
+            free(node);
+            continue;
+        }
+
+        /* Only the hash is computed here. The visited set is updated when
+         * merging the children in order, so which of two equal states is
+         * kept doesn't depend on the threads. */
+        if (out->goal_frame == 0)
+            out->hash = state_hash_get(&node->hash, &node->ctx);
+
+        if (!params->best_first)
+            node->score = node->depth;
+
+        out->node = node;
+    }
+}
+
+/* Expand the nodes of the batch, taking one at a time. Other threads might be
+ * taking them at the same time. */
+static void run_batch(Search* s) {
+    for (;;) {
+        const uint32_t i =
+          __atomic_fetch_add(&s->batch_next, 1, __ATOMIC_RELAXED);
+        if (i >= s->batch_num)
+            return;
+
+        expand(s, i);
+    }
+}
+
+static void* worker_main(void* arg) {
+    Search* s = arg;
+
+    for (;;) {
+        pthread_barrier_wait(&s->start);
+        if (s->quit)
+            break;
+
+        run_batch(s);
+        pthread_barrier_wait(&s->done);
+    }
+
+    return NULL;
+}
+
+/* Store the sequence that ends with `goal_frame' frames of a step */
+static void store_result(Search* s, SearchResult* result, uint32_t step,
+                         int depth, int goal_frame) {
+    const int step_frames = s->params->step_frames;
+
+    result->found  = true;
+    result->frames = (uint64_t)(depth - 1) * step_frames + goal_frame;
+    result->masks  = malloc((result->frames + 1) * sizeof(uint16_t));
+
+    /* Walk back from the last step, which might not be whole */
+    uint64_t end = result->frames;
+    int frames   = goal_frame;
+    for (; step != 0; step = s->steps[step].parent) {
+        for (uint64_t f = end - frames; f < end; f++)
+            result->masks[f] = s->steps[step].mask;
+
+        end -= frames;
+        frames = step_frames;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+uint32_t search_target_distance(const SearchTarget* target, const CpuCtx* ctx) {
+    int diff = 0;
+
+    switch (target->kind) {
+        case TARGET_MEM:
+            diff = (int)ctx->mem[target->addr & MEM_MASK] - (int)target->value;
+            break;
+
+        case TARGET_REG:
+            diff = (int)ctx->V[target->addr & 0xF] - (int)target->value;
+            break;
+
+        case TARGET_PC:
+            return (ctx->PC == target->value) ? 0 : SEARCH_MISS_DISTANCE;
+
+        case TARGET_PIXEL:
+            return display_get_pixel(ctx->fb, target->addr % DISP_W,
+                                     target->y % DISP_H)
+                     ? 0
+                     : SEARCH_MISS_DISTANCE;
+
+        case TARGET_FB_HASH:
+            return (cpu_hash_fb(ctx) == target->value) ? 0
+                                                       : SEARCH_MISS_DISTANCE;
+    }
+
+    return (diff < 0) ? -diff : diff;
+}
+
+bool search_run(const CpuCtx* initial, const SearchParams* params,
+                SearchResult* result) {
+    memset(result, 0, sizeof(SearchResult));
+
+    if (params->num_masks < 1 || params->step_frames < 1)
+        return false;
+
+    Search s;
+    memset(&s, 0, sizeof(Search));
+    s.params = params;
+
+    /* Room for every state, plus what a batch adds after reaching the
+     * limit, at most half full */
+    uint64_t visited_sz = 1;
+    while (visited_sz < 2 * ((uint64_t)params->max_states +
+                             SEARCH_BATCH * params->num_masks))
+        visited_sz *= 2;
+
+    s.visited      = calloc(visited_sz, sizeof(uint64_t));
+    s.visited_mask = visited_sz - 1;
+    s.children     = malloc(SEARCH_BATCH * params->num_masks *
+                            sizeof(SearchChild));
+    if (s.visited == NULL || s.children == NULL) {
+        free(s.visited);
+        free(s.children);
+        return false;
+    }
+
+    const int threads = (params->threads > 1) ? params->threads : 1;
+    if (threads > 1) {
+        pthread_barrier_init(&s.start, NULL, threads);
+        pthread_barrier_init(&s.done, NULL, threads);
+
+        s.workers = malloc((threads - 1) * sizeof(pthread_t));
+        for (int i = 0; i < threads - 1; i++)
+            pthread_create(&s.workers[i], NULL, worker_main, &s);
+    }
+
+    SearchNode* root = malloc(sizeof(SearchNode));
+    memcpy(&root->ctx, initial, sizeof(CpuCtx));
+    state_hash_init(&root->hash, &root->ctx);
+    root->step  = add_step(&s, 0, 0);
+    root->depth = 0;
+    root->score = params->best_first ? distance(params, &root->ctx) : 0;
+    visit(&s, state_hash_get(&root->hash, &root->ctx));
+
+    if (distance(params, &root->ctx) == 0) {
+        result->found = true;
+        result->masks = malloc(sizeof(uint16_t));
+        free(root);
+    } else if (params->max_depth > 0) {
+        heap_push(&s, root);
+    } else {
+        free(root);
+    }
+
+    while (!result->found && s.heap_num > 0) {
+        if (s.states >= params->max_states) {
+            result->limit_reached = true;
+            break;
+        }
+
+        /* In breadth-first order, only expand one depth at a time, so the
+         * first sequence found is one of the shortest */
+        s.batch_num  = 0;
+        s.batch_next = 0;
+        do {
+            s.batch[s.batch_num++] = heap_pop(&s);
+        } while (s.batch_num < SEARCH_BATCH && s.heap_num > 0 &&
+                 (params->best_first ||
+                  s.heap[0]->depth == s.batch[0]->depth));
+
+        if (threads > 1) {
+            pthread_barrier_wait(&s.start);
+            run_batch(&s);
+            pthread_barrier_wait(&s.done);
+        } else {
+            run_batch(&s);
+        }
+        result->expanded += s.batch_num;
+
+        /* Take the children in order, so the result doesn't depend on the
+         * threads */
+        const SearchChild* goal = NULL;
+        for (uint32_t i = 0; i < s.batch_num * params->num_masks; i++) {
+            const SearchChild* child = &s.children[i];
+            if (child->node == NULL)
+                continue;
+
+            if (child->goal_frame > 0 &&
+                (goal == NULL || child->node->depth < goal->node->depth ||
+                 (child->node->depth == goal->node->depth &&
+                  child->goal_frame < goal->goal_frame)))
+                goal = child;
+        }
+
+        for (uint32_t i = 0; i < s.batch_num * params->num_masks; i++) {
+            SearchChild* child = &s.children[i];
+            if (child->node == NULL)
+                continue;
+
+            if (child->goal_frame == 0 && !visit(&s, child->hash)) {
+                free(child->node);
+                continue;
+            }
+
+            const SearchNode* parent = s.batch[i / params->num_masks];
+            child->node->step =
+              add_step(&s, parent->step, params->masks[i % params->num_masks]);
+
+            if (child == goal)
+                store_result(&s, result, child->node->step, child->node->depth,
+                             child->goal_frame);
+
+            if (goal == NULL && child->goal_frame == 0 &&
+                child->node->depth < (uint32_t)params->max_depth)
+                heap_push(&s, child->node);
+            else
+                free(child->node);
+        }
+
+        for (uint32_t i = 0; i < s.batch_num; i++)
+            free(s.batch[i]);
+    }
+
+    result->states     = s.states;
+    result->duplicates = s.duplicates;
+
+    if (threads > 1) {
+        s.quit = true;
+        pthread_barrier_wait(&s.start);
+
+        for (int i = 0; i < threads - 1; i++)
+            pthread_join(s.workers[i], NULL);
+
+        pthread_barrier_destroy(&s.start);
+        pthread_barrier_destroy(&s.done);
+        free(s.workers);
+    }
+
+    while (s.heap_num > 0)
+        free(heap_pop(&s));
+
+    free(s.heap);
+    free(s.steps);
+    free(s.visited);
+    free(s.children);
+    return true;
+}
+
+void search_result_free(SearchResult* result) {
+    free(result->masks);
+    result->masks = NULL;
+}
@@ -0,0 +1,617 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/util.h"
+#include "include/cpu.h"
+#include "include/display.h"
+#include "include/keyboard.h"
+#include "include/simd.h"
+
+/* Number of the memory page of an address, see SIMD_PAGE_SHIFT */
+#define PAGE_OF(ADDR) (((ADDR) & MEM_MASK) >> SIMD_PAGE_SHIFT)
+
+/* Replace the lanes of `DST' selected by the vector mask `M' with `VAL' */
+#define BLEND(DST, VAL, M) ((DST) = ((VAL) & (M)) | ((DST) & ~(M)))
+
+/* Access a lane of a vector in memory. Indexing the vector directly with a
+ * variable makes the compiler copy the whole vector to the stack. */
+#define LANE(VEC, LANE) (((__typeof__((VEC)[0])*)&(VEC))[LANE])
+
+/* Index of each lane, used for converting bit masks to vector masks */
+static const SimdU32 lane_index = {
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15,
+    16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+};
+
+#if SIMD_LANES != 32
+#error "lane_index and the lane bit masks assume 32 lanes"
+#endif
+
+/*----------------------------------------------------------------------------*/
+
+/* Convert a bit mask of lanes into a vector mask, with all the bits of the
+ * selected lanes set. */
+static inline SimdU32 mask32(uint32_t bits) {
+    return -(((SimdU32){ 0 } + bits) >> lane_index & 1);
+}
+
+/* Get a bit mask of the lanes of `vec' that are equal to `val'. Each half of
+ * the vector is reduced with OR, after keeping the bit of each lane. */
+static inline uint32_t bits_eq16(const SimdU16* vec, uint16_t val) {
+    typedef uint16_t Quarter __attribute__((vector_size(SIMD_LANES / 2)));
+
+    static const SimdU16 lane_bit = {
+        1 << 0,  1 << 1,  1 << 2,  1 << 3,  1 << 4,  1 << 5,  1 << 6,  1 << 7,
+        1 << 8,  1 << 9,  1 << 10, 1 << 11, 1 << 12, 1 << 13, 1 << 14, 1 << 15,
+        1 << 0,  1 << 1,  1 << 2,  1 << 3,  1 << 4,  1 << 5,  1 << 6,  1 << 7,
+        1 << 8,  1 << 9,  1 << 10, 1 << 11, 1 << 12, 1 << 13, 1 << 14, 1 << 15,
+    };
+
+    union {
+        SimdU16 all;
+        Quarter quarter[4];
+    } u;
+
+    u.all = (SimdU16)(*vec == val) & lane_bit;
+
+    /* Lanes 0..15 and 16..31 have the same bits, so reduce each of them */
+    const Quarter lo = u.quarter[0] | u.quarter[1];
+    const Quarter hi = u.quarter[2] | u.quarter[3];
+
+    uint32_t bits = 0;
+    for (int i = 0; i < SIMD_LANES / 4; i++)
+        bits |= lo[i] | ((uint32_t)hi[i] << 16);
+    return bits;
+}
+
+/* Get the context of a lane in a group */
+static inline CpuCtx* lane_ctx(SimdBatch* batch, SimdGroup* group, int lane) {
+    return &batch->ctx[(group - batch->groups) * SIMD_LANES + lane];
+}
+
+/* Bit mask of the lanes that might have a different opcode at `pc' than the
+ * ROM, see `dirty' */
+static inline uint32_t dirty_lanes(const SimdGroup* group, uint16_t pc) {
+    return group->dirty[PAGE_OF(pc)] | group->dirty[PAGE_OF(pc + 1)];
+}
+
+/* Read the opcode at `pc' for a lane. Pages that were never written are read
+ * from the shared copy of the ROM, which is more likely to be cached. */
+static inline uint16_t lane_fetch(SimdBatch* batch, SimdGroup* group,
+                                  int lane, uint16_t pc) {
+    const uint8_t* mem = batch->code;
+    if ((dirty_lanes(group, pc) >> lane) & 1)
+        mem = lane_ctx(batch, group, lane)->mem;
+
+    return (mem[pc] << 8) | mem[(pc + 1) & MEM_MASK];
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* Copy the registers of a lane into its context, or the other way around */
+static void lane_store(SimdGroup* group, int lane, CpuCtx* ctx) {
+    for (int i = 0; i < 16; i++)
+        ctx->V[i] = LANE(group->V[i], lane);
+
+    ctx->DT  = LANE(group->DT, lane);
+    ctx->ST  = LANE(group->ST, lane);
+    ctx->I   = LANE(group->I, lane);
+    ctx->PC  = LANE(group->PC, lane);
+    ctx->rng = LANE(group->rng, lane);
+}
+
+static void lane_load(SimdGroup* group, int lane, const CpuCtx* ctx) {
+    for (int i = 0; i < 16; i++)
+        LANE(group->V[i], lane) = ctx->V[i];
+
+    LANE(group->DT, lane)  = ctx->DT;
+    LANE(group->ST, lane)  = ctx->ST;
+    LANE(group->I, lane)   = ctx->I;
+    LANE(group->PC, lane)  = ctx->PC;
+    LANE(group->rng, lane) = ctx->rng;
+}
+
+/* Mark the memory pages written by a lane, see `dirty' */
+static inline void lane_written(SimdGroup* group, int lane, uint16_t addr,
+                                int sz) {
+    for (int i = 0; i < sz; i++)
+        group->dirty[PAGE_OF(addr + i)] |= 1u << lane;
+}
+
+/* Run a cycle of a single lane with `cpu_cycle'. If the lane traps, it's
+ * stopped. */
+static void lane_cycle(SimdBatch* batch, SimdGroup* group, int lane) {
+    CpuCtx* ctx       = lane_ctx(batch, group, lane);
+    const uint32_t bit = 1u << lane;
+
+    lane_store(group, lane, ctx);
+
+    /* Remember where the memory writes will land, see `dirty' */
+    const uint16_t opcode = cpu_fetch(ctx);
+    if ((opcode & 0xF0FF) == 0xF033)
+        lane_written(group, lane, ctx->I, 3);
+    else if ((opcode & 0xF0FF) == 0xF055)
+        lane_written(group, lane, ctx->I, ((opcode >> 8) & 0xF) + 1);
+
+    const ECpuTrap trap = cpu_cycle(ctx);
+    if (trap != TRAP_NONE) {
+        batch->trap[(group - batch->groups) * SIMD_LANES + lane] = trap;
+        group->active &= ~bit;
+    }
+
+    if (kb_get_status(&ctx->kb) != KB_NONE)
+        group->busy |= bit;
+    else
+        group->busy &= ~bit;
+
+    lane_load(group, lane, ctx);
+    batch->scalar_instrs++;
+}
+
+/* Execute the instructions that only need a few registers and the rest of the
+ * context directly on a lane, without copying all the registers. Returns false,
+ * without changing anything, if the instruction has to go through
+ * `cpu_cycle', including when it would trap. */
+static bool lane_exec(SimdBatch* batch, SimdGroup* g, int lane,
+                      uint16_t opcode) {
+    CpuCtx* ctx     = lane_ctx(batch, g, lane);
+    const uint8_t x = (opcode >> 8) & 0xF;
+    const uint8_t n = opcode & 0xF;
+
+    uint16_t pc = (LANE(g->PC, lane) + 2) & MEM_MASK;
+    uint16_t I  = LANE(g->I, lane);
+
+    /* Size of the memory range used at I, for checking it in MEM_TRAP mode */
+    int range = 0;
+
+    switch (opcode & 0xF0FF) {
+        case 0x00E0: /* CLS */
+            if (opcode != 0x00E0)
+                return false;
+            display_clear(ctx->fb);
+            break;
+
+        case 0x00EE: /* RET */
+            if (opcode != 0x00EE || ctx->SP == 0)
+                return false;
+            pc = ctx->stack[--ctx->SP];
+            break;
+
+        case 0xE09E: /* SKP Vx */
+        case 0xE0A1: /* SKNP Vx */
+            if (kb_is_held(&ctx->kb, LANE(g->V[x], lane) & 0xF) ==
+                ((opcode & 0xFF) == 0x9E))
+                pc = (pc + 2) & MEM_MASK;
+            break;
+
+        case 0xF033: /* LD B, Vx */
+            range = 3;
+            if (batch->mem_trap && I + range > MEM_SZ)
+                return false;
+
+            lane_written(g, lane, I, range);
+            ctx->mem[(I + 2) & MEM_MASK] = LANE(g->V[x], lane) % 10;
+            ctx->mem[(I + 1) & MEM_MASK] = LANE(g->V[x], lane) / 10 % 10;
+            ctx->mem[I & MEM_MASK]       = LANE(g->V[x], lane) / 100;
+            break;
+
+        case 0xF055: /* LD [I], Vx */
+        case 0xF065: /* LD Vx, [I] */
+            range = x + 1;
+            if (batch->mem_trap && I + range > MEM_SZ)
+                return false;
+
+            if ((opcode & 0xFF) == 0x55) {
+                lane_written(g, lane, I, range);
+                for (int i = 0; i <= x; i++)
+                    ctx->mem[(I + i) & MEM_MASK] = LANE(g->V[i], lane);
+            } else {
+                for (int i = 0; i <= x; i++)
+                    LANE(g->V[i], lane) = ctx->mem[(I + i) & MEM_MASK];
+            }
+
+            if (batch->quirks & QUIRK_MEM_INC_I)
+                I += x + 1;
+            else if (batch->quirks & QUIRK_MEM_INC_IX)
+                I += x;
+            break;
+
+        default:
+            switch (opcode >> 12) {
+                case 0x2: /* CALL addr */
+                    if (ctx->SP >= LENGTH(ctx->stack))
+                        return false;
+                    ctx->stack[ctx->SP++] = pc;
+                    pc                    = opcode & 0xFFF;
+                    break;
+
+                case 0xD: { /* DRW Vx, Vy, nibble */
+                    if (batch->mem_trap && I + n > MEM_SZ)
+                        return false;
+
+                    uint8_t bytes[16];
+                    for (int i = 0; i < n; i++)
+                        bytes[i] = ctx->mem[(I + i) & MEM_MASK];
+
+                    LANE(g->V[0xF], lane) = display_draw_sprite(
+                      ctx->fb, LANE(g->V[x], lane),
+                      LANE(g->V[(opcode >> 4) & 0xF], lane), bytes, n);
+                } break;
+
+                default:
+                    return false;
+            }
+            break;
+    }
+
+    LANE(g->PC, lane) = pc;
+    LANE(g->I, lane)  = I;
+    batch->scalar_instrs++;
+    return true;
+}
+
+/* Execute an opcode in the lanes of `bits', all of them at the same PC.
+ * Returns false, without changing anything, if the opcode has to be executed
+ * one lane at a time. */
+static inline __attribute__((always_inline)) bool
+exec_vector(SimdGroup* g, uint16_t opcode, uint32_t bits, const int quirks) {
+    const uint8_t x  = (opcode >> 8) & 0xF;
+    const uint8_t y  = (opcode >> 4) & 0xF;
+    const uint8_t n  = opcode & 0xF;
+    const uint8_t nn = opcode & 0xFF;
+
+    const SimdU32 m32 = mask32(bits);
+    const SimdU16 m16 = __builtin_convertvector(m32, SimdU16);
+    const SimdU8 m8   = __builtin_convertvector(m32, SimdU8);
+
+    /* Vector mask of the lanes that skip the next instruction */
+    SimdU8 skip = { 0 };
+
+    switch (opcode >> 12) {
+        case 0x1: /* JP addr */
+            BLEND(g->PC, (SimdU16){ 0 } + (opcode & 0xFFF), m16);
+            return true;
+
+        case 0x3: /* SE Vx, byte */
+            skip = (SimdU8)(g->V[x] == nn);
+            break;
+
+        case 0x4: /* SNE Vx, byte */
+            skip = (SimdU8)(g->V[x] != nn);
+            break;
+
+        case 0x5: /* SE Vx, Vy */
+            if (n != 0)
+                return false;
+            skip = (SimdU8)(g->V[x] == g->V[y]);
+            break;
+
+        case 0x9: /* SNE Vx, Vy */
+            if (n != 0)
+                return false;
+            skip = (SimdU8)(g->V[x] != g->V[y]);
+            break;
+
+        case 0x6: /* LD Vx, byte */
+            BLEND(g->V[x], (SimdU8){ 0 } + nn, m8);
+            break;
+
+        case 0x7: /* ADD Vx, byte */
+            BLEND(g->V[x], g->V[x] + nn, m8);
+            break;
+
+        case 0x8: {
+            const SimdU8 vx = g->V[x];
+            const SimdU8 vy = g->V[y];
+            SimdU8 result, flag;
+
+            switch (n) {
+                case 0x0: /* LD Vx, Vy */
+                    BLEND(g->V[x], vy, m8);
+                    break;
+
+                case 0x1: /* OR Vx, Vy */
+                case 0x2: /* AND Vx, Vy */
+                case 0x3: /* XOR Vx, Vy */
+                    result = (n == 1) ? (vx | vy) : (n == 2) ? (vx & vy)
+                                                             : (vx ^ vy);
+                    BLEND(g->V[x], result, m8);
+                    if (quirks & QUIRK_VF_RESET)
+                        BLEND(g->V[0xF], (SimdU8){ 0 }, m8);
+                    break;
+
+                case 0x4: /* ADD Vx, Vy */
+                    result = vx + vy;
+                    flag   = (SimdU8)(result < vx) & 1;
+                    BLEND(g->V[x], result, m8);
+                    BLEND(g->V[0xF], flag, m8);
+                    break;
+
+                case 0x5: /* SUB Vx, Vy */
+                    flag = (SimdU8)(vx >= vy) & 1;
+                    BLEND(g->V[x], vx - vy, m8);
+                    BLEND(g->V[0xF], flag, m8);
+                    break;
+
+                case 0x7: /* SUBN Vx, Vy */
+                    flag = (SimdU8)(vy >= vx) & 1;
+                    BLEND(g->V[x], vy - vx, m8);
+                    BLEND(g->V[0xF], flag, m8);
+                    break;
+
+                case 0x6:   /* SHR Vx {, Vy} */
+                case 0xE: { /* SHL Vx {, Vy} */
+                    const SimdU8 src = (quirks & QUIRK_SHIFT_VX) ? vx : vy;
+                    if (n == 0x6) {
+                        result = src >> 1;
+                        flag   = src & 1;
+                    } else {
+                        result = src << 1;
+                        flag   = src >> 7;
+                    }
+                    BLEND(g->V[x], result, m8);
+                    BLEND(g->V[0xF], flag, m8);
+                } break;
+
+                default:
+                    return false;
+            }
+        } break;
+
+        case 0xA: /* LD I, addr */
+            BLEND(g->I, (SimdU16){ 0 } + (opcode & 0xFFF), m16);
+            break;
+
+        case 0xC: { /* RND Vx, byte */
+            SimdU32 rng = g->rng;
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            BLEND(g->rng, rng, m32);
+            BLEND(g->V[x], __builtin_convertvector(rng, SimdU8) & nn, m8);
+        } break;
+
+        case 0xF:
+            switch (nn) {
+                case 0x07: /* LD Vx, DT */
+                    BLEND(g->V[x], g->DT, m8);
+                    break;
+
+                case 0x15: /* LD DT, Vx */
+                    BLEND(g->DT, g->V[x], m8);
+                    break;
+
+                case 0x18: /* LD ST, Vx */
+                    BLEND(g->ST, g->V[x], m8);
+                    break;
+
+                case 0x1E: /* ADD I, Vx */
+                    BLEND(g->I,
+                          g->I + __builtin_convertvector(g->V[x], SimdU16),
+                          m16);
+                    break;
+
+                case 0x29: /* LD F, Vx */
+                    BLEND(g->I,
+                          DIGITS_ADDR +
+                            __builtin_convertvector(g->V[x], SimdU16) *
+                              CHAR_SPRITE_H,
+                          m16);
+                    break;
+
+                default:
+                    return false;
+            }
+            break;
+
+        default:
+            return false;
+    }
+
+    /* Increment the Program Counter, and skip the next instruction if
+     * needed */
+    const SimdU16 step =
+      2 + (__builtin_convertvector(skip, SimdU16) & 2);
+    BLEND(g->PC, (g->PC + step) & MEM_MASK, m16);
+    return true;
+}
+
+/* Run one cycle in all the lanes of a group. Specialized for the quirks, and
+ * compiled for AVX2 as well, selected at run time. */
+static inline __attribute__((always_inline)) void
+group_cycle_quirks(SimdBatch* batch, SimdGroup* g, const int quirks) {
+    /* Lanes that go through `cpu_cycle', starting with the ones waiting for a
+     * key */
+    uint32_t scalar  = g->active & g->busy;
+    uint32_t pending = g->active & ~g->busy;
+
+    while (pending != 0) {
+        const int lane        = __builtin_ctz(pending);
+        const uint16_t pc     = LANE(g->PC, lane);
+        const uint16_t opcode = lane_fetch(batch, g, lane, pc);
+
+        /* Lanes at the same PC. The ones that wrote to that page might have a
+         * different opcode there. */
+        uint32_t same  = bits_eq16(&g->PC, pc) & pending;
+        uint32_t check = same & dirty_lanes(g, pc) & ~(1u << lane);
+        while (check != 0) {
+            const int other = __builtin_ctz(check);
+            check &= check - 1;
+
+            if (lane_fetch(batch, g, other, pc) != opcode)
+                same &= ~(1u << other);
+        }
+
+        pending &= ~same;
+
+        if (exec_vector(g, opcode, same, quirks)) {
+            batch->vector_instrs += __builtin_popcount(same);
+            continue;
+        }
+
+        while (same != 0) {
+            const int other = __builtin_ctz(same);
+            same &= same - 1;
+
+            if (!lane_exec(batch, g, other, opcode))
+                scalar |= 1u << other;
+        }
+    }
+
+    while (scalar != 0) {
+        const int lane = __builtin_ctz(scalar);
+        scalar &= scalar - 1;
+
+        lane_cycle(batch, g, lane);
+    }
+}
+
+#define DEFINE_GROUP_CYCLE(NAME, QUIRKS)                              \
+    __attribute__((target_clones("avx2", "default"))) static void    \
+    NAME(SimdBatch* batch, SimdGroup* g) {                           \
+        group_cycle_quirks(batch, g, QUIRKS);                        \
+    }
+
+/* The only quirks used by `exec_vector' */
+DEFINE_GROUP_CYCLE(group_cycle_none, 0)
+DEFINE_GROUP_CYCLE(group_cycle_reset, QUIRK_VF_RESET)
+DEFINE_GROUP_CYCLE(group_cycle_shift, QUIRK_SHIFT_VX)
+DEFINE_GROUP_CYCLE(group_cycle_both, QUIRK_VF_RESET | QUIRK_SHIFT_VX)
+
+static void group_cycle(SimdBatch* batch, SimdGroup* g) {
+    switch (batch->quirks & (QUIRK_VF_RESET | QUIRK_SHIFT_VX)) {
+        case 0:
+            group_cycle_none(batch, g);
+            break;
+        case QUIRK_VF_RESET:
+            group_cycle_reset(batch, g);
+            break;
+        case QUIRK_SHIFT_VX:
+            group_cycle_shift(batch, g);
+            break;
+        default:
+            group_cycle_both(batch, g);
+            break;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool simd_init(SimdBatch* batch, const CpuCtx* initial, uint32_t num) {
+    memset(batch, 0, sizeof(SimdBatch));
+
+    batch->num        = num;
+    batch->num_groups = (num + SIMD_LANES - 1) / SIMD_LANES;
+
+    /* The vectors need to be aligned to their size */
+    void* groups;
+    if (posix_memalign(&groups, sizeof(SimdU32),
+                       batch->num_groups * sizeof(SimdGroup)) != 0)
+        return false;
+    batch->groups = groups;
+
+    batch->ctx  = malloc(num * sizeof(CpuCtx));
+    batch->trap = calloc(num, sizeof(uint8_t));
+    if (batch->ctx == NULL || batch->trap == NULL) {
+        simd_free(batch);
+        return false;
+    }
+
+    simd_reset(batch, initial);
+    return true;
+}
+
+void simd_reset(SimdBatch* batch, const CpuCtx* initial) {
+    batch->quirks   = cpu_profile_quirks(initial->profile);
+    batch->mem_trap = initial->mem_mode == MEM_TRAP;
+    memcpy(batch->code, initial->mem, MEM_SZ);
+    memset(batch->groups, 0, batch->num_groups * sizeof(SimdGroup));
+
+    for (uint32_t i = 0; i < batch->num; i++) {
+        memcpy(&batch->ctx[i], initial, sizeof(CpuCtx));
+        simd_load(batch, i);
+    }
+}
+
+void simd_free(SimdBatch* batch) {
+    free(batch->groups);
+    free(batch->ctx);
+    free(batch->trap);
+    batch->groups = NULL;
+    batch->ctx    = NULL;
+    batch->trap   = NULL;
+}
+
+void simd_load(SimdBatch* batch, uint32_t i) {
+    SimdGroup* group   = &batch->groups[i / SIMD_LANES];
+    const int lane     = i % SIMD_LANES;
+    const uint32_t bit = 1u << lane;
+    const CpuCtx* ctx  = &batch->ctx[i];
+
+    lane_load(group, lane, ctx);
+
+    /* The caller might have changed the memory, so compare it with the
+     * ROM */
+    for (int page = 0; page < SIMD_PAGES; page++) {
+        const size_t start = page << SIMD_PAGE_SHIFT;
+        if (memcmp(&ctx->mem[start], &batch->code[start],
+                   1 << SIMD_PAGE_SHIFT) != 0)
+            group->dirty[page] |= bit;
+        else
+            group->dirty[page] &= ~bit;
+    }
+
+    if (kb_get_status(&ctx->kb) != KB_NONE)
+        group->busy |= bit;
+    else
+        group->busy &= ~bit;
+
+    group->active |= bit;
+    batch->trap[i] = TRAP_NONE;
+}
+
+void simd_store(SimdBatch* batch, uint32_t i) {
+    lane_store(&batch->groups[i / SIMD_LANES], i % SIMD_LANES,
+               &batch->ctx[i]);
+}
+
+uint32_t simd_frame(SimdBatch* batch, const uint16_t* keys) {
+    uint32_t stopped = 0;
+
+    for (uint32_t g = 0; g < batch->num_groups; g++) {
+        SimdGroup* group = &batch->groups[g];
+
+        /* Store the keys, which might wake up the lanes waiting for one */
+        if (keys != NULL) {
+            for (int lane = 0; lane < SIMD_LANES; lane++) {
+                const uint32_t i = g * SIMD_LANES + lane;
+                if (i >= batch->num || !((group->active >> lane) & 1))
+                    continue;
+
+                kb_store_mask(&batch->ctx[i].kb, keys[i]);
+                if (kb_get_status(&batch->ctx[i].kb) != KB_NONE)
+                    group->busy |= 1u << lane;
+                else
+                    group->busy &= ~(1u << lane);
+            }
+        }
+
+        for (int i = 0; i < CYCLES_PER_FRAME; i++)
+            group_cycle(batch, group);
+
+        /* Decrement the timers of the lanes that didn't trap, like
+         * `cpu_tick_timers' */
+        const SimdU8 m8 =
+          __builtin_convertvector(mask32(group->active), SimdU8);
+        BLEND(group->DT, group->DT + (SimdU8)(group->DT != 0), m8);
+        BLEND(group->ST, group->ST + (SimdU8)(group->ST != 0), m8);
+
+        stopped += __builtin_popcount(~group->active);
+    }
+
+    /* The missing lanes of the last group are never active */
+    return stopped - (batch->num_groups * SIMD_LANES - batch->num);
+}
@@ -0,0 +1,211 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "include/util.h"
+#include "include/cpu.h"
+#include "include/keyboard.h"
+#include "include/spec.h"
+
+/* Check if two machines are in the same state, except for the keys being
+ * held. While waiting for a key, the held keys don't change anything until
+ * one of them is released. */
+static bool same_but_held(const CpuCtx* a, const CpuCtx* b) {
+    static CpuCtx tmp;
+    memcpy(&tmp, a, sizeof(CpuCtx));
+    tmp.kb.held = b->kb.held;
+
+    return memcmp(&tmp, b, sizeof(CpuCtx)) == 0;
+}
+
+/* Run the branch of a key, publishing each frame as soon as it's finished */
+static void run_branch(Spec* spec, int key) {
+    SpecBranch* branch = &spec->branches[key];
+
+    /* The key is pressed and released, and nothing is held afterwards */
+    memcpy(&branch->start, &spec->base, sizeof(CpuCtx));
+    branch->start.kb.held = 0;
+    kb_store(&branch->start.kb, key, true);
+    kb_store(&branch->start.kb, key, false);
+
+    const CpuCtx* prev = &branch->start;
+    for (uint32_t i = 0; i < SPEC_FRAMES; i++) {
+        if (__atomic_load_n(&spec->abort, __ATOMIC_RELAXED))
+            return;
+
+        CpuCtx* cur = &branch->frames[i];
+        memcpy(cur, prev, sizeof(CpuCtx));
+        branch->traps[i] = cpu_frame_count(cur, &branch->retired[i]);
+        __atomic_store_n(&branch->num_frames, i + 1, __ATOMIC_RELEASE);
+
+        if (branch->traps[i] != TRAP_NONE)
+            return;
+        prev = cur;
+    }
+}
+
+static void* worker_main(void* arg) {
+    Spec* spec    = arg;
+    uint64_t seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&spec->lock);
+        while (spec->job == seen && !spec->quit)
+            pthread_cond_wait(&spec->cond, &spec->lock);
+        const bool quit = spec->quit;
+        seen            = spec->job;
+        pthread_mutex_unlock(&spec->lock);
+
+        if (quit)
+            return NULL;
+
+        for (;;) {
+            const uint32_t key =
+              __atomic_fetch_add(&spec->next_key, 1, __ATOMIC_RELAXED);
+            if (key >= SPEC_KEYS)
+                break;
+
+            run_branch(spec, key);
+        }
+
+        __atomic_fetch_sub(&spec->busy, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Copy the branches from the waiting machine, and wake up the workers */
+static void start_job(Spec* spec, const CpuCtx* ctx) {
+    memcpy(&spec->base, ctx, sizeof(CpuCtx));
+    for (int key = 0; key < SPEC_KEYS; key++)
+        spec->branches[key].num_frames = 0;
+
+    spec->next_key = 0;
+    spec->abort    = false;
+    spec->busy     = spec->threads;
+    spec->has_base = true;
+    spec->jobs++;
+
+    pthread_mutex_lock(&spec->lock);
+    spec->job++;
+    pthread_cond_broadcast(&spec->cond);
+    pthread_mutex_unlock(&spec->lock);
+}
+
+/*----------------------------------------------------------------------------*/
+
+Spec* spec_create(int threads) {
+    if (threads < 1)
+        threads = 1;
+
+    Spec* spec = calloc(1, sizeof(Spec));
+    if (spec == NULL)
+        return NULL;
+
+    spec->following = -1;
+    spec->threads   = threads;
+    spec->workers   = calloc(threads, sizeof(pthread_t));
+    pthread_mutex_init(&spec->lock, NULL);
+    pthread_cond_init(&spec->cond, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&spec->workers[i], NULL, worker_main, spec) != 0) {
+            ERR("Could not create the speculation threads.");
+            spec->threads = i;
+            spec_destroy(spec);
+            return NULL;
+        }
+    }
+
+    return spec;
+}
+
+void spec_destroy(Spec* spec) {
+    if (spec == NULL)
+        return;
+
+    pthread_mutex_lock(&spec->lock);
+    spec->quit = true;
+    __atomic_store_n(&spec->abort, true, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&spec->cond);
+    pthread_mutex_unlock(&spec->lock);
+
+    for (int i = 0; i < spec->threads; i++)
+        pthread_join(spec->workers[i], NULL);
+
+    pthread_mutex_destroy(&spec->lock);
+    pthread_cond_destroy(&spec->cond);
+    free(spec->workers);
+    free(spec);
+}
+
+ECpuTrap spec_frame(Spec* spec, CpuCtx* ctx, int* retired) {
+    ECpuTrap trap = TRAP_NONE;
+    bool copied   = false;
+
+    /* Keep following the branch if nothing changed since the last frame */
+    if (spec->following >= 0) {
+        const SpecBranch* branch = &spec->branches[spec->following];
+        const uint32_t num =
+          __atomic_load_n(&branch->num_frames, __ATOMIC_ACQUIRE);
+
+        if (spec->pos < num &&
+            memcmp(ctx, &branch->frames[spec->pos - 1], sizeof(CpuCtx)) == 0) {
+            memcpy(ctx, &branch->frames[spec->pos], sizeof(CpuCtx));
+            trap     = branch->traps[spec->pos];
+            *retired = branch->retired[spec->pos];
+
+            spec->pos++;
+            spec->frames_reused++;
+            copied = true;
+        } else {
+            spec->following = -1;
+        }
+    } else if (spec->has_base && kb_get_status(&ctx->kb) == KB_HAS_KEY) {
+        /* The waited key was just released */
+        const SpecBranch* branch = &spec->branches[ctx->kb.last_key];
+        const uint32_t num =
+          __atomic_load_n(&branch->num_frames, __ATOMIC_ACQUIRE);
+
+        if (num > 0 && memcmp(ctx, &branch->start, sizeof(CpuCtx)) == 0) {
+            memcpy(ctx, &branch->frames[0], sizeof(CpuCtx));
+            trap     = branch->traps[0];
+            *retired = branch->retired[0];
+
+            spec->following = ctx->kb.last_key;
+            spec->pos       = 1;
+            spec->hits++;
+            spec->frames_reused++;
+            copied = true;
+        }
+    }
+
+    if (!copied)
+        trap = cpu_frame_count(ctx, retired);
+
+    /* Stop the branches once the machine is not waiting in the same state */
+    const bool waiting = kb_get_status(&ctx->kb) == KB_WAITING;
+    if (spec->has_base && spec->following < 0 &&
+        !(waiting && same_but_held(ctx, &spec->base))) {
+        __atomic_store_n(&spec->abort, true, __ATOMIC_RELAXED);
+        spec->has_base = false;
+    }
+
+    /* Start a new job once the waiting machine stops changing, and the
+     * workers are done with the last one */
+    if (waiting && !spec->has_base && trap == TRAP_NONE &&
+        __atomic_load_n(&spec->busy, __ATOMIC_ACQUIRE) == 0 &&
+        same_but_held(ctx, &spec->prev))
+        start_job(spec, ctx);
+
+    memcpy(&spec->prev, ctx, sizeof(CpuCtx));
+    return trap;
+}
+
+void spec_print(const Spec* spec, FILE* fp) {
+    fprintf(fp, "Speculation: %llu jobs, %llu branches followed, %llu frames "
+                "copied\n",
+            (unsigned long long)spec->jobs, (unsigned long long)spec->hits,
+            (unsigned long long)spec->frames_reused);
+}
@@ -0,0 +1,115 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "include/util.h"
+#include "include/cpu.h"
+#include "include/statehash.h"
+
+/* Maximum number of rows written by DRW */
+#define MAX_SPRITE_H 15
+
+/* Finalizer of SplitMix64, so close inputs give unrelated hashes */
+static inline uint64_t mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static inline uint64_t hash_byte(uint16_t addr, uint8_t byte) {
+    return mix(((uint64_t)addr << 8) | byte);
+}
+
+static inline uint64_t hash_row(int y, uint64_t row) {
+    return mix(row ^ mix(MEM_SZ + y));
+}
+
+/*----------------------------------------------------------------------------*/
+
+void state_hash_init(StateHash* hash, const CpuCtx* ctx) {
+    hash->mem = 0;
+    for (int addr = 0; addr < MEM_SZ; addr++)
+        hash->mem += hash_byte(addr, ctx->mem[addr]);
+
+    hash->fb = 0;
+    for (int y = 0; y < DISP_H; y++)
+        hash->fb += hash_row(y, ctx->fb[y]);
+}
+
+ECpuTrap state_hash_cycle(StateHash* hash, CpuCtx* ctx) {
+    const uint16_t opcode = cpu_fetch(ctx);
+
+    /* Memory written by Fx33 and Fx55, starting at I */
+    int mem_sz = 0;
+    if ((opcode & 0xF0FF) == 0xF033)
+        mem_sz = 3;
+    else if ((opcode & 0xF0FF) == 0xF055)
+        mem_sz = ((opcode >> 8) & 0xF) + 1;
+
+    /* Rows written by DRW, starting at `row'. CLS writes all of them. */
+    int rows = 0, row = 0;
+    if ((opcode & 0xF000) == 0xD000) {
+        rows = opcode & 0xF;
+        row  = ctx->V[(opcode >> 4) & 0xF] % DISP_H;
+    } else if ((opcode & 0xF0FF) == 0x00E0) {
+        rows = DISP_H;
+    }
+
+    /* Remove the old values from the hash, and add the new ones once the
+     * instruction is done */
+    const uint16_t i = ctx->I;
+    uint8_t old_mem[16];
+    for (int j = 0; j < mem_sz; j++)
+        old_mem[j] = ctx->mem[(i + j) & MEM_MASK];
+
+    uint64_t old_fb[DISP_H];
+    for (int j = 0; j < rows; j++)
+        old_fb[j] = ctx->fb[(row + j) % DISP_H];
+
+    const ECpuTrap trap = cpu_cycle(ctx);
+
+    for (int j = 0; j < mem_sz; j++) {
+        const uint16_t addr = (i + j) & MEM_MASK;
+        hash->mem += hash_byte(addr, ctx->mem[addr]) -
+                     hash_byte(addr, old_mem[j]);
+    }
+
+    for (int j = 0; j < rows; j++) {
+        const int y = (row + j) % DISP_H;
+        hash->fb += hash_row(y, ctx->fb[y]) - hash_row(y, old_fb[j]);
+    }
+
+    return trap;
+}
+
+ECpuTrap state_hash_frame(StateHash* hash, CpuCtx* ctx) {
+    for (int i = 0; i < CYCLES_PER_FRAME; i++) {
+        const ECpuTrap trap = state_hash_cycle(hash, ctx);
+        if (trap != TRAP_NONE)
+            return trap;
+    }
+
+    cpu_tick_timers(ctx);
+    return TRAP_NONE;
+}
+
+uint64_t state_hash_get(const StateHash* hash, const CpuCtx* ctx) {
+    uint64_t h = FNV1A_INIT;
+
+    /* Field by field, since the padding of the context is undefined. The
+     * stack above SP is always written before it's read again. */
+    h = hash_fnv1a(h, ctx->V, sizeof(ctx->V));
+    h = hash_fnv1a(h, &ctx->I, sizeof(ctx->I));
+    h = hash_fnv1a(h, &ctx->DT, sizeof(ctx->DT));
+    h = hash_fnv1a(h, &ctx->ST, sizeof(ctx->ST));
+    h = hash_fnv1a(h, &ctx->PC, sizeof(ctx->PC));
+    h = hash_fnv1a(h, &ctx->SP, sizeof(ctx->SP));
+    h = hash_fnv1a(h, ctx->stack, ctx->SP * sizeof(ctx->stack[0]));
+    h = hash_fnv1a(h, &ctx->kb.status, sizeof(ctx->kb.status));
+    h = hash_fnv1a(h, &ctx->kb.last_key, sizeof(ctx->kb.last_key));
+    h = hash_fnv1a(h, &ctx->kb.held, sizeof(ctx->kb.held));
+    h = hash_fnv1a(h, &ctx->rng, sizeof(ctx->rng));
+
+    h = mix(h ^ hash->mem);
+    return mix(h ^ hash->fb);
+}
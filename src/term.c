@@ -0,0 +1,246 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "include/display.h"
+#include "include/keyboard.h"
+#include "include/term.h"
+
+/* Maximum size of the characters grid, for the half-block glyphs */
+#define GRID_W DISP_W
+#define GRID_H (DISP_H / 2)
+
+/* Worst case for a frame: every character changes, each one with a cursor
+ * movement and a 3-byte UTF-8 sequence. */
+#define OUTPUT_SZ (GRID_W * GRID_H * 16 + 64)
+
+static bool initialized = false;
+static struct termios old_termios;
+static int old_flags;
+
+static ETermGlyphs glyphs;
+static int grid_w, grid_h;
+
+/* Contents of each character in the terminal, as a bit mask of its pixels.
+ * Used for only writing the characters that changed. */
+static uint8_t grid[GRID_H][GRID_W];
+static bool grid_valid = false;
+
+/* Frames left until each key is released, see TERM_KEY_FRAMES */
+static int key_frames[16];
+
+/*----------------------------------------------------------------------------*/
+
+bool term_init(ETermGlyphs new_glyphs) {
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &old_termios) != 0)
+        return false;
+
+    /* Raw mode: no line buffering, no echo and no signals */
+    struct termios raw = old_termios;
+    raw.c_iflag &= ~(ICRNL | IXON);
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_cc[VMIN]  = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+    old_flags = fcntl(STDIN_FILENO, F_GETFL);
+    fcntl(STDIN_FILENO, F_SETFL, old_flags | O_NONBLOCK);
+
+    glyphs = new_glyphs;
+    if (glyphs == TERM_BRAILLE) {
+        grid_w = DISP_W / 2;
+        grid_h = DISP_H / 4;
+    } else {
+        grid_w = DISP_W;
+        grid_h = DISP_H / 2;
+    }
+
+    grid_valid  = false;
+    initialized = true;
+
+    /* Hide the cursor and clear the screen */
+    const char* init = "\x1B[?25l\x1B[2J";
+    if (write(STDOUT_FILENO, init, strlen(init)) < 0)
+        return false;
+
+    return true;
+}
+
+void term_restore(void) {
+    if (!initialized)
+        return;
+
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_termios);
+    fcntl(STDIN_FILENO, F_SETFL, old_flags);
+
+    /* Show the cursor, and move it below the display */
+    char buf[32];
+    const int len =
+      snprintf(buf, sizeof(buf), "\x1B[%d;1H\x1B[?25h\n", grid_h + 1);
+    if (write(STDOUT_FILENO, buf, len) < 0)
+        return;
+
+    initialized = false;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* Get the pixel mask of the character at (col,row) of the grid */
+static uint8_t get_cell(const uint64_t* fb, int col, int row) {
+    if (glyphs == TERM_HALF_BLOCK) {
+        const int y = row * 2;
+        return display_get_pixel(fb, col, y) |
+               (display_get_pixel(fb, col, y + 1) << 1);
+    }
+
+    /* Braille dots are numbered by columns, with the bottom row last:
+     *
+     *     1 4
+     *     2 5
+     *     3 6
+     *     7 8
+     */
+    static const int dot_bits[4][2] = {
+        { 0, 3 },
+        { 1, 4 },
+        { 2, 5 },
+        { 6, 7 },
+    };
+
+    const int x  = col * 2;
+    const int y  = row * 4;
+    uint8_t mask = 0;
+    for (int dy = 0; dy < 4; dy++)
+        for (int dx = 0; dx < 2; dx++)
+            if (display_get_pixel(fb, x + dx, y + dy))
+                mask |= 1 << dot_bits[dy][dx];
+
+    return mask;
+}
+
+/* Write the UTF-8 character for a cell mask into `dst', and return its
+ * length */
+static int put_glyph(char* dst, uint8_t mask) {
+    if (glyphs == TERM_HALF_BLOCK) {
+        switch (mask) {
+            default:
+            case 0:
+                dst[0] = ' ';
+                return 1;
+
+            case 1: /* U+2580, upper half block */
+                memcpy(dst, "\xE2\x96\x80", 3);
+                return 3;
+
+            case 2: /* U+2584, lower half block */
+                memcpy(dst, "\xE2\x96\x84", 3);
+                return 3;
+
+            case 3: /* U+2588, full block */
+                memcpy(dst, "\xE2\x96\x88", 3);
+                return 3;
+        }
+    }
+
+    /* U+2800 plus the dot mask */
+    const int codepoint = 0x2800 + mask;
+    dst[0]              = 0xE0 | (codepoint >> 12);
+    dst[1]              = 0x80 | ((codepoint >> 6) & 0x3F);
+    dst[2]              = 0x80 | (codepoint & 0x3F);
+    return 3;
+}
+
+void term_render(const uint64_t* fb) {
+    static char out[OUTPUT_SZ];
+    int len = 0;
+
+    /* Position of the terminal cursor, or -1 if unknown */
+    int cur_col = -1, cur_row = -1;
+
+    for (int row = 0; row < grid_h; row++) {
+        for (int col = 0; col < grid_w; col++) {
+            const uint8_t mask = get_cell(fb, col, row);
+            if (grid_valid && grid[row][col] == mask)
+                continue;
+
+            grid[row][col] = mask;
+
+            /* Only move the cursor if the last character we wrote was not
+             * the previous one */
+            if (cur_row != row || cur_col != col)
+                len += snprintf(&out[len], OUTPUT_SZ - len, "\x1B[%d;%dH",
+                                row + 1, col + 1);
+
+            len += put_glyph(&out[len], mask);
+            cur_row = row;
+            cur_col = col + 1;
+        }
+    }
+
+    grid_valid = true;
+
+    if (len > 0 && write(STDOUT_FILENO, out, len) < 0)
+        grid_valid = false;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* Get the CHIP-8 key associated to a character, or -1 if it has none. Same
+ * layout as the SDL window. */
+static int get_key(char c) {
+    switch (c) {
+        /* clang-format off */
+        case '1': return 0x1;
+        case '2': return 0x2;
+        case '3': return 0x3;
+        case '4': return 0xC;
+        case 'q': return 0x4;
+        case 'w': return 0x5;
+        case 'e': return 0x6;
+        case 'r': return 0xD;
+        case 'a': return 0x7;
+        case 's': return 0x8;
+        case 'd': return 0x9;
+        case 'f': return 0xE;
+        case 'z': return 0xA;
+        case 'x': return 0x0;
+        case 'c': return 0xB;
+        case 'v': return 0xF;
+        /* clang-format on */
+
+        default:
+            return -1;
+    }
+}
+
+bool term_poll_keys(Keyboard* kb) {
+    /* Release the keys that have been held long enough */
+    for (int key = 0; key < 16; key++) {
+        if (key_frames[key] > 0 && --key_frames[key] == 0)
+            kb_store(kb, key, false);
+    }
+
+    char buf[64];
+    ssize_t len;
+    while ((len = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < len; i++) {
+            /* Escape or Ctrl+C */
+            if (buf[i] == 0x1B || buf[i] == 0x03)
+                return false;
+
+            const int key = get_key(buf[i]);
+            if (key < 0)
+                continue;
+
+            kb_store(kb, key, true);
+            key_frames[key] = TERM_KEY_FRAMES;
+        }
+    }
+
+    return true;
+}
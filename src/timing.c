@@ -0,0 +1,149 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "include/cpu.h"
+#include "include/timing.h"
+
+/* Extra machine cycles when a skip instruction is taken */
+#define SKIP_TAKEN_CYCLES 4
+
+/*
+ * Approximate cost of each instruction in machine cycles, including the
+ * fetch and decode of the interpreter, indexed by the first nibble of the
+ * opcode. Groups whose cost depends on the rest of the opcode or on the state
+ * of the machine are handled in `timing_cost'.
+ */
+static const int base_cost[16] = {
+    [0x0] = 24,  /* CLS, RET */
+    [0x1] = 12,  /* JP addr */
+    [0x2] = 26,  /* CALL addr */
+    [0x3] = 10,  /* SE Vx, byte */
+    [0x4] = 10,  /* SNE Vx, byte */
+    [0x5] = 14,  /* SE Vx, Vy */
+    [0x6] = 6,   /* LD Vx, byte */
+    [0x7] = 10,  /* ADD Vx, byte */
+    [0x8] = 44,  /* Arithmetic and logic */
+    [0x9] = 14,  /* SNE Vx, Vy */
+    [0xA] = 12,  /* LD I, addr */
+    [0xB] = 22,  /* JP V0, addr */
+    [0xC] = 36,  /* RND Vx, byte */
+    [0xD] = 26,  /* DRW, plus the cost of each row */
+    [0xE] = 14,  /* SKP, SKNP */
+    [0xF] = 10,  /* Timers, I and memory, see below */
+};
+
+int timing_cost(const CpuCtx* ctx, uint16_t opcode) {
+    const uint8_t nibble1 = (opcode >> 12) & 0xF;
+    const uint8_t x       = (opcode >> 8) & 0xF;
+    const uint8_t byte2   = opcode & 0xFF;
+
+    switch (nibble1) {
+        case 0x0: {
+            /* CLS clears the 256 bytes of the display page, one on each
+             * machine cycle */
+            if (byte2 == 0xE0)
+                return base_cost[0x0] + 256;
+        } break;
+
+        case 0xD: {
+            /* Each row costs more when the sprite is not aligned to a byte,
+             * since it has to be shifted and written to two bytes of the
+             * display page. Clipped rows are not drawn. */
+            const int sx   = ctx->V[x] % 64;
+            const int sy   = ctx->V[(opcode >> 4) & 0xF] % 32;
+            int rows       = opcode & 0xF;
+            const int cost = (sx % 8 == 0) ? 22 : 38;
+
+            if (sy + rows > 32)
+                rows = 32 - sy;
+
+            return base_cost[0xD] + rows * cost;
+        }
+
+        case 0xF: {
+            switch (byte2) {
+                case 0x1E: /* ADD I, Vx */
+                    return 19;
+
+                case 0x29: /* LD F, Vx */
+                    return 20;
+
+                case 0x33: /* LD B, Vx, by repeated subtraction */
+                    return 84 + 16 * (ctx->V[x] / 100 + (ctx->V[x] / 10) % 10 +
+                                      ctx->V[x] % 10);
+
+                case 0x55: /* LD [I], Vx */
+                case 0x65: /* LD Vx, [I] */
+                    return 10 + 14 * (x + 1);
+
+                default:
+                    break;
+            }
+        } break;
+
+        default:
+            break;
+    }
+
+    return base_cost[nibble1];
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* Is the opcode one of the conditional skips? */
+static inline bool is_skip(uint16_t opcode) {
+    switch (opcode >> 12) {
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+        case 0xE:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void timing_init(VipTiming* timing) {
+    timing->balance      = 0;
+    timing->cycles       = 0;
+    timing->instructions = 0;
+}
+
+ECpuTrap timing_frame(VipTiming* timing, CpuCtx* ctx) {
+    timing->balance += VIP_BUDGET_CYCLES;
+
+    /* We are right after the vertical blank interrupt */
+    bool vblank = true;
+
+    while (timing->balance > 0) {
+        const uint16_t opcode = cpu_fetch(ctx);
+
+        /* DRW waits for the next interrupt, unless we just had one. The
+         * remaining cycles of this frame are lost. */
+        if ((opcode >> 12) == 0xD && !vblank) {
+            timing->balance = 0;
+            break;
+        }
+
+        int cost = timing_cost(ctx, opcode);
+
+        const uint16_t pc   = ctx->PC;
+        const ECpuTrap trap = cpu_cycle(ctx);
+        if (trap != TRAP_NONE)
+            return trap;
+
+        if (is_skip(opcode) && ctx->PC == ((pc + 4) & MEM_MASK))
+            cost += SKIP_TAKEN_CYCLES;
+
+        timing->balance -= cost;
+        timing->cycles += cost;
+        timing->instructions++;
+        vblank = false;
+    }
+
+    cpu_tick_timers(ctx);
+    return TRAP_NONE;
+}
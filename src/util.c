@@ -1,26 +1,9 @@
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
-#include "include/main.h"
 #include "include/util.h"
 
-void die(const char* fmt, ...) {
-    va_list va;
-    va_start(va, fmt);
-
-    vfprintf(stderr, fmt, va);
-    putc('\n', stderr);
-
-    if (g_cpu_ctx != NULL)
-        cpu_free(g_cpu_ctx);
-
-    if (g_window != NULL)
-        SDL_DestroyWindow(g_window);
-
-    SDL_Quit();
-    exit(1);
-}
-
 void err_msg(const char* func, const char* fmt, ...) {
     va_list va;
     va_start(va, fmt);
@@ -31,3 +14,14 @@ void err_msg(const char* func, const char* fmt, ...) {
 
     va_end(va);
 }
+
+uint64_t hash_fnv1a(uint64_t hash, const void* data, size_t sz) {
+    const uint8_t* bytes = data;
+
+    for (size_t i = 0; i < sz; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
@@ -0,0 +1,94 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "include/util.h"
+#include "include/watch.h"
+
+/* Events of a finished write, or of a file moved into the directory */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+bool watch_mode_from_str(const char* str, EReloadMode* mode) {
+    if (strcmp(str, "restart") == 0)
+        *mode = RELOAD_RESTART;
+    else if (strcmp(str, "replay") == 0)
+        *mode = RELOAD_REPLAY;
+    else
+        return false;
+
+    return true;
+}
+
+RomWatch* watch_start(const char* path) {
+    /* Split the path into the directory and the name */
+    char dir[4096];
+    const char* slash = strrchr(path, '/');
+    const char* name  = (slash != NULL) ? slash + 1 : path;
+    if (slash == NULL)
+        snprintf(dir, sizeof(dir), ".");
+    else if (slash == path)
+        snprintf(dir, sizeof(dir), "/");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+
+    RomWatch* watch = calloc(1, sizeof(RomWatch));
+    if (snprintf(watch->name, sizeof(watch->name), "%s", name) >=
+        (int)sizeof(watch->name)) {
+        ERR("File name too long: '%s'", name);
+        free(watch);
+        return NULL;
+    }
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) {
+        ERR("Could not start inotify.");
+        free(watch);
+        return NULL;
+    }
+
+    if (inotify_add_watch(watch->fd, dir, WATCH_EVENTS) < 0) {
+        ERR("Could not watch directory: '%s'", dir);
+        close(watch->fd);
+        free(watch);
+        return NULL;
+    }
+
+    return watch;
+}
+
+void watch_stop(RomWatch* watch) {
+    if (watch == NULL)
+        return;
+
+    close(watch->fd);
+    free(watch);
+}
+
+bool watch_poll(RomWatch* watch) {
+    /* Buffer aligned for the events, with room for several of them */
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    bool changed = false;
+    for (;;) {
+        const ssize_t len = read(watch->fd, buf, sizeof(buf));
+        if (len <= 0)
+            break;
+
+        for (ssize_t pos = 0; pos < len;) {
+            const struct inotify_event* event =
+              (const struct inotify_event*)&buf[pos];
+
+            if (event->len > 0 && (event->mask & WATCH_EVENTS) &&
+                strcmp(event->name, watch->name) == 0)
+                changed = true;
+
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return changed;
+}